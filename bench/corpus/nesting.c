@@ -0,0 +1,27 @@
+int nesting_starts_here;
+// A comment opened at the end of the first line reaches the end of the file */ /*
+// Comment delimiters hidden in strings, chars and line comments, which C doesn't nest */ /*
+// Every line leaves the comment state the way it found it, so opening or closing */ /*
+// a comment anywhere changes the highlighting of every line after it */ /*
+int a = 1; // */ int b = 2; /* tail
+" */ /* "
+" */ int c = 3; /* still inside or outside "
+x = y / *p; // */ /**/ /*
+const char *open_in_string = "/* not a comment"; // */ /*
+const char *close_in_string = "not a comment */ /*";
+const char *both = "/*" "/*/" "*/*"; // */ /*
+const char *escaped = "\"/* still a string \\\" */ /*\"";
+int g(int *p) { return *p**p; } // */ /**/ /**/ /**/ /*
+// /* /* /* a line comment with openers, */ /* then a close and an open
+"*//*"
+"*/ /**/ /**/ /*"
+" /**/ /***/ /****/ */ /* "
+" /* a */ /* b */ /* c */ */ /* "
+char q = '"'; // */ char r = '\''; /* '
+#define OPEN "/*" // */ /*
+#define CLOSE "*/ /*"
+int f(int *p) { return *p/ *p; } // */ /*
+// a long line comment: if while for return switch case break continue struct union typedef static const int char */ /* double float long short unsigned signed void
+
+" */ /* " " */ /* " " */ /* " " */ /* " " */ /* " " */ /* " " */ /* " " */ /* "
+// */ /*/ still open */ /* and open again
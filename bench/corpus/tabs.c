@@ -0,0 +1,46 @@
+/*	A file indented and aligned with tabs	*/
+#define	ONE		1	/* aligned with tabs	*/
+#define	TWO		2	/* aligned with tabs	*/
+#define	THREE		3	/* aligned with tabs	*/
+#define	TWENTY_THREE	23	/* aligned with tabs	*/
+
+struct	record	{
+	int		id;		/* identifier	*/
+	char		*name;		/* name		*/
+	double		weight;		/* weight	*/
+	unsigned long	flags;		/* flags	*/
+};
+
+int	deep(int a)	{
+	if (a) {
+		if (a > 1) {
+			if (a > 2) {
+				if (a > 3) {
+					if (a > 4) {
+						if (a > 5) {
+							if (a > 6) {
+								if (a > 7) {
+									if (a > 8) {
+										return	a;	/* nine tabs deep	*/
+									}
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	return	0;
+}
+
+/*	tab	separated	values	in	a	table	*/
+/*	id	name	count	price	total	flag	*/
+/*	1	apple	12	0.5	6	y	*/
+/*	2	banana	7	0.25	1.75	n	*/
+/*	3	cherry	1000	0.01	10	y	*/
+/*	a		b			c				d	*/
+/*								tabs only before this	*/
+			int	mixed_tabs = 1;	  	  	/* tabs and spaces	*/
+	 	 	int	alternating = 2;	 	 	/* space tab space tab	*/
+x	=	1;	y	=	2;	z	=	3;	w	=	4;	v	=	5;	u	=	6;
@@ -5,27 +5,128 @@
 #define _GNU_SOURCE // Enables all GNU extensions
 
 #include <ctype.h> // Access iscntrl()
+#include <dirent.h> // Access scandir(), alphasort(), struct dirent
+#ifdef __SSE2__
+#include <emmintrin.h> // Access __m128i, _mm_loadu_si128(), _mm_set1_epi8(), _mm_cmpeq_epi8(), _mm_and_si128(), _mm_or_si128(), _mm_movemask_epi8()
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNEL_AVX2 // Build AVX2 kernels, they're only used if the CPU turns out to support them
+#include <immintrin.h> // Access __m256i, _mm256_loadu_si256(), _mm256_set1_epi8(), _mm256_cmpeq_epi8(), _mm256_or_si256(), _mm256_movemask_epi8()
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define KERNEL_NEON // Build NEON kernels, every 64-bit ARM CPU has them
+#include <arm_neon.h> // Access uint8x16_t, vld1q_u8(), vdupq_n_u8(), vceqq_u8(), vshrq_n_u8(), vaddvq_u8(), vmaxvq_u8(), vorrq_u8()
+#endif
 #include <errno.h> // Access errno, EAGAIN
-#include <fcntl.h> // Access open(), O_RDWR, O_CREAT
-#include <stdio.h> // Access printf(), perror(), sscanf(), snprintf(), FILE, fopen(), getline(), vsnprintf()
+#include <fcntl.h> // Access open(), fcntl(), O_RDWR, O_CREAT, F_SETFL, O_NONBLOCK
+#include <limits.h> // Access INT_MAX
+#include <poll.h> // Access poll(), struct pollfd, POLLIN
+#include <pthread.h> // Access pthread_t, pthread_create(), pthread_mutex_t, pthread_mutex_lock(), pthread_mutex_unlock(), pthread_cond_t, pthread_cond_wait(), pthread_cond_broadcast()
+#include <signal.h> // Access sigaction(), struct sigaction, sigemptyset(), SIGWINCH, SA_RESTART
+#include <stdio.h> // Access printf(), perror(), sscanf(), snprintf(), FILE, fopen(), getline(), vsnprintf(), rename()
 #include <stdarg.h> // Access va_list, va_start(), va_end()
-#include <stdlib.h> // Access atexit(), exit(), realloc(), free(), malloc()
-#include <string.h> // Acess memcpy(), strlen(), strdup(), memmove(), strerror(), strstr(), memset(), strrchr(), strcmp(), strncmp()
+#include <stdlib.h> // Access atexit(), exit(), realloc(), free(), malloc(), mkstemp(), realpath(), strtoll(), atoi(), getenv(), setenv(), qsort()
+#include <string.h> // Acess memcpy(), strlen(), strdup(), memmove(), strerror(), strstr(), memset(), strrchr(), strcmp(), memchr(), memcmp()
+#ifdef __linux__
+#include <sys/inotify.h> // Access inotify_init1(), inotify_add_watch(), inotify_rm_watch(), struct inotify_event, IN_MODIFY, IN_NONBLOCK, IN_CLOEXEC
+#endif
 #include <sys/ioctl.h> // Access ioctl(), TIOCGWINSZ, struct winsize
-#include <sys/types.h> // Access ssize_t
+#include <sys/mman.h> // Access mmap(), munmap(), PROT_READ, MAP_PRIVATE, MAP_FAILED
+#include <sys/stat.h> // Access fstat(), stat(), fchmod(), umask(), struct stat, S_ISREG
+#include <sys/types.h> // Access ssize_t, mode_t
+#include <sys/uio.h> // Access writev(), struct iovec
+#include <sys/wait.h> // Access waitpid(), WIFEXITED, WEXITSTATUS
 #include <termios.h> // Access struct termios, tcgetattr(), tcsetattr(), ECHO, TCSAFLUSH, ICANON, ISIG, IXON, IEXTEN, ICRNL, OPOST, BRKINT, INPCK, ISTRIP, CS8, VMIN, VTIME
-#include <time.h> // Access time_t, time()
-#include <unistd.h> // Access read(), STDIN_FILENO, write(), ftruncate(), close()
+#include <time.h> // Access time_t, time(), clock_gettime(), struct timespec, CLOCK_MONOTONIC
+#include <unistd.h> // Access read(), STDIN_FILENO, write(), close(), fsync(), unlink(), pipe(), sysconf(), access(), pread()
 
 /*** defines ***/
 
 #define SIMPLE_TEXT_EDITOR_VERSION "0.0.1" // Version number for welcome message display
 #define TAB_STOP_LENGTH 8 // The length of a tab stop
 #define CONFIRM_QUIT_TIMES 3 // Require user to to quit 3 times to quit without saving
+#define HL_PROPAGATE_BUDGET_US 3000 // Time a keystroke may spend scanning comment state, the rest is done while idle
+#define HL_PROPAGATE_CHECK_ROWS 256 // Number of rows scanned between checks of the time budget
+#define HL_PROPAGATE_CHECK_BYTES (64 << 10) // Number of chars scanned between checks of the time budget, a long row is stopped partway
+#define INPUT_BUF_SIZE 4096 // Number of bytes of input read from the terminal at once
+#define PASTE_EMPTY_READS 10 // Timed out reads in a row, about a second, after which a paste without its end is given up on
+#define SEARCH_CHUNK_ROWS 16384 // Most rows a search worker scans at a time
+#define SEARCH_CHUNK_BYTES (1 << 20) // Most bytes a search worker scans at a time, smaller buffers are searched right away
+#define SEARCH_NARROW_MATCHES (1 << 18) // Most matches narrowed down on the main thread when the query grows, more are searched for again by the workers
+#define SEARCH_CANCEL_ROWS 1024 // Number of rows a search worker scans between checks for a cancelled search
+#define SEARCH_CANCEL_BYTES (1 << 20) // Number of bytes of one row a regex search scans between checks for a cancelled search
+#define SEARCH_MAX_THREADS 8 // Most search worker threads started, however many processors there are
+#define BENCH_SCREEN_ROWS 24 // Rows of the screen the benchmark draws into
+#define BENCH_SCREEN_COLS 80 // Columns of the screen the benchmark draws into
+#define BENCH_OPEN_ROUNDS 5 // Times each corpus is opened and highlighted from scratch
+#define BENCH_FOLLOW_LINES 1000 // Lines appended to a followed corpus in each round of the follow step
+#define BENCH_CORPUS_DIR "bench/corpus" // Directory of the checked-in files the benchmark repeats into corpora
+#define BENCH_SYNTAX_DIR "syntax" // Directory of the syntax files the benchmark highlights a sample with, unless SYNTAX_DIR_ENV names another
+#define BENCH_CORPUS_ENV "SIMPLE_TEXT_EDITOR_BENCH_CORPUS" // Environment variable naming another directory of benchmark files
+#define BENCH_TILE_BYTES (4 << 20) // Size a checked-in benchmark file is repeated up to
+#define BENCH_THRESHOLD_PERCENT 50 // Slowdown over the baseline in percent that makes a gated step a regression, perf-check runs the benchmark again before trusting one
+#define BENCH_NOISE_US 50 // Slowdowns of fewer microseconds than this are timer noise, not regressions
+#define PROFILE_BUCKETS 256 // Buckets of a latency histogram, four per power of two nanoseconds
+#define PROFILE_DUMP_FILE "simple-text-editor-profile.txt" // File the latency histograms are written to
+#define INPUT_BATCH_US 30000 // Longest time spent applying already arrived keys before drawing again
+#define SAVE_IOV_BATCH 1024 // Number of iovec entries handed to writev() at once when saving
+#define AUTOSAVE_SECS 30 // Seconds between backups of buffers with unsaved changes
+#define STATUS_MSG_SECS 5 // Seconds a status message stays in the message bar
+#define RESIZE_DELAY_US 20000 // Time to wait after a terminal resize for more of them before laying out the screen again
+#define FOLLOW_READ_SIZE (1 << 20) // Most bytes appended to a followed file that are added to its buffer at a time
+#define FOLLOW_POLL_US 250000 // Time between checks of a followed file's size where inotify isn't available
+#define AUTOSAVE_SUFFIX "~" // Appended to a file's name to get the name of its backup
 #define CTRL_KEY(k) ((k) & 0x1f) // CTRL keypress macro
+#ifdef EDITOR_PROFILE
+#define PROFILE_BEGIN(stage) long long profile_start_##stage = editorMonotonicNs() // Start timing a stage of the editor's work
+#define PROFILE_END(stage) editorProfileRecord(stage, editorMonotonicNs() - profile_start_##stage) // Add the time since PROFILE_BEGIN() to the stage's histogram
+#else
+#define PROFILE_BEGIN(stage) // Timing compiles out unless EDITOR_PROFILE is defined
+#define PROFILE_END(stage) ((void) 0)
+#endif
 #define HL_HIGHLIGHT_NUMBERS (1<<0) // Flag bit for numbers
 #define HL_HIGHLIGHT_STRINGS (1<<1) // Flag bit for strings
+#define LEX_MAX_QUOTES 4 // Most chars that can start a string in one filetype
+#define LEX_STATES (LEX_STRING + 2 * LEX_MAX_QUOTES) // Most states of a compiled lexer
+#define LEX_DELIM (1<<0) // Action bit for chars that may start a comment delimiter
+#define LEX_KEYWORD (1<<1) // Action bit for chars that may start a keyword
+#define SYNTAX_DIR ".simple-text-editor/syntax" // Directory in the home directory syntax files are loaded from
+#define SYNTAX_DIR_ENV "SIMPLE_TEXT_EDITOR_SYNTAX" // Environment variable naming another directory to load syntax files from
+#define SYNTAX_SUFFIX ".syntax" // Ending of the names of syntax files
+#define ROW_MAPPED (1<<0) // Flag bit for rows whose chars point into the memory-mapped file
+#define ROW_HL_STALE (1<<1) // Flag bit for rows whose hl needs to be computed again before drawing
+#define ROW_RENDER_ALIAS (1<<2) // Flag bit for rows without tabs whose render is their chars
+#define ROW_HL_RAW (1<<3) // Flag bit for rows whose hl holds one value per render char instead of runs
+#define ROW_LONG (1<<4) // Flag bit for rows too long to render and highlight in full, see LONG_LINE_MIN
+#define VIEW_INDEX_STEP 256 // Number of lines between the lines whose offset is kept in the line index of a file opened with -R
+#define VIEW_CACHE_ROWS 1024 // Number of lines of a file opened with -R that have an erow at a time
+#define VIEW_CACHE_BUCKETS 2048 // Number of hash buckets of the row cache of a file opened with -R, a power of two
+#define COL_INDEX_MIN_ROW 4096 // Rows at least this long get an index of render positions for cursor columns
+#define COL_INDEX_STEP 1024 // Number of chars between the checkpoints of the column index
+#define STATE_INDEX_STEP 4096 // Number of chars between the checkpoints of the lexer states of a long row
+#define MAP_MIN_SIZE (1 << 20) // Files at least this big are memory-mapped when opened, smaller ones are read into memory
+#define LONG_LINE_MIN (64 * 1024) // Rows at least this long are only rendered and highlighted where they're visible
+#define LONG_LINE_LOOKBACK 4096 // Chars before the visible part of a long row that are highlighted to get the state right
+#define LONG_LINE_MARGIN 256 // Chars after the visible part of a long row that are highlighted so words at the edge are whole
+#define HL_RUN_MAX 255 // Longest run of chars with the same highlighting stored in one hl entry
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0])) // Constant to store the length of the HLDB array
+#define IDLE_TASKS_LEN (sizeof(IDLE_TASKS) / sizeof(IDLE_TASKS[0])) // Number of idle tasks of the event loop
+#define BENCH_CORPORA_LEN (sizeof(BENCH_CORPORA) / sizeof(BENCH_CORPORA[0])) // Number of corpora the benchmark runs on
+#define BENCH_GATED_LEN (sizeof(BENCH_GATED) / sizeof(BENCH_GATED[0])) // Number of steps checked against the baseline
+#define ATTR_DEFAULT 39 // Screen cell attribute for the terminal's default text color
+#define ATTR_COLOR_MASK 0x7f // Bits of a screen cell attribute that hold the text color code
+#define ATTR_INVERSE 0x80 // Flag bit of a screen cell attribute for inverted colors
+#define CELL_BYTES 7 // Most bytes of UTF-8 text a screen cell holds, a char and the combining marks drawn over it
+#define FRAME_RUN_GAP 8 // Unchanged cells between two changed ones that are sent rather than moving the cursor
+#define POOL_CLASSES 17 // Number of size classes of row buffers that come from the pool
+#define POOL_LARGE POOL_CLASSES // Size class of row buffers too big for the pool
+#define POOL_SLAB_SIZE 65536 // Size of the slabs small row buffers are carved from
+#define UNDO_BLOCK_SIZE 65536 // Size of the blocks the undo log is allocated from
+#define UNDO_MAX_BYTES (32 << 20) // Most memory the undo log keeps, the oldest edits are forgotten past it
+#define UNDO_ALIGN 16 // Alignment of the entries in the undo log
+#define REGEX_MAX_STATES 2048 // Most DFA states a regex compiles to before it's rejected as too complex
+#define REGEX_MAX_PREFIX 64 // Longest literal prefix of a regex searched for before running its DFA
+#define REGEX_LOOKAHEAD 32 // Bytes without a match after which a match stops growing, unless it's longer than that already
 
 // Keys that move the cursor or page in the editor
 // Represent keys with large integer values out of 
@@ -40,7 +141,8 @@ enum editorKey {
     PAGE_DOWN,
     HOME_KEY,
     END_KEY,
-    DEL_KEY
+    DEL_KEY,
+    PASTE_KEY // Text pasted by the terminal, held in E.paste
 };
 
 // Contain the possible values of the erow highlight array
@@ -55,8 +157,118 @@ enum editorHighlight {
     HL_MATCH
 };
 
+// States of a compiled lexer, see editorLexerCompile()
+// Each state stands for what the hand-written highlighter used to keep in
+// flags: whether the last char was a separator, a number, or in a comment or string
+enum lexState {
+    LEX_SEP, // After a separator or at the start of the line, where numbers and keywords start
+    LEX_WORD, // After a char of a word
+    LEX_NUMBER, // After a char highlighted as a number
+    LEX_MLCOMMENT, // Inside a multi-line comment
+    LEX_STRING // Inside a string, then right after a backslash in it, for each quote char in turn
+};
+
+// Kinds of edits recorded in the undo log
+enum undoType {
+    UNDO_INSERT,
+    UNDO_DELETE
+};
+
+// Timers of the event loop, each goes off once every time it's armed
+enum editorTimer {
+    TIMER_STATUS, // The status message is due to disappear
+    TIMER_AUTOSAVE, // A buffer is due to be backed up
+    TIMER_RESIZE, // The terminal was resized and has stopped changing size
+    TIMER_FOLLOW, // Followed files without an inotify watch are due to be checked for growth
+    TIMERS // Number of timers
+};
+
+// Types of the nodes of a regex's nondeterministic automaton
+enum regexNodeType {
+    REGEX_CHAR, // Consumes a byte in the node's set and goes to out
+    REGEX_SPLIT, // Goes to both out and out1 without consuming anything
+    REGEX_EMPTY, // Goes to out without consuming anything
+    REGEX_MATCH // The pattern matched
+};
+
+// DFAs a regex is compiled to
+enum regexDfaKind {
+    REGEX_DFA_ANCHORED, // Matches starting at one position
+    REGEX_DFA_SEARCH, // Finds the end of the first match, wherever it starts
+    REGEX_DFA_REVERSE // Runs backwards from the end of a match to its start
+};
+
+#ifdef EDITOR_PROFILE
+// Stages of the editor's work whose latency is measured
+enum profileStage {
+    PROF_READ, // Decoding a key once its first byte arrived, editorReadKey() without the wait
+    PROF_KEY, // Applying a key in editorProcessKeypress()
+    PROF_SYNTAX, // Highlighting the rows about to be drawn in editorScroll()
+    PROF_DRAW, // Drawing the rows into the frame in editorDrawRows()
+    PROF_WRITE, // Sending the frame to the terminal in editorRefreshScreen()
+    PROF_FRAME, // All of editorRefreshScreen()
+    PROF_STAGES // Number of stages
+};
+#endif
+
 /*** data ***/
 
+// Slot in a compiled keyword table
+struct editorKeyword {
+    // The keyword without its trailing pipe char, null for an empty slot
+    const char *word;
+
+    // Length of the keyword
+    int len;
+
+    // HL_KEYWORD1 or HL_KEYWORD2
+    unsigned char hl;
+};
+
+// Keyword list of a filetype compiled into a hash table
+// Looking up a word costs the same no matter how many keywords the filetype has
+struct editorKeywordTable {
+    // Open addressing hash table, the number of slots is a power of two
+    struct editorKeyword *slots;
+    unsigned int mask;
+
+    // Length of the longest keyword, longer words are never looked up
+    int maxlen;
+
+    // Set for each char that starts at least one keyword
+    unsigned char first[256];
+};
+
+// Entry of the transition table of a compiled lexer
+struct lexEntry {
+    // State after the char
+    unsigned char next;
+
+    // Highlight of the char
+    unsigned char hl;
+
+    // LEX_DELIM and LEX_KEYWORD bits, for rules that have to look at the chars after it
+    unsigned char act;
+};
+
+// Highlighting rules of a filetype compiled into a state machine
+// Bytes that behave the same in every state share a class, so the table has a
+// row per state and a column per class, and most chars take a single lookup.
+// Only comment delimiters and keywords, which span several chars, are matched
+// by looking ahead from the chars the table marks with an action
+struct editorLexer {
+    // Class of each byte value
+    unsigned char cls[256];
+    int nclasses;
+
+    // Row of nclasses entries for each state
+    struct lexEntry table[LEX_STATES * 256];
+
+    // Comment delimiters and their lengths, 0 for the ones the filetype doesn't have
+    const char *scs, *mcs, *mce;
+    int scs_len, mcs_len, mce_len;
+};
+
 // Contain all the syntax highlighting information for a particular filetype
 struct editorSyntax {
     // Name of the filetype that will be displayed to the user
@@ -80,13 +292,86 @@ struct editorSyntax {
     // Bit field that contains flags for whether to highlight
     // numbers and whether to highlight strings for the filetype
     int flags;
+
+    // Chars that start and end a string, when strings are highlighted
+    char *quotes;
+
+    // The keywords and rules compiled by editorSelectSyntaxHighlight()
+    // the first time the filetype is used, null until then
+    struct editorKeywordTable *kwtable;
+    struct editorLexer *lexer;
+};
+
+// Checkpoint of a column index, a char of the row and its render position
+struct colCheckpoint {
+    // Offset of the start of a UTF-8 char and the render position before it
+    int cx;
+    int rx;
+
+    // Whether the chars up to the next checkpoint hold a tab
+    int tab;
+};
+
+// Render positions of about every COL_INDEX_STEP-th char of a long row
+// Lets the cursor column of a very long line be worked out from the
+// nearest checkpoint instead of from the start of the line
+// An edit only fills in the checkpoints around it and shifts the ones after it
+struct colIndex {
+    // Chars and length of the row the index is current for
+    const char *chars;
+    int size;
+
+    // Checkpoints in the order of their chars, the first one is at the start of the row
+    int n;
+    int cap;
+    struct colCheckpoint cp[];
+};
+
+// Checkpoint of a state index, where the lexer was in the row and the state it was in
+struct stateCheckpoint {
+    int at;
+    int state;
+};
+
+// Lexer states of about every STATE_INDEX_STEP-th char of a long row
+// Lets the comment state a row ends in be worked out again after an edit by
+// scanning from the checkpoint before it to the first one after it that the
+// lexer gets to in the same state, the rest of the row is scanned the same as before
+struct stateIndex {
+    // Lexer the states are of
+    const struct editorLexer *lexer;
+
+    // Checkpoints in the order of their chars, the first one is at the start of the row
+    // and the last one at its end, only the first valid ones are known to be current,
+    // the others are from before the last edit
+    int n;
+    int cap;
+    int valid;
+    struct stateCheckpoint cp[];
+};
+
+// Stretch of a row with UTF-8 text that is laid out on the screen as one piece
+// Either a run of ASCII chars other than tabs, one column and one render char each,
+// a tab, or a single char along with the combining marks drawn over it
+// A glyph ends where the next one starts
+struct rowGlyph {
+    // Offsets of its first char in chars and in render
+    int cx;
+    int ridx;
+
+    // Render position (screen column) it starts at
+    int rx;
+};
+
+// Glyphs of a row with chars other than ASCII, worked out once when the row is rendered
+// g[n] marks the end of the row, so the glyph at g[k] runs up to g[k + 1]
+struct rowGlyphs {
+    int n;
+    struct rowGlyph g[];
 };
 
 // Data type for storing a row of text in the editor
 typedef struct erow {
-    // Track row index
-    int idx;
-
     // Length
     int size;
 
@@ -98,23 +383,480 @@ typedef struct erow {
 
     // Contains the actual chars to draw on the screen for the row
     // Needed to render nonprintable control chars i.e. tabs
+    // Rows without tabs render as their chars, so render is the
+    // chars themselves and isn't null terminated (ROW_RENDER_ALIAS)
     char *render;
 
     // Store the highlighting of each line in an array
     // Need to know the highlighting for each row before displaying
     // and then re-highlight a line whenever it gets changed
-    // Stores integers in the range of 0-255, each value corresponds
-    // to a char in render and will indicate if the char is part of the
-    // string or a comment, number, and so on
+    // Stores integers in the range of 0-255 that indicate if a char
+    // in render is part of a string or a comment, number, and so on
+    // Kept as pairs of a run length and the value of the run's chars,
+    // editorHighlightExpand() turns them back into one value per char
+    // Rows with more runs than that saves keep one value per char (ROW_HL_RAW)
     unsigned char *hl;
 
     // Boolean variable to check if the line is part of 
     // an unclosed multi-line comment
     int hl_open_comment;
+
+    // Whether the line starts inside a multi-line comment,
+    // as of the last time its state was computed
+    int hl_entry;
+
+    // Bit field of ROW_* flags
+    // A ROW_MAPPED row doesn't own chars, they point into the mapped file
+    // and aren't null terminated until the row is first edited
+    // A ROW_HL_STALE row changed since hl was computed
+    int flags;
+
+    // Column index of a long row, built the first time the cursor needs it
+    // and brought up to date by editorUpdateRow() when the row's chars change
+    struct colIndex *cols;
+
+    // Lexer states of a row of at least LONG_LINE_MIN chars, built the first
+    // time its comment state is scanned and shifted by editorUpdateRow()
+    struct stateIndex *states;
+
+    // Screen layout of a row with UTF-8 text, null for rows that are all ASCII,
+    // where every char but a tab takes up one column
+    // Built by editorRenderRow(), so it's current whenever render is
+    struct rowGlyphs *glyphs;
+
+    // Size classes of the chars, render, hl and glyphs buffers, which come from the row memory pool
+    unsigned char charsclass;
+    unsigned char renderclass;
+    unsigned char hlclass;
+    unsigned char glyphclass;
 } erow;
 
+// Line of a file opened with -R that's in the row cache
+struct viewRow {
+    // The line's erow, first so the viewRow can be found from it
+    erow row;
+
+    // Line number of the row
+    int line;
+
+    // Whether the row's hl_entry is the line's real starting state, rather than
+    // plain code taken until the comment scan of the file gets to the line
+    int known;
+
+    // Slots used just before and after this one, and the next slot in the same hash bucket
+    int prev, next;
+    int hnext;
+};
+
+// File opened with -R, which is viewed straight from its mapping
+struct editorView {
+    char *map;
+    size_t len;
+
+    // Byte offset of every VIEW_INDEX_STEP-th line, in an array of indexcap entries
+    size_t *index;
+    int nindex;
+    int indexcap;
+
+    // Whether each indexed line starts inside a multi-line comment, known for the
+    // ones up to line E.hl_dirty, which the comment scan of the file got to
+    unsigned char *entry;
+
+    // Where the comment scan is: line scanline, which starts at offset scanpos
+    // and is scanlen chars long, -1 until it's looked up, and the lexer
+    // state after its first scanat chars
+    int scanline;
+    size_t scanpos;
+    int scanlen;
+    int scanat;
+    int scanstate;
+
+    // Number of lines of the file
+    int numrows;
+
+    // Row cache of VIEW_CACHE_ROWS slots, of which the first used are filled in,
+    // linked from the newest to the oldest used and hashed by line number
+    struct viewRow *rows;
+    int used;
+    int newest, oldest;
+    int buckets[VIEW_CACHE_BUCKETS];
+};
+
+// Free row buffer of the pool, linked into the free list of its size class
+struct poolFree {
+    struct poolFree *next;
+};
+
+// Pool the row buffers are allocated from
+struct editorPool {
+    // Free buffers of each size class
+    struct poolFree *free[POOL_CLASSES];
+
+    // Rest of the slab new buffers are carved from
+    char *slab;
+    size_t slableft;
+};
+
+// One character cell of the screen
+struct screenCell {
+    // UTF-8 text drawn in the cell, a char and the combining marks over it,
+    // padded with null bytes so cells can be compared with memcmp()
+    // Empty in the cell covered by the right half of a wide char
+    char ch[CELL_BYTES];
+
+    // Text color code combined with the ATTR_INVERSE flag
+    unsigned char attr;
+};
+
+// Block of the arena the undo log is bump allocated from
+// Entries are stored one after another after the header
+struct undoBlock {
+    // Next newer block
+    struct undoBlock *next;
+
+    // Bytes allocated for the block and bytes in use, the header included
+    size_t size;
+    size_t used;
+};
+
+// Edit recorded in the undo log, the text it inserted or deleted follows it in the arena
+struct undoEntry {
+    // UNDO_INSERT or UNDO_DELETE
+    int type;
+
+    // Where the text was inserted or deleted, as a row and an index into its chars
+    int y, x;
+
+    // Cursor position before the edit
+    int cy, cx;
+
+    // Length of the text, line breaks in it are '\n' chars
+    size_t len;
+
+    // Entries with the same group are undone and redone together
+    unsigned int group;
+
+    // The entries before and after in the order the edits were made
+    struct undoEntry *prev, *next;
+
+    // Block of the arena the entry is in
+    struct undoBlock *block;
+};
+
+// Undo and redo history
+struct editorUndo {
+    // Oldest and newest blocks of the arena and the bytes they take up
+    struct undoBlock *first, *last;
+    size_t bytes;
+
+    // Oldest and newest entries
+    struct undoEntry *oldest, *newest;
+
+    // Newest entry that isn't undone, null if all of them are
+    // The entries after it can be redone
+    struct undoEntry *current;
+
+    // Group of the newest entry
+    unsigned int group;
+
+    // Whether the next edit starts a new group rather than joining the run of the last one
+    int sealed;
+};
+
+// Node of a regex's nondeterministic automaton
+struct regexNode {
+    // One of the regexNodeType values
+    int type;
+
+    // Bit set of the bytes a REGEX_CHAR node consumes
+    unsigned char set[32];
+
+    // Nodes that come next, -1 if there's none
+    int out, out1;
+};
+
+// Piece of an automaton built for part of a regex
+// Its end node is a REGEX_EMPTY node whose out isn't set yet
+struct regexFrag {
+    int start;
+    int end;
+};
+
+// State of parsing a regex into an automaton
+struct regexParser {
+    // Next char of the pattern to parse
+    const char *pos;
+
+    // Description of what's wrong with the pattern, null if nothing is
+    const char *error;
+
+    // Nodes of the automaton built so far
+    struct regexNode *nodes;
+    int nnodes;
+    int nodecap;
+
+    // Whether the pattern ends with a $
+    int eol;
+};
+
+// One DFA of a compiled regex
+struct regexDfa {
+    // Transition table with nclasses entries per state, state 0 has no NFA nodes left in it
+    int *trans;
+
+    // Whether each state means a match was found
+    unsigned char *accept;
+    int nstates;
+
+    // State the DFA starts in
+    int start;
+};
+
+// Regex compiled into DFAs
+struct editorRegex {
+    // Byte classes, bytes that no part of the pattern tells apart share a class
+    unsigned char classof[256];
+    int nclasses;
+
+    // DFA matching from a given position, state 0 is the dead state
+    struct regexDfa dfa;
+
+    // DFA that lets a match begin at every byte, state 0 is where it starts
+    // One pass of it over a row finds where the first match ends
+    struct regexDfa search;
+
+    // DFA of the reversed pattern, run back from where a match ends to find
+    // where it starts, state 0 is the dead state
+    struct regexDfa reverse;
+
+    // Whether matches have to start at the start of a row or end at the end of it
+    int bol;
+    int eol;
+
+    // Bytes every match starts with
+    char prefix[REGEX_MAX_PREFIX];
+    int prefixlen;
+
+    // Set for each byte a match can start with
+    unsigned char first[256];
+
+    // Number of users, the search prompt and workers scanning with it
+    int refs;
+};
+
+// Position of one match of the search query
+struct searchMatch {
+    // Index of the row the match is on
+    int row;
+
+    // Index into the row's chars where the match starts
+    int cx;
+
+    // Number of chars matched
+    int len;
+};
+
+// Growable list of search matches
+struct searchMatchList {
+    struct searchMatch *matches;
+    int len;
+    int cap;
+};
+
+// Rows of the buffer handed to one search worker at a time
+struct searchChunk {
+    // Rows from start up to end, or a piece of the single row start
+    // when it's longer than SEARCH_CHUNK_BYTES, in which case only
+    // the matches starting from from up to to belong to the chunk
+    int start, end;
+    int from, to;
+
+    // Matches found in the chunk's rows in file order
+    struct searchMatchList found;
+
+    // Whether a worker finished scanning the chunk
+    int done;
+};
+
+// State of the incremental search while the search prompt is open
+struct editorSearch {
+    // Query the match list was built for
+    char *query;
+    size_t querylen;
+
+    // Every match of the query found so far in file order, overlapping ones included
+    struct searchMatchList list;
+
+    // Index into the list of the match the cursor is on, -1 if there's none
+    int current;
+
+    // Whether the search prompt is open
+    int active;
+
+    // Whether the query is a regex rather than a literal string
+    int regex_mode;
+
+    // Compiled query in regex mode, shared with the workers
+    struct editorRegex *regex;
+
+    // Why the query couldn't be compiled, null if it could
+    const char *error;
+
+    // Chunks of the background scan of a large buffer
+    // The ones before merged were appended to the list,
+    // the ones from nextchunk on weren't handed to a worker yet
+    struct searchChunk *chunks;
+    int nchunks;
+    int nextchunk;
+    int merged;
+
+    // How the buffer is split into chunks, worked out for the first scan
+    // after the prompt is opened and kept for the next ones
+    struct searchChunk *split;
+    int nsplit;
+
+    // Bumped whenever a scan is dropped, so workers can tell their chunk is no longer wanted
+    unsigned int gen;
+
+    // Number of workers scanning a chunk right now
+    int busy;
+
+    // Worker threads, started the first time a scan is split into chunks
+    pthread_t threads[SEARCH_MAX_THREADS];
+    int nthreads;
+
+    // Protects what's shared with the workers: query, querylen, regex, chunks, nchunks, nextchunk, gen and busy
+    pthread_mutex_t lock;
+
+    // Signaled when there are chunks to hand out and when the last busy worker is done
+    pthread_cond_t work;
+    pthread_cond_t idle;
+
+    // Pipe a worker writes a byte to after finishing a chunk, to wake up the main loop
+    int notify[2];
+};
+
+// Read-only mapping of an opened file that ROW_MAPPED rows point into
+// Stays mapped until the last row storage with rows in it is freed
+struct editorMap {
+    char *addr;
+    size_t len;
+    int refs;
+
+    // The mapped file stays open, so editorMapChanged() can notice
+    // another program changing its size or contents
+    int fd;
+    struct timespec mtime;
+};
+
+// Row storage of one buffer, or of several buffers showing the same unmodified file
+// Shared rows, along with their render, hl and column index, are only
+// read until one of the buffers edits them, which gives it a copy of its own
+struct editorStore {
+    // Number of buffers using the rows
+    int refs;
+
+    // Resolved path of the file the rows were read from or saved to, null if there's none
+    char *path;
+
+    // Mapping of the file the rows were read from, null if it wasn't mapped
+    struct editorMap *map;
+
+    // Number of bytes of the file when the rows were read from or saved to it
+    off_t size;
+};
+
+// File a buffer follows, whose bytes are added to the buffer as they're appended to it
+struct editorFollow {
+    // Descriptor the appended bytes are read from
+    int fd;
+
+    // Watch of the file, -1 if it's checked every FOLLOW_POLL_US instead
+    int wd;
+
+    // Number of bytes of the file that are in the buffer,
+    // and whether they end in the middle of a line
+    off_t offset;
+    int partial;
+
+    // Whether the file may have grown since it was last read
+    int pending;
+};
+
+// State of a buffer while another one is being edited
+// The buffer being edited keeps its state in E, where the rest of the
+// editor reads it, and is parked here when the user switches away from it
+struct editorBuffer {
+    unsigned int id;
+    int cx, cy, rx;
+    int rowoff, coloff;
+    int numrows;
+    erow *row;
+    int rowcap;
+    int gap, gaplen;
+    int hl_dirty, hl_dirty_end;
+    struct editorStore *store;
+    struct editorView *view;
+    struct editorFollow *follow;
+    char *filename;
+    int dirty;
+    int autosaved;
+    long long autosave_time;
+    struct editorSyntax *syntax;
+    struct editorUndo undo;
+};
+
+// Save being written by the save thread
+// The thread writes a snapshot of the buffer, which holds a reference to its
+// row storage, so the buffer can be edited, or even closed, in the meantime
+struct editorSaveJob {
+    // Rows to write, along with the id and dirty count of the buffer when the save started
+    struct editorBuffer snap;
+
+    // File the rows are written to, the buffer's file or its backup
+    char *filename;
+
+    // Whether the rows go to the backup rather than the file itself
+    int autosave;
+
+    // Taken away from the permissions of a new file, see E.umask
+    mode_t umask;
+
+    // Number of bytes written, or -1 with the error in err
+    long long len;
+    int err;
+
+    // Set by the thread once it's done with the file, protected by lock
+    int done;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+};
+
+#ifdef EDITOR_PROFILE
+// Latency histogram of one stage
+struct profileHist {
+    long long last; // Latest time, in nanoseconds
+    long long count;
+    long long total;
+    long long max;
+    long long buckets[PROFILE_BUCKETS];
+};
+
+// Latencies of every stage
+struct editorProfile {
+    struct profileHist stage[PROF_STAGES];
+
+    // Whether the message bar shows the latencies instead of the status message
+    int overlay;
+};
+#endif
+
 // Global struct to contain editor state
 struct editorConfig {
+    // Number that tells the buffer apart from the others for as long as it's open
+    unsigned int id;
+
     // Cursor's x and y position
     // cx is an index into the chars field of an erow
     int cx, cy;
@@ -143,8 +885,35 @@ struct editorConfig {
     int numrows;
 
     // Pointer to array of erow structs to store multiple lines
+    // The array is a gap buffer: rows before the gap are stored at the front,
+    // rows after the gap are stored at the back, so inserting or deleting
+    // a line near the last edit point only moves the gap instead of every row
     erow *row;
 
+    // Number of erow slots allocated for the row array
+    int rowcap;
+
+    // Row index where the gap starts and the number of free slots in it
+    int gap;
+    int gaplen;
+
+    // First row whose cached comment state may be out of date
+    // All the rows before it are up to date, it's numrows or more when every row is
+    int hl_dirty;
+
+    // Rows from hl_dirty up to hl_dirty_end were edited and have to be scanned again,
+    // past it a row only needs to be scanned when the row before it changed state
+    int hl_dirty_end;
+
+    // Storage the rows belong to, which other buffers may share
+    struct editorStore *store;
+
+    // File opened with -R whose rows come from the row cache, null when editing
+    struct editorView *view;
+
+    // File whose appended bytes are added to the rows, null if it isn't followed
+    struct editorFollow *follow;
+
     // Stores the filename when a file is opened 
     char *filename;
 
@@ -152,17 +921,97 @@ struct editorConfig {
     // Used for displaying messages to the user and prompt for input
     char statusmsg[80];
 
-    // Timestamp for when the status message is set
-    time_t statusmsg_time;
+    // Monotonic time, in microseconds, the status message was set
+    long long statusmsg_time;
 
     // Track whether the text loaded in the editor differs from 
     // what is in the file since opening or saving
     int dirty;
 
+    // Value of dirty when the buffer was last backed up and the monotonic time,
+    // in microseconds, its last backup was started
+    int autosaved;
+    long long autosave_time;
+
     // Pointer to the current editor syntax
     // Null means there's no filetype for the current file,
     // so no syntax highlighting should be done
     struct editorSyntax *syntax;
+
+    // Filetypes loaded from syntax files at startup
+    struct editorSyntax *syntaxes;
+    unsigned int nsyntaxes;
+
+    // Cells of the frame being drawn and of the last frame sent to the terminal
+    // Both hold screenrows + 2 rows, for the status bar and the message bar
+    struct screenCell *frame;
+    struct screenCell *shadow;
+
+    // Whether the shadow frame matches what the terminal shows
+    int shadow_valid;
+
+    // Bytes read from the terminal that haven't been decoded into keys yet
+    char inbuf[INPUT_BUF_SIZE];
+    int inlen;
+    int inpos;
+
+    // Text of the last bracketed paste
+    char *paste;
+    size_t pastelen;
+    size_t pastecap;
+
+    // Matches of the query in the search prompt
+    struct editorSearch search;
+
+    // Edits that can be undone and redone
+    struct editorUndo undo;
+
+    // Every open buffer, the one at curbuffer is the one in E
+    // and its slot is only filled in while it's parked
+    struct editorBuffer *buffers;
+    int numbuffers;
+    int curbuffer;
+
+    // Id given to the newest buffer
+    unsigned int lastid;
+
+    // Save being written in the background, null if there's none
+    struct editorSaveJob *save;
+
+    // Pipe the save thread writes a byte to when it's done, to wake up the main loop
+    int savenotify[2];
+
+    // The process's umask, read once at startup, since reading it means setting it
+    mode_t umask;
+
+    // Monotonic time, in microseconds, each timer goes off, 0 if it isn't armed
+    long long timers[TIMERS];
+
+    // Pipe the signal handler writes the number of a caught signal to, to wake up the main loop
+    int sigpipe[2];
+
+    // Inotify instance watching the followed files, -1 if none was created
+    int inotify;
+
+    // Memory the chars, render and hl of the rows come from
+    struct editorPool pool;
+
+    // One highlight value per char of the row being highlighted or drawn
+    unsigned char *hlbuf;
+    int hlbufcap;
+
+    // Render string of the visible part of the long row being drawn
+    char *winbuf;
+    int winbufcap;
+
+    // Glyphs of the row being laid out, see editorLayoutGlyphs()
+    struct rowGlyph *glyphbuf;
+    int glyphbufcap;
+
+#ifdef EDITOR_PROFILE
+    // Latencies of the stages of the editor's work
+    struct editorProfile profile;
+#endif
 };
 
 struct editorConfig E;
@@ -190,15 +1039,48 @@ struct editorSyntax HLDB[] = {
         C_HL_extensions,
         C_HL_keywords,
         "//", "/*", "*/",
-        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+        "\"'",
+        NULL,
+        NULL
     },
 };
 
 /*** function prototypes ***/
 
+erow *editorRowAt(int at);
+int editorRowIndex(erow *row);
+erow *editorViewRow(struct editorView *v, int at);
+int editorSyntaxPropagate(int upto, long long budget_us);
+int editorViewPropagate(struct editorView *v, int upto, long long budget_us);
+const char *editorSearchFind(const char *hay, size_t haylen, const char *needle, size_t len);
+int editorSearchCancelled(unsigned int gen);
+int editorSearchScanning();
+int editorSearchCollect();
+void editorFindShowMatch();
+void editorUndoRecord(int type, int y, int x, const char *text, size_t len, int run);
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
+void editorStoreUnshare();
+int editorSaveCollect();
+int editorAutosave();
+void editorAutosaveSchedule();
+long long editorMonotonicUs();
+void editorTimerArm(int timer, long long when);
+void editorWaitInput();
+int editorResize();
+int editorFollowPoll();
+int editorFollowPending();
+int editorFollowIdle();
+int editorFollowTruncated();
+void editorFollowCollect();
+void editorFollowStop();
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+#ifdef EDITOR_PROFILE
+long long editorMonotonicNs();
+void editorProfileRecord(int stage, long long ns);
+void editorProfileDrawOverlay();
+#endif
 
 /*** terminal ***/
 
@@ -217,6 +1099,9 @@ void die(const char *s) {
 
 // Restore original terminal attributes after enabling raw mode and exiting program
 void disableRawMode() {
+    // Turn bracketed paste back off
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
+
     // Discard any unread input before restoring terminal attributes
     if (tcsetattr(STDERR_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
         die("tcsetattr");
@@ -266,19 +1151,76 @@ void enableRawMode() {
     // Set the modified terminal attributes for standard input
     // TCSAFLUSH for applying changes after flushing input buffer to discard any unread input
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+
+    // Ask the terminal to wrap pasted text in <esc>[200~ and <esc>[201~
+    // so a paste can be inserted at once instead of key by key
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-// Read and return keypress inputs
-int editorReadKey() {
-    int nread;
-    char c;
+// Checks whether there's input waiting to be decoded without blocking
+int editorInputPending() {
+    if (E.inpos < E.inlen) return 1;
+
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
 
-    // Keep reading 1 byte from standard input into variable c until there are no more bytes to read
-    // read() returns number of bytes read, will return 0 when it reaches the end of a file
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+// Gets the next byte of input
+// Bytes are read from the terminal as many at a time as have arrived,
+// so a burst of input takes one read() instead of one per byte
+// Returns 0 if no byte arrived before read() timed out (around 0.1s)
+int editorReadByte(char *c) {
+    if (E.inpos == E.inlen) {
+        int nread = read(STDIN_FILENO, E.inbuf, INPUT_BUF_SIZE);
         if (nread == -1 && errno != EAGAIN) die("read");
+        if (nread <= 0) return 0;
+
+        E.inlen = nread;
+        E.inpos = 0;
+    }
+
+    *c = E.inbuf[E.inpos++];
+    return 1;
+}
+
+// Collects the text of a bracketed paste into E.paste
+// Called after <esc>[200~ and reads up to the closing <esc>[201~
+// The closing sequence never comes if the paste was cut short or <esc>[200~
+// was typed by hand, so after a while without input what arrived is taken as the paste
+void editorReadPaste() {
+    static const char end[] = "\x1b[201~";
+    const size_t endlen = sizeof(end) - 1;
+    char c;
+    int empty = 0;
+
+    E.pastelen = 0;
+
+    while (1) {
+        // Keep waiting while the terminal is still sending the paste
+        if (!editorReadByte(&c)) {
+            if (++empty >= PASTE_EMPTY_READS) return;
+            continue;
+        }
+        empty = 0;
+
+        if (E.pastelen == E.pastecap) {
+            E.pastecap = E.pastecap ? E.pastecap * 2 : 4096;
+            E.paste = realloc(E.paste, E.pastecap);
+            if (E.paste == NULL) die("realloc");
+        }
+        E.paste[E.pastelen++] = c;
+
+        // Stop once the paste ends with the closing sequence
+        if (E.pastelen >= endlen && !memcmp(&E.paste[E.pastelen - endlen], end, endlen)) {
+            E.pastelen -= endlen;
+            return;
+        }
     }
+}
 
+// Decodes the key that starts with the given byte of input
+// Reads the rest of an escape sequence as needed
+int editorDecodeKey(char c) {
     // Check if escape char is read
     if (c == '\x1b') {
         // Declare buffer to store escape sequence chars
@@ -286,27 +1228,37 @@ int editorReadKey() {
         
         // Read two more bytes into a buffer
         // If either of the reads timeout (around 0.1s), then assume
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        // the escape key was pressed on its own
+        if (!editorReadByte(&seq[0])) return '\x1b';
+        if (!editorReadByte(&seq[1])) return '\x1b';
         
         // Look to see if escape sequence is a special [ or O char
         // Depending on terminal emulator or OS, escape sequences can be <esc>[(int)~ or <esc>O(char)
         if (seq[0] == '[') {
             // Check if digit byte is between 0 and 9
-            // If it is, read the next byte and check for a tilde
-            // If it is a tilde, return the corresponding key if it's 1, 3, 4, 5, 6, 7, or 8
+            // If it is, read the rest of the number and check for a tilde
+            // If it is a tilde, return the corresponding key if it's 1, 3, 4, 5, 6, 7, or 8,
+            // or read the pasted text if it's 200 (start of a bracketed paste)
             // Otherwise, return corresponding key if it's A, B, C, D, H, or F
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                int num = seq[1] - '0';
+                while (1) {
+                    if (!editorReadByte(&seq[2])) return '\x1b';
+                    if (seq[2] < '0' || seq[2] > '9' || num > 1000) break;
+                    num = num * 10 + (seq[2] - '0');
+                }
                 if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
+                    switch (num) {
+                        case 1: return HOME_KEY;
+                        case 3: return DEL_KEY;
+                        case 4: return END_KEY;
+                        case 5: return PAGE_UP;
+                        case 6: return PAGE_DOWN;
+                        case 7: return HOME_KEY;
+                        case 8: return END_KEY;
+                        case 200:
+                            editorReadPaste();
+                            return PASTE_KEY;
                     }
                 }
             } else {
@@ -333,6 +1285,24 @@ int editorReadKey() {
     }
 }
 
+// Read and return keypress inputs
+int editorReadKey() {
+    char c;
+
+    // Keep waiting for a byte of input
+    // The event loop does the deferred work in the meantime
+    do {
+        editorWaitInput();
+    } while (!editorReadByte(&c));
+
+    // Decode the rest of the key
+    PROFILE_BEGIN(PROF_READ);
+    int key = editorDecodeKey(c);
+    PROFILE_END(PROF_READ);
+
+    return key;
+}
+
 // Get the cursor position for displaying
 int getCursorPosition(int *rows, int *cols) {
     // Buffer to hold escape sequence response for parsing
@@ -388,899 +1358,5857 @@ int getWindowSize(int *rows, int *cols) {
     }
 }
 
-/*** syntax highlighting ***/
+/*** event loop ***/
 
-// Checks if a character is considered a separator character
-int is_separator(int c) {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+// Status message timer, the message only has to disappear from the screen
+int editorStatusExpired() {
+    return 1;
 }
 
-// Highlight the characters in an erow
-void editorUpdateSyntax(erow *row) {
-    // Reallocate the needed memory since this might be a new row 
-    // or the row might be bigger than the last time we highlighted it
-    // The size of the hl array is the same as the render array
-    row->hl = realloc(row->hl, row->rsize);
+// What to do when each timer goes off, returns 1 if the screen has to be drawn again
+int (*TIMER_HANDLERS[TIMERS])() = {
+    editorStatusExpired,
+    editorAutosave,
+    editorResize,
+    editorFollowPoll
+};
 
-    // Set all of the chars to HL_NORMAL by default
-    // before we loop through the chars and set the digits
-    // Any unhighlighted chars will have a HL_NORMAL value
-    memset(row->hl, HL_NORMAL, row->rsize);
+// Arms a timer to go off at the given monotonic time, in microseconds
+void editorTimerArm(int timer, long long when) {
+    E.timers[timer] = when;
+}
 
-    // If filetype is set, return immediately after setting 
-    // the line to the default highlighting
-    if (E.syntax == NULL) return;
+// Runs the handlers of the timers that went off
+// Returns 1 if the screen has to be drawn again
+int editorTimersRun() {
+    long long now = editorMonotonicUs();
+    int redraw = 0;
 
-    // Make an alias for the keywords array in syntax struct 
-    char **keywords = E.syntax->keywords;
+    int t;
+    for (t = 0; t < TIMERS; t++) {
+        if (E.timers[t] == 0 || E.timers[t] > now) continue;
 
-    // Alias for the comment syntax for the file
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
+        // Disarm it first, the handler may arm it again
+        E.timers[t] = 0;
+        if (TIMER_HANDLERS[t]()) redraw = 1;
+    }
 
-    // Set the length of the string or 0 if the string is null
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
+    return redraw;
+}
 
-    // Track whether the previous char was a separator
-    // Set it to 1 (true) since we consider the beginning
-    // of the line to be a separator
-    int prev_sep = 1;
+// Returns the number of milliseconds until the next timer goes off, for poll()
+// -1 means no timer is armed, so poll() waits for as long as it takes
+int editorTimersTimeout() {
+    long long next = 0;
 
-    // Keep track of whether we're currently inside a string
-    int in_string = 0;
+    int t;
+    for (t = 0; t < TIMERS; t++) {
+        if (E.timers[t] != 0 && (next == 0 || E.timers[t] < next)) next = E.timers[t];
+    }
 
-    // Boolean to track if we're currently inside a multi-line
-    // comment (not used for single-line comments)
-    // Set to true if the previous row has an unclosed multi-line comment
-    // If that's the case, then the current row will start out 
-    // being highlighted as a multi-line comment
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+    if (next == 0) return -1;
 
-    int i = 0;
+    // Round up, so poll() doesn't wake up just before the timer is due
+    long long ms = (next - editorMonotonicUs() + 999) / 1000;
+    if (ms < 0) ms = 0;
+    if (ms > 1000000) ms = 1000000;
 
-    // Loop the the characters and set each char
-    // to a corresponding highlight integer/value
-    while (i < row->rsize) {
-        // Get the char in the render string
-        char c = row->render[i];
-
-        // Set the highlight type of the previous char
-        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
-
-        // Check if the comment line has a length and if we're not 
-        // in a string and if we're not in a multi-line comment
-        // If checks pass, use strncmp() to check if this character is the start 
-        // of a single-line comment, if so, set the memory block for the whole 
-        // rest of the line with HL_COMMENT and break out of the syntax highlighting loop
-        if (scs_len && !in_string && !in_comment) {
-            if (!strncmp(&row->render[i], scs, scs_len)) {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
-            }
-        }
+    return ms;
+}
 
-        // Check if multi-line comment start and end are non-null
-        // strings of length greater than 0 and check if we're not in a string since having a "/*" char
-        // inside a string doesn't usually start a comment
-        // Otherwise, check if we're at the start of a multi-line comment
-        if (mcs_len && mce_len && !in_string) {
-            // Check if we're currently in multi-line comment
-            if (in_comment) {
-                row->hl[i] = HL_MLCOMMENT;
-
-                // Check if we're at the end of a multi-line comment 
-                if (!strncmp(&row->render[i], mce, mce_len)) {
-                    // Highlight the whole multi-line end comment string
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-
-                    // Consume entire multi-line end comment string
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_sep = 1;
-                    continue;
-                } else {
-                    // If not at the end of the comment, consume
-                    // the current char we already highlighted
-                    i++;
-                    continue;
-                }
-            } else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-                // Highlight the whole multi-comment start string
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
+// Signal handler, hands the signal over to the main loop through the signal pipe
+// Only async-signal-safe calls are allowed here, so all it does is write()
+void editorSignalHandler(int signo) {
+    int saved_errno = errno;
+    unsigned char c = signo;
+    write(E.sigpipe[1], &c, 1);
+    errno = saved_errno;
+}
 
-                // Consume entire multi-line start comment string
-                i += mcs_len;
+// Starts catching the signals the main loop handles
+void editorSignalsInit() {
+    // Neither end may block, a full pipe already has a wakeup pending
+    if (pipe(E.sigpipe) == -1) die("pipe");
+    fcntl(E.sigpipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(E.sigpipe[1], F_SETFL, O_NONBLOCK);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+}
 
-                // We're in a multi-line comment, so set the flag to true
-                in_comment = 1;
-                continue;
-            }
+// Handles the signals caught since the last call
+// A window manager sends a stream of SIGWINCH while the terminal is
+// dragged to a new size, so they only push TIMER_RESIZE back and the
+// screen is laid out once, after the size stopped changing
+void editorSignalsRun() {
+    unsigned char buf[64];
+    ssize_t n;
+
+    while ((n = read(E.sigpipe[0], buf, sizeof(buf))) > 0) {
+        for (ssize_t j = 0; j < n; j++) {
+            if (buf[j] == SIGWINCH) editorTimerArm(TIMER_RESIZE, editorMonotonicUs() + RESIZE_DELAY_US);
         }
+    }
+}
 
-        // Check if the strings should be highlighted for the current filetype
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-            // If we're in a string, then keep highlighting the 
-            // current character as a string until we hit the closing quote
-            // If we're not in a string, check if we’re at the beginning 
-            // of one by checking for a double- or single-quote, if we are,
-            // then store quote in in_string, highlight it with HL_STRING, and consume it
-            if (in_string) {
-                row->hl[i] = HL_STRING;
-
-                // If we’re in a string and the current character is a backslash, 
-                // and there’s at least one more character in that line that comes 
-                // after the backslash, then we highlight the character that comes 
-                // after the backslash with HL_STRING and consume it 
-                // Increment i by 2 to consume both characters at once.
-                if (c == '\\' && i + 1 < row->rsize) {
-                    row->hl[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
+// Whether the comment state left over from the last edits still has to be scanned
+int editorHighlightPending() {
+    return E.hl_dirty < E.numrows;
+}
 
-                // Check if current char is the closing quote
-                // If so, reset in_string flag to 0
-                if (c == in_string) in_string = 0;
+// Scans one time budget's worth of the comment state left over from the last edits
+// Returns 1 if rows on screen may have been drawn from a state that changed
+int editorHighlightIdle() {
+    int redraw = E.hl_dirty < E.rowoff + E.screenrows;
+    editorSyntaxPropagate(E.numrows, HL_PROPAGATE_BUDGET_US);
+    return redraw;
+}
 
-                // Since we highlighted the current character, we have to 
-                // consume it by incrementing i and continuing out of the current loop iteration
-                // Set prev_sep to 1 so that if we’re done highlighting the string, 
-                // the closing quote is considered a separator
-                i++;
-                prev_sep = 1;
-                continue;
-            } else {
-                if (c == '"' || c == '\'') {
-                    in_string = c;
-                    row->hl[i] = HL_STRING;
-                    i++;
-                    continue;
-                }
-            }
-        }
+// Deferred work done a slice at a time while there's no input
+// pending() tells whether the task has work left, run() does a slice of it
+// and returns 1 if the screen has to be drawn again
+struct idleTask {
+    int (*pending)();
+    int (*run)();
+};
 
-        // Check if the numbers should be highlighted for the current filetype
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-            // Digits/numbers/decimals
-            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) || (c == '.' && prev_hl == HL_NUMBER)) {
-                row->hl[i] = HL_NUMBER;
-                i++;
-                prev_sep = 0;
-                continue;
-            }
-        }
+struct idleTask IDLE_TASKS[] = {
+    { editorFollowPending, editorFollowIdle },
+    { editorHighlightPending, editorHighlightIdle }
+};
 
-        // Keywords require separator before and after the keyword
-        // Otherwise the keyword substring in other strings would be highlighted 
-        // Check to make sure a separator came before the keyword prior to 
-        // looping through each possible keyword 
-        if (prev_sep) {
-            int j;
-            
-            // Loop through each keyword
-            for (j = 0; keywords[j]; j++) {
-                // Store the length of the keyword
-                int klen = strlen(keywords[j]);
-
-                // If it's a secondary keyword, decrement
-                // length to account for the pipe char
-                int kw2 = keywords[j][klen - 1] == '|';
-                if (kw2) klen--;
-                
-                // Check if keyword exists at current position in text
-                // and check if a separator char comes after the keyword
-                // Since null char is considered a separator, this works 
-                // at the very end of the line
-                if (!strncmp(&row->render[i], keywords[j], klen) && is_separator(row->render[i + klen])) {
-                    // We have a keyword to highlight 
-                    // Highlight whole keyword at once depending on the value of kw2
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-
-                    // Consume entire keyword by incrementing i by length of keyword
-                    i += klen;
-
-                    // Break because we're in an inner loop, so break before
-                    // continuing the outer loop 
-                    break;
-                }
-            }
+// Gives each idle task with work left a slice of time
+// Sets *redraw if the screen has to be drawn again
+// Returns 1 if some task still has work left
+int editorIdleRun(int *redraw) {
+    int busy = 0;
 
-            // Check if the loop was broken out by seeing
-            // if it got to the terminating null value
-            // If it was broken out of, continue
-            if (keywords[j] != NULL) {
-                prev_sep = 0;
-                continue;
-            }
-        }
+    size_t j;
+    for (j = 0; j < IDLE_TASKS_LEN; j++) {
+        if (!IDLE_TASKS[j].pending()) continue;
 
-        // If no char was highlighted, set the current char
-        // according to whether it's a separator or not
-        prev_sep = is_separator(c);
-        i++;
+        if (IDLE_TASKS[j].run()) *redraw = 1;
+        if (IDLE_TASKS[j].pending()) busy = 1;
     }
 
-    // Set boolean flag to whether or not the user commmented out a
-    // part of the file
-    int changed = (row->hl_open_comment != in_comment);
-
-    // Set the value of the current row’s hl_open_comment to 
-    // whatever state in_comment is after processing the entire row
-    row->hl_open_comment = in_comment;
-
-    // Check if line got changed and and if there is a next line in the file
-    if (changed && row->idx + 1 < E.numrows)
-        // Highlight the commented out row as a multi-line comment
-        // Because editorUpdateSyntax() keeps calling itself with the next line, 
-        // the change will continue to propagate to more and more lines until 
-        // one of them is unchanged, at which point we know that all the lines 
-        // after that one must be unchanged as well.
-        editorUpdateSyntax(&E.row[row->idx + 1]);
+    return busy;
 }
 
-// Maps the highlight values to corresponding color codes
-int editorSyntaxToColor(int hl) {
-    switch (hl) {
-        // Numbers are highlighted red
-        case HL_NUMBER: return 31;
+// Runs the event loop until a byte of input can be read
+// Timers, signals, followed files and the wakeups of the search workers and the save thread are
+// handled as they come, and idle tasks get a slice of time between checks
+// for input. With nothing left to do, poll() sleeps until the next key,
+// wakeup or timer, so an idle editor doesn't use any CPU
+void editorWaitInput() {
+    int redraw = 0;
 
-        // Strings are highlighted magenta
-        case HL_STRING: return 35;
+    while (E.inpos == E.inlen) {
+        redraw |= editorTimersRun();
 
-        // Comments are highlighted as cyan
-        case HL_COMMENT:
-        case HL_MLCOMMENT: return 36;
+        int busy = editorIdleRun(&redraw);
 
-        // Specify two keyword types
-        // Actual keywords in one color (yellow) and 
-        // common type names in another color (green)
-        case HL_KEYWORD1: return 33;
-        case HL_KEYWORD2: return 32;
+        // Show what changed before going to sleep
+        if (redraw) {
+            editorRefreshScreen();
+            redraw = 0;
+        }
 
-        // Search results are highlighted blue
-        case HL_MATCH: return 34;
+        // The terminal and the signal pipe are always watched, the followed
+        // files once there are any, the workers and the save thread only while they're running
+        struct pollfd pfd[5];
+        int n = 0;
+        pfd[n++] = (struct pollfd) { STDIN_FILENO, POLLIN, 0 };
+        int sig = E.sigpipe[0] != -1 ? n++ : -1;
+        if (sig != -1) pfd[sig] = (struct pollfd) { E.sigpipe[0], POLLIN, 0 };
+        int search = editorSearchScanning() ? n++ : -1;
+        if (search != -1) pfd[search] = (struct pollfd) { E.search.notify[0], POLLIN, 0 };
+        int save = E.save != NULL ? n++ : -1;
+        if (save != -1) pfd[save] = (struct pollfd) { E.savenotify[0], POLLIN, 0 };
+        int follow = E.inotify != -1 ? n++ : -1;
+        if (follow != -1) pfd[follow] = (struct pollfd) { E.inotify, POLLIN, 0 };
+
+        // Only check for events while idle tasks still have work, otherwise sleep until the next timer
+        if (poll(pfd, n, busy ? 0 : editorTimersTimeout()) == -1) {
+            if (errno == EINTR) continue;
+            die("poll");
+        }
 
-        // Default is white
-        default: return 37;
+        if (sig != -1 && pfd[sig].revents) editorSignalsRun();
+        if (pfd[0].revents) return;
+        if (search != -1 && pfd[search].revents && editorSearchCollect()) redraw = 1;
+        if (save != -1 && pfd[save].revents && editorSaveCollect()) redraw = 1;
+        if (follow != -1 && pfd[follow].revents) editorFollowCollect();
     }
 }
 
-// Match the current filename to one of the filematch fields in the HLDB
-// to the set the appropriate syntax highlighting for a filetype
-void editorSelectSyntaxHighlight() {
-    // Set to null so if there's no matches, there's no filename and filetype
-    E.syntax = NULL;
+/*** row memory ***/
 
-    // If there's no filename, return immediately
-    if (E.filename == NULL) return;
-    
-    // Get the pointer to the extension part of the filename
-    // If there is none, this will be null
-    char *ext = strrchr(E.filename, '.');
-    
-    // Loop through each editorSyntax struct in the HLDB array
-    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-        // Get pointer to the struct
-        struct editorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
+// Bytes a buffer of each size class holds
+// Classes step up by half a power of two, so a buffer is at most a third bigger than asked for,
+// what's left over lets a row grow a few chars before it has to move
+const size_t POOL_CLASS_SIZE[POOL_CLASSES] = {
+    16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
 
-        // Loop through each pattern in the filematch array
-        while (s->filematch[i]) {
-            // Check if there's a file extension
-            int is_ext = (s->filematch[i][0] == '.');
-            
-            // If the pattern starts with a '.', we know it's a file extension
-            // and we see if the filename ends with that extension using strcmp()
-            // If it's not a file extension pattern, the we check to see if the 
-            // pattern exists anywhere in the filename using strstr()
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) || (!is_ext && strstr(E.filename, s->filematch[i]))) {
-                // Set syntax highlight to the current syntax struct
-                E.syntax = s;
+// Header in front of a buffer too big for the pool, which comes straight from malloc()
+// 16 bytes keep the buffer after it as aligned as malloc() would
+struct poolLarge {
+    size_t cap;
+    size_t pad;
+};
 
-                // Rehighlight the entire file after setting the syntax highlighting
-                int filerow;
-                for (filerow = 0; filerow < E.numrows; filerow++) {
-                    editorUpdateSyntax(&E.row[filerow]);
-                }
+// Returns the smallest size class that holds size bytes, or POOL_LARGE if none does
+unsigned char editorPoolClass(size_t size) {
+    unsigned char cls = 0;
+    while (cls < POOL_CLASSES && POOL_CLASS_SIZE[cls] < size) cls++;
+    return cls;
+}
 
-                return;
+// Returns the number of bytes a row buffer can hold
+size_t editorPoolCapacity(void *p, unsigned char cls) {
+    if (p == NULL) return 0;
+    if (cls == POOL_LARGE) return ((struct poolLarge *) p - 1)->cap;
+    return POOL_CLASS_SIZE[cls];
+}
+
+// Carves a buffer of a size class out of the current slab
+// A new slab is started when the current one runs out, the end of the
+// old one is handed out to the free lists of the classes that still fit
+void *editorPoolCarve(unsigned char cls) {
+    struct editorPool *pool = &E.pool;
+    size_t size = POOL_CLASS_SIZE[cls];
+
+    if (pool->slableft < size) {
+        for (int c = POOL_CLASSES - 1; c >= 0; c--) {
+            while (pool->slableft >= POOL_CLASS_SIZE[c]) {
+                struct poolFree *f = (struct poolFree *) pool->slab;
+                f->next = pool->free[c];
+                pool->free[c] = f;
+                pool->slab += POOL_CLASS_SIZE[c];
+                pool->slableft -= POOL_CLASS_SIZE[c];
             }
-            
-            i++;
         }
+
+        pool->slab = malloc(POOL_SLAB_SIZE);
+        if (pool->slab == NULL) die("malloc");
+        pool->slableft = POOL_SLAB_SIZE;
     }
-}
 
-/*** row operations ***/
+    void *p = pool->slab;
+    pool->slab += size;
+    pool->slableft -= size;
+    return p;
+}
 
-// Calculate the value of the horizontal render position from the cursor position
-int editorRowCxToRx(erow *row, int cx) {
-    int rx = 0;
-    int j;
+// Allocates a row buffer that holds at least size bytes and sets *cls to its size class
+// Small buffers come from the free list of their class or a slab shared by
+// many rows, rather than one malloc() each
+void *editorPoolAlloc(size_t size, unsigned char *cls) {
+    struct editorPool *pool = &E.pool;
+    unsigned char c = editorPoolClass(size);
+    *cls = c;
+
+    if (c == POOL_LARGE) {
+        // Leave room for the buffer to grow, like the small classes do
+        size_t cap = size + size / 2;
+        struct poolLarge *large = malloc(sizeof(struct poolLarge) + cap);
+        if (large == NULL) die("malloc");
+        large->cap = cap;
+        return large + 1;
+    }
 
-    // Loop through all the chars to the left of the cursor position (cx)
-    // and figure out how many spaces each tab takes up
-    for (j = 0; j < cx; j++) {
-        if (row->chars[j] == '\t')
-            // rx % TAB_STOP_LENGTH for how many columns we're to the right of the last tab stop
-            // TAB_STOP_LENGTH - 1 for how many columns we're to the left of the next tab stop
-            // Add to rx to get to the left of the next tab stop
-            rx += (TAB_STOP_LENGTH - 1) - (rx % TAB_STOP_LENGTH);
-        
-        // Go to the next tab stop
-        rx++;
+    if (pool->free[c] != NULL) {
+        struct poolFree *f = pool->free[c];
+        pool->free[c] = f->next;
+        return f;
     }
 
-    return rx;
+    return editorPoolCarve(c);
 }
 
-// Calculate the cursor position from the horizontal render position
-int editorRowRxToCx(erow *row, int rx) {
-    int cur_rx = 0;
-    int cx;
+// Gives a row buffer back to the pool
+// Note: slabs are never handed back to the system, their buffers are reused
+void editorPoolFree(void *p, unsigned char cls) {
+    if (p == NULL) return;
 
-    // Loop through the chars in the string
-    for (cx = 0; cx < row->size; cx++) {
-        if (row->chars[cx] == '\t')
-            // rx % TAB_STOP_LENGTH for how many columns we're to the right of the last tab stop
-            // TAB_STOP_LENGTH - 1 for how many columns we're to the left of the next tab stop
-            // Add to rx to get to the left of the next tab stop
-            cur_rx += (TAB_STOP_LENGTH - 1) - (cur_rx % TAB_STOP_LENGTH);
+    if (cls == POOL_LARGE) {
+        free((struct poolLarge *) p - 1);
+        return;
+    }
 
-        // Go to the next tab stop
-        cur_rx++;
+    struct poolFree *f = p;
+    f->next = E.pool.free[cls];
+    E.pool.free[cls] = f;
+}
 
-        // When the current render position hits the given render position,
-        // return the current cursor position
-        if (cur_rx > rx) return cx;
-    }
+// Makes a row buffer hold at least size bytes
+// Returns the buffer itself if it's big enough already, otherwise
+// a bigger one with the first used bytes copied over
+void *editorPoolGrow(void *p, unsigned char *cls, size_t used, size_t size) {
+    if (size <= editorPoolCapacity(p, *cls)) return p;
 
-    // Return in the case that the caller provided a 
-    // render position that is out of range
-    return cx;
+    unsigned char oldcls = *cls;
+    void *new = editorPoolAlloc(size, cls);
+    if (used > 0) memcpy(new, p, used);
+    editorPoolFree(p, oldcls);
+
+    return new;
 }
 
-// Use the string of an erow to fill the contents of the render string
-void editorUpdateRow(erow *row) {
-    int j;
-    int tabs = 0;
-    int idx = 0;
+/*** kernels ***/
 
-    // Count the number of tabs contained in the string
-    // to know how much memory to allocate for render
-    for (j = 0; j < row->size; j++)
-        if (row->chars[j] == '\t') tabs++;
+// Chars that end a word for the highlighter, one entry per byte value
+// Filled in by editorKernelsInit()
+unsigned char SEPARATORS[256];
 
-    // Free any used memory from the render buffer in order to update it
-    free(row->render);
+// Counts the occurrences of a char, one char at a time
+// Used for the end of a row and on CPUs without vector instructions
+int editorCountByteScalar(const char *s, int len, char c) {
+    int count = 0;
+    for (int i = 0; i < len; i++) count += (s[i] == c);
+    return count;
+}
 
-    // Allocate memory to store render string
-    row->render = malloc(row->size + tabs * (TAB_STOP_LENGTH - 1) + 1);
+#ifdef __SSE2__
+// Counts the occurrences of a char 16 chars at a time
+int editorCountByteSSE2(const char *s, int len, char c) {
+    __m128i want = _mm_set1_epi8(c);
+    int count = 0;
+    int i = 0;
 
-    // Copy chars stored in the erow to the render buffer
-    // Render tabs as multiple space chars
-    for (j = 0; j < row->size; j++) {
-        // If the char in the string is a tab, render it as a space
-        // and append spaces until we get to a tab stop (a column divisible by 8)
-        // Otherwise, copy the char directly to render
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            while (idx % TAB_STOP_LENGTH != 0) row->render[idx++] = ' ';
-        } else {
-            row->render[idx++] = row->chars[j];
-        }
+    // One bit per char that matches, so each block adds the number of set bits
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (s + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, want)));
     }
 
-    // Terminate render string with null char
-    row->render[idx] = '\0';
+    return count + editorCountByteScalar(s + i, len - i, c);
+}
+#endif
+
+#ifdef KERNEL_AVX2
+// Counts the occurrences of a char 32 chars at a time
+// Only called once editorKernelsInit() checked that the CPU has AVX2
+__attribute__((target("avx2")))
+int editorCountByteAVX2(const char *s, int len, char c) {
+    __m256i want = _mm256_set1_epi8(c);
+    int count = 0;
+    int i = 0;
 
-    // idx contains the number of chars we copied into render
-    // Assign it to render size
-    row->rsize = idx;
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (s + i));
+        count += __builtin_popcount((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, want)));
+    }
 
-    // Set the highlighting of the row after the render is updated
-    editorUpdateSyntax(row);
+    return count + editorCountByteScalar(s + i, len - i, c);
 }
+#endif
 
-// Inserts a row at the specified index 
-void editorInsertRow(int at, char *s, size_t len) {
-    // If the index is not within the row, then exit the function
-    if (at < 0 || at > E.numrows) return;
+#ifdef KERNEL_NEON
+// Counts the occurrences of a char 16 chars at a time
+int editorCountByteNEON(const char *s, int len, char c) {
+    uint8x16_t want = vdupq_n_u8((unsigned char) c);
+    int count = 0;
+    int i = 0;
 
-    // Reallocate memory to resize array to append new line
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
+    // Matching lanes are all ones, shifting leaves a 1 to add up
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t block = vld1q_u8((const uint8_t *) (s + i));
+        count += vaddvq_u8(vshrq_n_u8(vceqq_u8(block, want), 7));
+    }
 
-    // Shift the rows to make room at the specified index for the new row
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+    return count + editorCountByteScalar(s + i, len - i, c);
+}
+#endif
 
-    // Increment the idx of each row whenever a row is inserted into the file
-    for (int j = at + 1; j <= E.numrows; j++) E.row[j].idx++;
+// Counts the occurrences of a char in a string that doesn't need to be null terminated
+// Points to the fastest version the CPU supports, set by editorKernelsInit()
+int (*editorCountByte)(const char *s, int len, char c) = editorCountByteScalar;
 
-    // Set to row's index in the file at the time it's inserted
-    E.row[at].idx = at;
+// Counts the chars at the start of a string that are ASCII and not a tab, one char at a time
+// Each of them takes up one column, so they're skipped over without decoding them
+int editorAsciiSpanScalar(const char *s, int len) {
+    int i = 0;
+    while (i < len && (unsigned char) s[i] < 0x80 && s[i] != '\t') i++;
+    return i;
+}
 
-    // Set row size to length of the line
-    E.row[at].size = len;
+#ifdef __SSE2__
+// Counts the chars at the start of a string that are ASCII and not a tab, 16 chars at a time
+// Bytes of UTF-8 chars other than ASCII have their top bit set, and so do the tabs
+// once they're compared, which is the bit the mask is made of
+int editorAsciiSpanSSE2(const char *s, int len) {
+    __m128i tab = _mm_set1_epi8('\t');
+    int i = 0;
 
-    // Allocate memory for the line 
-    E.row[at].chars = malloc(len + 1);
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (s + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(block, _mm_cmpeq_epi8(block, tab)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
 
-    // Store line to chars field which points to the allocated memory
-    memcpy(E.row[at].chars, s, len);
+    return i + editorAsciiSpanScalar(s + i, len - i);
+}
+#endif
+
+#ifdef KERNEL_AVX2
+// Counts the chars at the start of a string that are ASCII and not a tab, 32 chars at a time
+// Only called once editorKernelsInit() checked that the CPU has AVX2
+__attribute__((target("avx2")))
+int editorAsciiSpanAVX2(const char *s, int len) {
+    __m256i tab = _mm256_set1_epi8('\t');
+    int i = 0;
 
-    // Terminate string with null char
-    E.row[at].chars[len] = '\0';
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (s + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(block, _mm256_cmpeq_epi8(block, tab)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
 
-    // Initialize render and highlighting
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    E.row[at].hl = NULL;
-    E.row[at].hl_open_comment = 0;
+    return i + editorAsciiSpanScalar(s + i, len - i);
+}
+#endif
 
-    // Update render string
-    editorUpdateRow(&E.row[at]);
+#ifdef KERNEL_NEON
+// Counts the chars at the start of a string that are ASCII and not a tab, 16 chars at a time
+// The block that has one of the other chars is counted one char at a time
+int editorAsciiSpanNEON(const char *s, int len) {
+    uint8x16_t tab = vdupq_n_u8('\t');
+    int i = 0;
 
-    // Update number of rows
-    E.numrows++;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t block = vld1q_u8((const uint8_t *) (s + i));
+        if (vmaxvq_u8(vorrq_u8(block, vceqq_u8(block, tab))) >= 0x80) break;
+    }
 
-    // Increment in each row operation that makes a change to the text
-    E.dirty++;
+    return i + editorAsciiSpanScalar(s + i, len - i);
 }
-
-// Frees the memory owned by the erow being deleted
-void editorFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+#endif
+
+// Counts the chars at the start of a string that are ASCII and not a tab
+// Points to the fastest version the CPU supports, set by editorKernelsInit()
+int (*editorAsciiSpan)(const char *s, int len) = editorAsciiSpanScalar;
+
+// Picks the versions of the kernels to use and fills in the lookup tables
+void editorKernelsInit() {
+#ifdef __SSE2__
+    editorCountByte = editorCountByteSSE2;
+    editorAsciiSpan = editorAsciiSpanSSE2;
+#endif
+#ifdef KERNEL_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        editorCountByte = editorCountByteAVX2;
+        editorAsciiSpan = editorAsciiSpanAVX2;
+    }
+#endif
+#ifdef KERNEL_NEON
+    editorCountByte = editorCountByteNEON;
+    editorAsciiSpan = editorAsciiSpanNEON;
+#endif
+
+    // Whitespace, the null char and punctuation separate words
+    memset(SEPARATORS, 0, sizeof(SEPARATORS));
+    for (int c = 0; c < 256; c++) {
+        if (isspace(c)) SEPARATORS[c] = 1;
+    }
+    SEPARATORS[0] = 1;
+    for (const char *p = ",.()+-/*=~%<>[];"; *p; p++) SEPARATORS[(unsigned char) *p] = 1;
 }
 
-// Deletes a row
-void editorDelRow(int at) {
-    // If the index is not within the row, then exit the function
-    if (at < 0 || at >= E.numrows) return;
-
-    // Free the memory of the row being deleted
-    editorFreeRow(&E.row[at]);
+/*** utf-8 ***/
+
+// Code point ranges of chars that take up no column of their own,
+// they're drawn over the char before them: combining marks, joiners,
+// variation selectors and the like. Sorted, for a binary search
+const int ZERO_WIDTH_RANGES[][2] = {
+    { 0x0300, 0x036f }, { 0x0483, 0x0489 }, { 0x0591, 0x05bd }, { 0x05bf, 0x05bf },
+    { 0x05c1, 0x05c2 }, { 0x05c4, 0x05c5 }, { 0x05c7, 0x05c7 }, { 0x0610, 0x061a },
+    { 0x064b, 0x065f }, { 0x0670, 0x0670 }, { 0x06d6, 0x06dc }, { 0x06df, 0x06e4 },
+    { 0x06e7, 0x06e8 }, { 0x06ea, 0x06ed }, { 0x0900, 0x0902 }, { 0x093a, 0x093a },
+    { 0x093c, 0x093c }, { 0x0941, 0x0948 }, { 0x094d, 0x094d }, { 0x0951, 0x0957 },
+    { 0x0962, 0x0963 }, { 0x0e31, 0x0e31 }, { 0x0e34, 0x0e3a }, { 0x0e47, 0x0e4e },
+    { 0x1160, 0x11ff }, { 0x1ab0, 0x1aff }, { 0x1dc0, 0x1dff }, { 0x200b, 0x200f },
+    { 0x202a, 0x202e }, { 0x2060, 0x2064 }, { 0x20d0, 0x20ff }, { 0x302a, 0x302d },
+    { 0x3099, 0x309a }, { 0xfe00, 0xfe0f }, { 0xfe20, 0xfe2f }, { 0xfeff, 0xfeff },
+    { 0x1f3fb, 0x1f3ff }, { 0xe0001, 0xe007f }, { 0xe0100, 0xe01ef },
+};
 
-    // Shift the row structs in the array to the left to accommodate for the deleted 
-    // row struct by overwriting it with the row structs that come after it
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
+// Code point ranges of chars that take up two columns: the CJK scripts,
+// fullwidth forms and emoji. Sorted, for a binary search
+const int WIDE_RANGES[][2] = {
+    { 0x1100, 0x115f }, { 0x231a, 0x231b }, { 0x2329, 0x232a }, { 0x23e9, 0x23ec },
+    { 0x23f0, 0x23f0 }, { 0x23f3, 0x23f3 }, { 0x25fd, 0x25fe }, { 0x2614, 0x2615 },
+    { 0x2648, 0x2653 }, { 0x267f, 0x267f }, { 0x2693, 0x2693 }, { 0x26a1, 0x26a1 },
+    { 0x26aa, 0x26ab }, { 0x26bd, 0x26be }, { 0x26c4, 0x26c5 }, { 0x26ce, 0x26ce },
+    { 0x26d4, 0x26d4 }, { 0x26ea, 0x26ea }, { 0x26f2, 0x26f3 }, { 0x26f5, 0x26f5 },
+    { 0x26fa, 0x26fa }, { 0x26fd, 0x26fd }, { 0x2705, 0x2705 }, { 0x270a, 0x270b },
+    { 0x2728, 0x2728 }, { 0x274c, 0x274c }, { 0x274e, 0x274e }, { 0x2753, 0x2755 },
+    { 0x2757, 0x2757 }, { 0x2795, 0x2797 }, { 0x27b0, 0x27b0 }, { 0x27bf, 0x27bf },
+    { 0x2b1b, 0x2b1c }, { 0x2b50, 0x2b50 }, { 0x2b55, 0x2b55 }, { 0x2e80, 0x303e },
+    { 0x3041, 0x33ff }, { 0x3400, 0x4dbf }, { 0x4e00, 0x9fff }, { 0xa000, 0xa4cf },
+    { 0xa960, 0xa97f }, { 0xac00, 0xd7a3 }, { 0xf900, 0xfaff }, { 0xfe10, 0xfe19 },
+    { 0xfe30, 0xfe6f }, { 0xff00, 0xff60 }, { 0xffe0, 0xffe6 }, { 0x16fe0, 0x16fe4 },
+    { 0x17000, 0x18aff }, { 0x1b000, 0x1b2ff }, { 0x1f004, 0x1f004 }, { 0x1f0cf, 0x1f0cf },
+    { 0x1f18e, 0x1f18e }, { 0x1f191, 0x1f19a }, { 0x1f200, 0x1f202 }, { 0x1f210, 0x1f23b },
+    { 0x1f240, 0x1f248 }, { 0x1f250, 0x1f251 }, { 0x1f300, 0x1f64f }, { 0x1f680, 0x1f6ff },
+    { 0x1f7e0, 0x1f7eb }, { 0x1f900, 0x1f9ff }, { 0x1fa70, 0x1faff }, { 0x20000, 0x2fffd },
+    { 0x30000, 0x3fffd },
+};
 
-    // Decrement the idx of each row whenever a row is removed from the file
-    for (int j = at; j < E.numrows - 1; j++) E.row[j].idx--;
+// Checks if a code point is in one of n sorted ranges
+int editorInRanges(int cp, const int (*ranges)[2], int n) {
+    // Everything below the first range is below all of them, which is most chars
+    if (cp < ranges[0][0]) return 0;
+
+    int lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (cp < ranges[mid][0]) hi = mid - 1;
+        else if (cp > ranges[mid][1]) lo = mid + 1;
+        else return 1;
+    }
+    return 0;
+}
 
-    // Decrement the number of rows
-    E.numrows--;
+// Decodes the UTF-8 char at the start of a string of len bytes and sets *cp to its code point
+// A byte that doesn't start a valid sequence (a stray continuation byte, an overlong
+// form, a surrogate, or a sequence that's cut short) is a char of its own and *cp is -1
+// Returns the number of bytes of the char
+int editorUtf8Decode(const char *s, int len, int *cp) {
+    const unsigned char *u = (const unsigned char *) s;
+    *cp = u[0];
+    if (u[0] < 0x80) return 1;
+
+    // The lead byte tells how many continuation bytes follow and the smallest
+    // code point that needs that many, anything less is an overlong form
+    int n, min;
+    if (u[0] >= 0xc2 && u[0] <= 0xdf) { n = 1; min = 0x80; *cp = u[0] & 0x1f; }
+    else if (u[0] >= 0xe0 && u[0] <= 0xef) { n = 2; min = 0x800; *cp = u[0] & 0x0f; }
+    else if (u[0] >= 0xf0 && u[0] <= 0xf4) { n = 3; min = 0x10000; *cp = u[0] & 0x07; }
+    else { *cp = -1; return 1; }
+
+    if (n >= len) {
+        *cp = -1;
+        return 1;
+    }
+    for (int j = 1; j <= n; j++) {
+        if ((u[j] & 0xc0) != 0x80) {
+            *cp = -1;
+            return 1;
+        }
+        *cp = (*cp << 6) | (u[j] & 0x3f);
+    }
 
-    // Increment in each row operation that makes a change to the text
-    E.dirty++;
+    if (*cp < min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp <= 0xdfff)) {
+        *cp = -1;
+        return 1;
+    }
+    return n + 1;
 }
 
-// Inserts a single char into an erow at a given position
-void editorRowInsertChar(erow *row, int at, int c) {
-    // Validate the index we want to insert into
-    // Allowed to go one char past the end of the string, so we insert at the end
-    if (at < 0 || at > row->size) at = row->size;
-
-    // Allocate one more byte for the chars of the erow
-    // Add 2 because we need to make space for the null byte
-    row->chars = realloc(row->chars, row->size + 2);
+// Returns the offset of the start of the UTF-8 char that the byte at the given offset
+// of a string of len bytes is part of
+// Only looks back as far as the longest sequence goes, at most 3 bytes
+int editorUtf8Start(const char *s, int len, int at) {
+    if (at >= len) return len;
 
-    // Move the char at the index we are inserting to the next index
-    // Using memmove() because we are handling overlapping memory areas
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    // Go back over the continuation bytes to what could be the lead byte
+    int lead = at;
+    while (lead > 0 && at - lead < 3 && ((unsigned char) s[lead] & 0xc0) == 0x80) lead--;
+    if (lead == at) return at;
 
-    // Increment size of array 
-    row->size++;
+    // The byte is only part of the char before it if that's a valid sequence reaching it
+    int cp;
+    return lead + editorUtf8Decode(&s[lead], len - lead, &cp) > at ? lead : at;
+}
 
-    // Assign character at the given position in the array
-    row->chars[at] = c;
+// Returns the number of columns a char takes up on the screen, tabs aside, which
+// take up as many as it takes to get to the next tab stop
+// *attach is whether a combining mark would be drawn over the char before this one,
+// and is updated for this one. Control chars and invalid bytes (a code point
+// of -1) are drawn as a single inverted char and take no marks, and a mark with
+// nothing to be drawn over gets a column of its own
+int editorCharColumns(int cp, int *attach) {
+    if (cp < 0x20 || (cp >= 0x7f && cp < 0xa0)) {
+        *attach = 0;
+        return 1;
+    }
 
-    // Update the render string to update the new row content
-    editorUpdateRow(row);
+    if (cp >= 0x80 && editorInRanges(cp, ZERO_WIDTH_RANGES, sizeof(ZERO_WIDTH_RANGES) / sizeof(ZERO_WIDTH_RANGES[0]))) {
+        int columns = !*attach;
+        *attach = 1;
+        return columns;
+    }
 
-    // Increment in each row operation that makes a change to the text
-    E.dirty++;
+    *attach = 1;
+    if (cp >= 0x1100 && editorInRanges(cp, WIDE_RANGES, sizeof(WIDE_RANGES) / sizeof(WIDE_RANGES[0]))) return 2;
+    return 1;
 }
 
-// Appends a string to the end of a row
-void editorRowAppendString(erow *row, char *s, size_t len) {
-    // After appending, the row's new size is row->size + len + 1
-    // Allocate that much memory for the string to be stored in the row
-    row->chars = realloc(row->chars, row->size + len + 1);
-
-    // Copy the given string to the end of the current string content of the row
-    memcpy(&row->chars[row->size], s, len);
+// Checks if a combining mark at the given offset of a string of len bytes
+// would be drawn over the char before it, see editorCharColumns()
+int editorCharAttach(const char *s, int len, int at) {
+    if (at <= 0) return 0;
 
-    // Increase the row size by the length of the appended string
-    row->size += len;
+    int cp;
+    int start = editorUtf8Start(s, len, at - 1);
+    editorUtf8Decode(&s[start], len - start, &cp);
 
-    // Append null byte at the end of the new string
-    row->chars[row->size] = '\0';
+    int attach = 0;
+    editorCharColumns(cp, &attach);
+    return attach;
+}
 
-    // Update the render string to update the new row content
-    editorUpdateRow(row);
+// Returns the offset just past the char at the given offset of a string of len bytes
+// and the combining marks drawn over it, which the cursor moves over as one char
+int editorCharNext(const char *s, int len, int at) {
+    if (at >= len) return len;
+
+    int cp;
+    int attach = 0;
+    at += editorUtf8Decode(&s[at], len - at, &cp);
+    editorCharColumns(cp, &attach);
+
+    // Marks have no columns of their own as long as there's a char they go over
+    while (at < len) {
+        int n = editorUtf8Decode(&s[at], len - at, &cp);
+        if (editorCharColumns(cp, &attach) != 0) break;
+        at += n;
+    }
 
-    // Increment in each row operation that makes a change to the text
-    E.dirty++;
+    return at;
 }
 
-// Deletes a character in an erow
-void editorRowDelChar(erow *row, int at) {
-    // If the index is not within the row, then exit the function
-    if (at < 0 || at >= row->size) return;
+// Returns the offset of the start of the char that the byte at the given offset
+// of a string of len bytes is part of, along with the marks drawn over it
+int editorCharStart(const char *s, int len, int at) {
+    if (at >= len) return len;
+    if (at < 0) return 0;
+
+    at = editorUtf8Start(s, len, at);
+    while (at > 0) {
+        int cp;
+        int attach = editorCharAttach(s, len, at);
+        editorUtf8Decode(&s[at], len - at, &cp);
+        if (editorCharColumns(cp, &attach) != 0) break;
+        at = editorUtf8Start(s, len, at - 1);
+    }
 
-    // Shift the chars to the left to accommodate for the deleted char
-    // by overwriting it with the chars that come after it
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+    return at;
+}
 
-    // Decrement row size
-    row->size--;
+// Checks if a string of len bytes is all ASCII, whose chars other than tabs take up
+// one column and one render char each
+int editorIsAscii(const char *s, int len) {
+    int i = 0;
+    while ((i += editorAsciiSpan(&s[i], len - i)) < len && s[i] == '\t') i++;
+    return i >= len;
+}
 
-    // Update the render string to update the new row content
-    editorUpdateRow(row);
+// Returns a buffer for the glyphs of a row of len chars, which has at most one per char
+// and the one marking its end. The buffer is shared, it holds the row being laid out
+struct rowGlyph *editorGlyphScratch(int len) {
+    if (len + 1 > E.glyphbufcap) {
+        int cap = E.glyphbufcap ? E.glyphbufcap : 256;
+        while (cap < len + 1) cap *= 2;
+
+        struct rowGlyph *new = realloc(E.glyphbuf, sizeof(struct rowGlyph) * cap);
+        if (new == NULL) die("realloc");
+        E.glyphbuf = new;
+        E.glyphbufcap = cap;
+    }
 
-    // Increment in each row operation that makes a change to the text
-    E.dirty++;
+    return E.glyphbuf;
 }
 
-/*** editor operations ***/
+// Renders a string of len chars that has UTF-8 text and lays it out in glyphs
+// The glyphs go into E.glyphbuf, followed by the one that marks the end of the string
+// The string starts at render position rx, and attach is whether a combining
+// mark at its start would be drawn over the char before it
+// The render string is written to render unless it's null, tabs are rendered as
+// spaces up to the next tab stop and everything else as it is, so it needs as many
+// bytes as editorRenderRow() allocates for an ASCII row with that many tabs
+// Returns the number of glyphs
+int editorLayoutGlyphs(const char *s, int len, int rx, int attach, char *render) {
+    struct rowGlyph *g = editorGlyphScratch(len);
+    int n = 0;
+    int i = 0;
+    int idx = 0;
 
-// Insert a character in the position that the cursor is at
-void editorInsertChar(int c) {
-    // If the cursor is on the tilde line after the end of the file,
+    // Whether the last glyph is a run of ASCII chars that can be extended
+    int run = 0;
+
+    while (i < len) {
+        int cp;
+
+        // ASCII chars other than tabs go into a run a stretch at a time, except for
+        // one followed by a combining mark, which makes a glyph with the mark
+        int k = editorAsciiSpan(&s[i], len - i);
+        if (k > 0 && i + k < len && (unsigned char) s[i + k] >= 0x80) {
+            int last = attach;
+            editorCharColumns((unsigned char) s[i + k - 1], &last);
+            editorUtf8Decode(&s[i + k], len - i - k, &cp);
+            if (editorCharColumns(cp, &last) == 0) k--;
+        }
+
+        if (k > 0) {
+            if (!run) g[n++] = (struct rowGlyph) { i, idx, rx };
+            run = 1;
+
+            if (render) memcpy(&render[idx], &s[i], k);
+            editorCharColumns((unsigned char) s[i + k - 1], &attach);
+            i += k;
+            idx += k;
+            rx += k;
+            continue;
+        }
+
+        g[n++] = (struct rowGlyph) { i, idx, rx };
+        run = 0;
+
+        // Tabs go to the next tab stop, spacing out to it in the render string
+        if (s[i] == '\t') {
+            do {
+                if (render) render[idx] = ' ';
+                idx++;
+                rx++;
+            } while (rx % TAB_STOP_LENGTH != 0);
+            attach = 0;
+            i++;
+            continue;
+        }
+
+        // Any other char, along with the combining marks drawn over it
+        int start = i;
+        i += editorUtf8Decode(&s[i], len - i, &cp);
+        int columns = editorCharColumns(cp, &attach);
+        while (i < len) {
+            int mark = attach;
+            int m = editorUtf8Decode(&s[i], len - i, &cp);
+            if (editorCharColumns(cp, &mark) != 0) break;
+            i += m;
+        }
+
+        if (render) memcpy(&render[idx], &s[start], i - start);
+        idx += i - start;
+        rx += columns;
+    }
+
+    g[n] = (struct rowGlyph) { i, idx, rx };
+    return n;
+}
+
+// Returns the index of the glyph that holds the char at the given offset of chars
+// The glyphs are binary searched, their offsets only go up
+int editorGlyphAtCx(const struct rowGlyph *g, int n, int cx) {
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (g[mid].cx <= cx) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Returns the index of the glyph that covers the given render position
+// A glyph of no columns never covers one, the one after it starts at the same position
+int editorGlyphAtRx(const struct rowGlyph *g, int n, int rx) {
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (g[mid].rx <= rx) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/*** syntax highlighting ***/
+
+// Checks if a character is considered a separator character
+// Looked up in a table since it's asked for every char of every highlighted row
+int is_separator(int c) {
+    return SEPARATORS[(unsigned char) c];
+}
+
+// Hashes a word for the keyword table (FNV-1a)
+unsigned int editorKeywordHash(const char *s, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Compiles a null terminated keyword list into a hash table
+// The trailing pipe char that marks a secondary keyword is parsed once here,
+// so highlighting never has to look at it
+struct editorKeywordTable *editorCompileKeywords(char **keywords) {
+    struct editorKeywordTable *kt = calloc(1, sizeof(*kt));
+    if (kt == NULL) die("calloc");
+
+    // Keep the table at most half full so probe sequences stay short
+    unsigned int n = 0;
+    while (keywords[n]) n++;
+    unsigned int nslots = 8;
+    while (nslots < n * 2) nslots *= 2;
+
+    kt->slots = calloc(nslots, sizeof(struct editorKeyword));
+    if (kt->slots == NULL) die("calloc");
+    kt->mask = nslots - 1;
+
+    for (unsigned int j = 0; j < n; j++) {
+        int klen = strlen(keywords[j]);
+
+        // If it's a secondary keyword, decrement
+        // length to account for the pipe char
+        int kw2 = klen > 0 && keywords[j][klen - 1] == '|';
+        if (kw2) klen--;
+        if (klen == 0) continue;
+
+        // Find a free slot with linear probing
+        // A duplicate keyword keeps its first entry, like the old linear search did
+        unsigned int h = editorKeywordHash(keywords[j], klen) & kt->mask;
+        while (kt->slots[h].word) {
+            if (kt->slots[h].len == klen && !memcmp(kt->slots[h].word, keywords[j], klen)) break;
+            h = (h + 1) & kt->mask;
+        }
+        if (kt->slots[h].word) continue;
+
+        kt->slots[h].word = keywords[j];
+        kt->slots[h].len = klen;
+        kt->slots[h].hl = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+
+        if (klen > kt->maxlen) kt->maxlen = klen;
+        kt->first[(unsigned char)keywords[j][0]] = 1;
+    }
+
+    return kt;
+}
+
+// Returns the highlight of the keyword a word is, or HL_NORMAL if it isn't one
+int editorKeywordLookup(struct editorKeywordTable *kt, const char *s, int len) {
+    unsigned int h = editorKeywordHash(s, len) & kt->mask;
+    while (kt->slots[h].word) {
+        if (kt->slots[h].len == len && !memcmp(kt->slots[h].word, s, len)) return kt->slots[h].hl;
+        h = (h + 1) & kt->mask;
+    }
+    return HL_NORMAL;
+}
+
+// Returns a buffer for one highlight value per char of a row of the given length
+// The buffer is shared, it holds the row being highlighted or drawn
+unsigned char *editorHighlightScratch(int len) {
+    if (len > E.hlbufcap) {
+        int cap = E.hlbufcap ? E.hlbufcap : 256;
+        while (cap < len) cap *= 2;
+
+        unsigned char *new = realloc(E.hlbuf, cap);
+        if (new == NULL) die("realloc");
+        E.hlbuf = new;
+        E.hlbufcap = cap;
+    }
+
+    return E.hlbuf;
+}
+
+// Stores the highlighting of a row, given as one value per render char
+// Most of a row is usually the same color, so it's stored as runs
+void editorHighlightStore(erow *row, const unsigned char *hl) {
+    // Count the runs, a run is split when it's too long for its length byte
+    int runs = 0;
+    for (int i = 0; i < row->rsize; runs++) {
+        int j = i + 1;
+        while (j < row->rsize && j - i < HL_RUN_MAX && hl[j] == hl[i]) j++;
+        i = j;
+    }
+
+    // Runs take two bytes each, keep the values as they are if that's no smaller
+    if (runs * 2 >= row->rsize) {
+        row->hl = editorPoolGrow(row->hl, &row->hlclass, 0, row->rsize);
+        if (row->rsize > 0) memcpy(row->hl, hl, row->rsize);
+        row->flags |= ROW_HL_RAW;
+        return;
+    }
+
+    row->hl = editorPoolGrow(row->hl, &row->hlclass, 0, runs * 2);
+    row->flags &= ~ROW_HL_RAW;
+
+    unsigned char *out = row->hl;
+    for (int i = 0; i < row->rsize; ) {
+        int j = i + 1;
+        while (j < row->rsize && j - i < HL_RUN_MAX && hl[j] == hl[i]) j++;
+        *out++ = j - i;
+        *out++ = hl[i];
+        i = j;
+    }
+}
+
+// Returns the highlight values of len render chars of a row, starting at from
+// The runs of the row are expanded into the shared buffer, so the
+// values are only good until the next row is highlighted or drawn
+unsigned char *editorHighlightExpand(erow *row, int from, int len) {
+    if (row->flags & ROW_HL_RAW) return &row->hl[from];
+
+    unsigned char *hl = editorHighlightScratch(len);
+    unsigned char *run = row->hl;
+    int at = 0;
+
+    // Skip the runs that end before the first char
+    while (at + run[0] <= from) {
+        at += run[0];
+        run += 2;
+    }
+
+    // Fill in the values run by run
+    int filled = 0;
+    while (filled < len) {
+        int n = at + run[0] - (from + filled);
+        if (n > len - filled) n = len - filled;
+        memset(&hl[filled], run[1], n);
+        filled += n;
+        at += run[0];
+        run += 2;
+    }
+
+    return hl;
+}
+
+// Works out what a char does in a state of a filetype's lexer
+// These are the rules the highlighter always had, tried in the same order:
+// comment delimiters, strings, numbers, keywords, and what's left is a
+// separator or part of a word. Delimiters and keywords are only marked,
+// they're matched at highlight time, the rest is decided here once
+struct lexEntry editorLexerRule(struct editorSyntax *syntax, int state, int c) {
+    struct lexEntry e = { LEX_SEP, HL_NORMAL, 0 };
+    struct editorLexer *lx = syntax->lexer;
+    const char *quotes = (syntax->flags & HL_HIGHLIGHT_STRINGS) ? syntax->quotes : "";
+
+    if (state >= LEX_STRING) {
+        // Every char of a string is part of it, a backslash escapes the char after it
+        int q = (state - LEX_STRING) / 2;
+        e.hl = HL_STRING;
+        if ((state - LEX_STRING) % 2) e.next = LEX_STRING + 2 * q;
+        else if (c == '\\') e.next = state + 1;
+        else if (c == quotes[q]) e.next = LEX_SEP;
+        else e.next = state;
+        return e;
+    }
+
+    if (state == LEX_MLCOMMENT) {
+        e.hl = HL_MLCOMMENT;
+        e.next = LEX_MLCOMMENT;
+        if (lx->mce_len && c == lx->mce[0]) e.act = LEX_DELIM;
+        return e;
+    }
+
+    // Comment delimiters come first, even over strings
+    if ((lx->scs_len && c == lx->scs[0]) || (lx->mcs_len && c == lx->mcs[0])) e.act = LEX_DELIM;
+
+    const char *q = c != 0 ? strchr(quotes, c) : NULL;
+    if (q != NULL) {
+        e.hl = HL_STRING;
+        e.next = LEX_STRING + 2 * (q - quotes);
+        return e;
+    }
+
+    // Digits after a separator or a number, and dots inside a number
+    if (syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+        if ((isdigit(c) && state != LEX_WORD) || (c == '.' && state == LEX_NUMBER)) {
+            e.hl = HL_NUMBER;
+            e.next = LEX_NUMBER;
+            return e;
+        }
+    }
+
+    // Keywords start after a separator
+    if (state == LEX_SEP && syntax->kwtable->first[c]) e.act |= LEX_KEYWORD;
+
+    e.next = is_separator(c) ? LEX_SEP : LEX_WORD;
+    return e;
+}
+
+// Compiles the highlighting rules of a filetype into a state machine
+// The entries of every state are worked out for each of the 256 byte values,
+// then bytes with the same entries in every state are merged into one class
+// Called the first time the filetype is used, after its keywords were compiled
+struct editorLexer *editorLexerCompile(struct editorSyntax *syntax) {
+    struct editorLexer *lx = calloc(1, sizeof(struct editorLexer));
+    if (lx == NULL) die("calloc");
+
+    // Multi-line comments need both delimiters
+    lx->scs = syntax->singleline_comment_start;
+    lx->mcs = syntax->multiline_comment_start;
+    lx->mce = syntax->multiline_comment_end;
+    lx->scs_len = lx->scs ? strlen(lx->scs) : 0;
+    lx->mcs_len = lx->mcs ? strlen(lx->mcs) : 0;
+    lx->mce_len = lx->mce ? strlen(lx->mce) : 0;
+    if (lx->mcs_len == 0 || lx->mce_len == 0) {
+        lx->mcs_len = 0;
+        lx->mce_len = 0;
+    }
+
+    // The rules see the delimiters through the lexer
+    syntax->lexer = lx;
+
+    int nquotes = (syntax->flags & HL_HIGHLIGHT_STRINGS) ? strlen(syntax->quotes) : 0;
+    int nstates = LEX_STRING + 2 * nquotes;
+
+    // Entries of each byte in every state, one column per byte
+    static struct lexEntry columns[256][LEX_STATES];
+    int rep[256];
+
+    for (int c = 0; c < 256; c++) {
+        for (int state = 0; state < nstates; state++) columns[c][state] = editorLexerRule(syntax, state, c);
+
+        // Find a class whose bytes have the same entries
+        int k;
+        for (k = 0; k < lx->nclasses; k++) {
+            if (!memcmp(columns[rep[k]], columns[c], sizeof(struct lexEntry) * nstates)) break;
+        }
+        if (k == lx->nclasses) rep[lx->nclasses++] = c;
+        lx->cls[c] = k;
+    }
+
+    for (int state = 0; state < nstates; state++) {
+        for (int k = 0; k < lx->nclasses; k++) lx->table[state * lx->nclasses + k] = columns[rep[k]][state];
+    }
+
+    return lx;
+}
+
+// Matches the rules that span several chars at a char the lexer marked with an action
+// Comment delimiters are looked for, and unless hl is null, keywords too, the
+// matched chars are highlighted and *state is set to the state after them
+// Returns the number of chars matched, 0 if nothing matched and -1 if
+// the rest of the line is a single-line comment
+int editorLexerMatch(struct editorLexer *lx, const char *s, int len, int i, int act, int *state, unsigned char *hl) {
+    if (act & LEX_DELIM) {
+        if (*state == LEX_MLCOMMENT) {
+            if (i + lx->mce_len <= len && !memcmp(&s[i], lx->mce, lx->mce_len)) {
+                if (hl) memset(&hl[i], HL_MLCOMMENT, lx->mce_len);
+                *state = LEX_SEP;
+                return lx->mce_len;
+            }
+        } else {
+            if (lx->scs_len && i + lx->scs_len <= len && !memcmp(&s[i], lx->scs, lx->scs_len)) {
+                if (hl) memset(&hl[i], HL_COMMENT, len - i);
+                return -1;
+            }
+            if (lx->mcs_len && i + lx->mcs_len <= len && !memcmp(&s[i], lx->mcs, lx->mcs_len)) {
+                if (hl) memset(&hl[i], HL_MLCOMMENT, lx->mcs_len);
+                *state = LEX_MLCOMMENT;
+                return lx->mcs_len;
+            }
+        }
+    }
+
+    // Keywords only matter for the highlighting, the comment state doesn't depend on them
+    if ((act & LEX_KEYWORD) && hl) {
+        struct editorKeywordTable *kt = E.syntax->kwtable;
+
+        // Measure the word up to the next separator
+        // The end of the line counts as a separator, and words
+        // longer than every keyword are never a keyword
+        int klen = 0;
+        while (i + klen < len && klen <= kt->maxlen && !is_separator(s[i + klen])) klen++;
+
+        int kw = (klen <= kt->maxlen) ? editorKeywordLookup(kt, &s[i], klen) : HL_NORMAL;
+        if (kw != HL_NORMAL) {
+            memset(&hl[i], kw, klen);
+            *state = LEX_WORD;
+            return klen;
+        }
+    }
+
+    return 0;
+}
+
+// Highlight the characters of a rendered line, one hl value per char
+// in_comment is set if the line starts inside an unclosed multi-line comment
+// Runs the filetype's lexer over the line, see editorLexerCompile()
+// Returns whether the line ends inside an unclosed multi-line comment
+int editorHighlightLine(const char *render, int rsize, unsigned char *hl, int in_comment) {
+    // If there's no filetype, the whole line is highlighted as normal text
+    if (E.syntax == NULL) {
+        memset(hl, HL_NORMAL, rsize);
+        return 0;
+    }
+
+    struct editorLexer *lx = E.syntax->lexer;
+    int state = in_comment ? LEX_MLCOMMENT : LEX_SEP;
+
+    int i = 0;
+    while (i < rsize) {
+        const struct lexEntry *e = &lx->table[state * lx->nclasses + lx->cls[(unsigned char) render[i]]];
+
+        if (e->act) {
+            int n = editorLexerMatch(lx, render, rsize, i, e->act, &state, hl);
+            if (n == -1) return 0;
+            if (n > 0) {
+                i += n;
+                continue;
+            }
+        }
+
+        hl[i++] = e->hl;
+        state = e->next;
+    }
+
+    return state == LEX_MLCOMMENT;
+}
+
+// Highlight the characters in an erow
+// in_comment is set if the row starts inside an unclosed multi-line comment
+void editorHighlightRow(erow *row, int in_comment) {
+    // Remember the state the row was highlighted from
+    row->hl_entry = in_comment;
+    row->flags &= ~ROW_HL_STALE;
+
+    // Highlight into the shared buffer since this might be a new row 
+    // or the row might be bigger than the last time we highlighted it
+    // The size of the hl array is the same as the render array
+    // The row keeps its highlighting as runs once it's done
+    unsigned char *hl = editorHighlightScratch(row->rsize);
+
+    // Set the value of the current row’s hl_open_comment to 
+    // whatever state in_comment is after processing the entire row
+    row->hl_open_comment = editorHighlightLine(row->render, row->rsize, hl, in_comment);
+
+    // Keep the highlighting in the row
+    editorHighlightStore(row, hl);
+}
+
+// Runs the lexer over a line from offset *at in *state until it gets to stop
+// Skips keywords like editorSyntaxScanState(), a single-line comment takes it
+// to the end of the line in LEX_SEP
+void editorSyntaxScanSpan(struct editorLexer *lx, const char *s, int len, int *at, int *state, int stop) {
+    int i = *at;
+    int st = *state;
+
+    while (i < stop) {
+        const struct lexEntry *e = &lx->table[st * lx->nclasses + lx->cls[(unsigned char) s[i]]];
+
+        if (e->act & LEX_DELIM) {
+            int n = editorLexerMatch(lx, s, len, i, LEX_DELIM, &st, NULL);
+            if (n == -1) {
+                i = len;
+                st = LEX_SEP;
+                break;
+            }
+            if (n > 0) {
+                i += n;
+                continue;
+            }
+        }
+
+        i++;
+        st = e->next;
+    }
+
+    *at = i;
+    *state = st;
+}
+
+// Returns whether a line ends inside an unclosed multi-line comment without highlighting it
+// Runs the same lexer as editorHighlightLine(), but skips keywords, which
+// don't carry over to the next line, so rows that were never drawn don't
+// need a render or hl buffer to know the state of the rows after them
+// The line doesn't need to be null terminated
+int editorSyntaxScanState(const char *s, int len, int in_comment) {
+    if (E.syntax == NULL) return 0;
+
+    int i = 0;
+    int state = in_comment ? LEX_MLCOMMENT : LEX_SEP;
+    editorSyntaxScanSpan(E.syntax->lexer, s, len, &i, &state, len);
+
+    return state == LEX_MLCOMMENT;
+}
+
+// Longest comment delimiter of the filetype, a lexer state depends on
+// up to that many chars after where it was taken
+int editorSyntaxLookahead(const struct editorLexer *lx) {
+    int n = lx->scs_len;
+    if (lx->mcs_len > n) n = lx->mcs_len;
+    if (lx->mce_len > n) n = lx->mce_len;
+    return n;
+}
+
+// Adds a checkpoint at slot k of a row's state index, moving the ones from k on
+struct stateIndex *editorStateIndexInsert(erow *row, int k, int at, int state) {
+    struct stateIndex *si = row->states;
+
+    if (si->n == si->cap) {
+        si->cap *= 2;
+        si = realloc(si, sizeof(struct stateIndex) + sizeof(struct stateCheckpoint) * si->cap);
+        if (si == NULL) die("realloc");
+        row->states = si;
+    }
+
+    memmove(&si->cp[k + 1], &si->cp[k], sizeof(struct stateCheckpoint) * (si->n - k));
+    si->cp[k].at = at;
+    si->cp[k].state = state;
+    si->n++;
+    return si;
+}
+
+// Returns whether a row of at least LONG_LINE_MIN chars ends inside an unclosed
+// multi-line comment, see editorSyntaxScanState()
+// The lexer starts over from the last current checkpoint of the row's state index,
+// adding checkpoints as it goes, and stops as soon as it gets to a checkpoint from
+// before the last edit in the state it was in then, since the rest of the row
+// then ends in the same state as the last time it was scanned
+// The chars scanned are taken off *left, once it runs out the scan stops at the
+// next checkpoint and -1 is returned, the next call carries on from there
+int editorSyntaxScanRow(erow *row, int in_comment, long long *left) {
+    if (E.syntax == NULL) return 0;
+
+    struct editorLexer *lx = E.syntax->lexer;
+    int entry = in_comment ? LEX_MLCOMMENT : LEX_SEP;
+    struct stateIndex *si = row->states;
+
+    // Start over for a new row or filetype, a different starting state
+    // only makes the checkpoints after the start out of date
+    if (si == NULL || si->lexer != lx) {
+        if (si == NULL) {
+            si = malloc(sizeof(struct stateIndex) + sizeof(struct stateCheckpoint) * 16);
+            if (si == NULL) die("malloc");
+            si->cap = 16;
+            row->states = si;
+        }
+        si->lexer = lx;
+        si->n = 1;
+        si->valid = 1;
+        si->cp[0].at = 0;
+        si->cp[0].state = entry;
+    } else if (si->cp[0].state != entry) {
+        si->cp[0].state = entry;
+        si->valid = 1;
+    }
+
+    while (si->valid < si->n || si->cp[si->n - 1].at < row->size) {
+        struct stateCheckpoint last = si->cp[si->valid - 1];
+
+        // Scan up to the next checkpoint from before the edit, or a step on
+        int stop = last.at + STATE_INDEX_STEP;
+        if (si->valid < si->n && si->cp[si->valid].at < stop) stop = si->cp[si->valid].at;
+        if (stop > row->size) stop = row->size;
+
+        // Stop at the checkpoint the last scan got to once the chars to scan ran out
+        if (*left <= 0) return -1;
+
+        int at = last.at;
+        int state = last.state;
+        editorSyntaxScanSpan(lx, row->chars, row->size, &at, &state, stop);
+        *left -= at - last.at;
+
+        // Drop the old checkpoints the lexer went past
+        int k = si->valid;
+        while (k < si->n && si->cp[k].at < at) k++;
+        memmove(&si->cp[si->valid], &si->cp[k], sizeof(struct stateCheckpoint) * (si->n - k));
+        si->n -= k - si->valid;
+
+        if (si->valid < si->n && si->cp[si->valid].at == at) {
+            // The rest of the row is the same as before if the state is
+            if (si->cp[si->valid].state == state) {
+                si->valid = si->n;
+                break;
+            }
+            si->cp[si->valid++].state = state;
+        } else {
+            si = editorStateIndexInsert(row, si->valid, at, state);
+            si->valid++;
+        }
+    }
+
+    return si->cp[si->n - 1].state == LEX_MLCOMMENT;
+}
+
+// Brings the state index of a row up to date after removed chars at offset at
+// were replaced by inserted ones
+// The checkpoints that only depend on chars before the edit stay current, the
+// ones after it move by the change in length and are kept to be compared with
+void editorRowShiftStates(erow *row, int at, int removed, int inserted) {
+    struct stateIndex *si = row->states;
+    if (si == NULL) return;
+
+    if (row->size < LONG_LINE_MIN || E.syntax == NULL || si->lexer != E.syntax->lexer) {
+        free(si);
+        row->states = NULL;
+        return;
+    }
+
+    // The checkpoints before the edit, the lexer looks ahead of where it is for delimiters
+    int look = editorSyntaxLookahead(si->lexer);
+    int head = 1;
+    while (head < si->n && si->cp[head].at + look <= at) head++;
+
+    // The checkpoints after the edit
+    int j = head;
+    while (j < si->n && si->cp[j].at < at + removed) j++;
+
+    int d = inserted - removed;
+    for (int k = j; k < si->n; k++) si->cp[k].at += d;
+    memmove(&si->cp[head], &si->cp[j], sizeof(struct stateCheckpoint) * (si->n - j));
+    si->n -= j - head;
+    if (si->valid > head) si->valid = head;
+}
+
+// Marks a row whose chars changed as needing to be highlighted again
+// The row is only re-highlighted when it's drawn, and its new comment state is
+// worked out by editorSyntaxPropagate() when a row after it needs it
+void editorSyntaxInvalidate(int at) {
+    editorRowAt(at)->flags |= ROW_HL_STALE;
+
+    // Widen the range of rows that have to be scanned again to include the row
+    if (E.hl_dirty >= E.numrows) {
+        E.hl_dirty = at;
+        E.hl_dirty_end = at + 1;
+    } else {
+        if (at < E.hl_dirty) E.hl_dirty = at;
+        if (at + 1 > E.hl_dirty_end) E.hl_dirty_end = at + 1;
+    }
+}
+
+// Returns the current time of the monotonic clock in nanoseconds
+// Single keys take a few microseconds, so timing them needs finer steps than editorMonotonicUs()
+long long editorMonotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns the current time of the monotonic clock in microseconds
+long long editorMonotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Brings the cached comment state of every row before the given row index up to date
+// Each row remembers the state it started in (hl_entry) and ended in (hl_open_comment),
+// rows whose starting state changed are only marked stale instead of being highlighted
+// Once past the edited rows, the first row whose starting state is unchanged also
+// ends unchanged, so the rows after it don't need to be looked at
+// The dirty range works as the worklist, so no work is lost when the given
+// time budget runs out, the next call or editorIdle() picks up where this one stopped
+// The clock is checked every HL_PROPAGATE_CHECK_ROWS rows or HL_PROPAGATE_CHECK_BYTES
+// chars, whichever comes first, and a long row is left partway if the time
+// is up by then, its state index remembers how far it got
+// Returns 1 if every row before upto is up to date, 0 if the budget ran out first
+int editorSyntaxPropagate(int upto, long long budget_us) {
+    if (upto > E.numrows) upto = E.numrows;
+
+    // The lines of a file opened with -R don't all have a row to keep their state in
+    if (E.view != NULL) return editorViewPropagate(E.view, upto, budget_us);
+
+    long long deadline = editorMonotonicUs() + budget_us;
+    int rows = 0;
+    long long left = HL_PROPAGATE_CHECK_BYTES;
+
+    while (E.hl_dirty < upto) {
+        // Check the clock every so often rather than for every row
+        if (++rows == HL_PROPAGATE_CHECK_ROWS || left <= 0) {
+            if (editorMonotonicUs() >= deadline) return 0;
+            rows = 0;
+            left = HL_PROPAGATE_CHECK_BYTES;
+        }
+
+        int at = E.hl_dirty;
+        erow *row = editorRowAt(at);
+
+        // Set to true if the previous row has an unclosed multi-line comment
+        int in_comment = (at > 0 && editorRowAt(at - 1)->hl_open_comment);
+
+        // Stop at the first unedited row whose starting state didn't change
+        if (at >= E.hl_dirty_end && in_comment == row->hl_entry) {
+            E.hl_dirty = E.numrows;
+            return 1;
+        }
+
+        // The row's highlighting depends on its starting state
+        if (in_comment != row->hl_entry) row->flags |= ROW_HL_STALE;
+        row->hl_entry = in_comment;
+
+        // Scan the row for the state it leaves the next row in
+        if (row->size >= LONG_LINE_MIN) {
+            int open = editorSyntaxScanRow(row, in_comment, &left);
+
+            // Come back to a row that was left partway, even if it turns out
+            // to start in the state it's been given by then
+            if (open == -1) {
+                if (E.hl_dirty_end <= at) E.hl_dirty_end = at + 1;
+                continue;
+            }
+            row->hl_open_comment = open;
+        } else {
+            row->hl_open_comment = editorSyntaxScanState(row->chars, row->size, in_comment);
+            left -= row->size;
+        }
+
+        E.hl_dirty++;
+    }
+
+    return 1;
+}
+
+// Makes sure an erow's highlighting is current before it's drawn
+// The row's starting state is taken from the cache, callers run
+// editorSyntaxPropagate() first to bring it up to date
+void editorUpdateSyntax(erow *row) {
+    // Long rows are highlighted a window at a time while they're drawn
+    if (row->flags & ROW_LONG) {
+        row->flags &= ~ROW_HL_STALE;
+        return;
+    }
+
+    // Highlight the row again if it changed since it was last highlighted
+    if (row->hl == NULL || (row->flags & ROW_HL_STALE))
+        editorHighlightRow(row, row->hl_entry);
+}
+
+// Maps the highlight values to corresponding color codes
+int editorSyntaxToColor(int hl) {
+    switch (hl) {
+        // Numbers are highlighted red
+        case HL_NUMBER: return 31;
+
+        // Strings are highlighted magenta
+        case HL_STRING: return 35;
+
+        // Comments are highlighted as cyan
+        case HL_COMMENT:
+        case HL_MLCOMMENT: return 36;
+
+        // Specify two keyword types
+        // Actual keywords in one color (yellow) and 
+        // common type names in another color (green)
+        case HL_KEYWORD1: return 33;
+        case HL_KEYWORD2: return 32;
+
+        // Search results are highlighted blue
+        case HL_MATCH: return 34;
+
+        // Default is white
+        default: return 37;
+    }
+}
+
+// Match the current filename to one of the filematch fields in the HLDB
+// to the set the appropriate syntax highlighting for a filetype
+void editorSelectSyntaxHighlight() {
+    // Set to null so if there's no matches, there's no filename and filetype
+    E.syntax = NULL;
+
+    // If there's no filename, return immediately
+    if (E.filename == NULL) return;
+    
+    // Get the pointer to the extension part of the filename
+    // If there is none, this will be null
+    char *ext = strrchr(E.filename, '.');
+    
+    // Loop through each loaded filetype and then each editorSyntax struct in the HLDB array
+    // Filetypes from syntax files come first, so they can replace the built-in ones
+    for (unsigned int j = 0; j < E.nsyntaxes + HLDB_ENTRIES; j++) {
+        // Get pointer to the struct
+        struct editorSyntax *s = j < E.nsyntaxes ? &E.syntaxes[j] : &HLDB[j - E.nsyntaxes];
+        unsigned int i = 0;
+
+        // Loop through each pattern in the filematch array
+        while (s->filematch[i]) {
+            // Check if there's a file extension
+            int is_ext = (s->filematch[i][0] == '.');
+            
+            // If the pattern starts with a '.', we know it's a file extension
+            // and we see if the filename ends with that extension using strcmp()
+            // If it's not a file extension pattern, the we check to see if the 
+            // pattern exists anywhere in the filename using strstr()
+            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) || (!is_ext && strstr(E.filename, s->filematch[i]))) {
+                // Set syntax highlight to the current syntax struct
+                E.syntax = s;
+
+                // Compile the filetype's keywords and rules the first time it's used
+                if (s->kwtable == NULL) s->kwtable = editorCompileKeywords(s->keywords);
+                if (s->lexer == NULL) editorLexerCompile(s);
+
+                // Rehighlight the entire file after setting the syntax highlighting
+                // The rows are highlighted again as they're drawn
+                int filerow;
+                for (filerow = 0; filerow < E.numrows; filerow++) {
+                    editorRowAt(filerow)->flags |= ROW_HL_STALE;
+                }
+                E.hl_dirty = 0;
+                E.hl_dirty_end = E.numrows;
+
+                return;
+            }
+            
+            i++;
+        }
+    }
+}
+
+/*** syntax files ***/
+
+// Splits the next word off a line of a syntax file, words are separated by spaces and tabs
+// Returns null once there are no words left
+char *editorSyntaxWord(char **line) {
+    char *p = *line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '\0') return NULL;
+
+    char *word = p;
+    while (*p != '\0' && *p != ' ' && *p != '\t') p++;
+    if (*p != '\0') *p++ = '\0';
+
+    *line = p;
+    return word;
+}
+
+// Appends a copy of a word to a null terminated list of n words
+char **editorSyntaxListAdd(char **list, int *n, const char *word, const char *suffix) {
+    list = realloc(list, sizeof(char *) * (*n + 2));
+    if (list == NULL) die("realloc");
+
+    size_t len = strlen(word) + strlen(suffix) + 1;
+    list[*n] = malloc(len);
+    if (list[*n] == NULL) die("malloc");
+    snprintf(list[*n], len, "%s%s", word, suffix);
+
+    list[++*n] = NULL;
+    return list;
+}
+
+// Frees a null terminated list of words
+void editorSyntaxListFree(char **list) {
+    if (list == NULL) return;
+    for (int j = 0; list[j]; j++) free(list[j]);
+    free(list);
+}
+
+// Frees what editorSyntaxLoad() allocated for a filetype
+void editorSyntaxFree(struct editorSyntax *syntax) {
+    free(syntax->filetype);
+    editorSyntaxListFree(syntax->filematch);
+    editorSyntaxListFree(syntax->keywords);
+    free(syntax->singleline_comment_start);
+    free(syntax->multiline_comment_start);
+    free(syntax->multiline_comment_end);
+    free(syntax->quotes);
+}
+
+// Reads a filetype from a syntax file
+// Each line holds a directive followed by its words, lines starting with # are comments:
+//   filetype <name>             name shown in the status bar, required
+//   match <pattern>...          file extensions starting with a dot, or parts of file names, required
+//   keywords <word>...          keywords highlighted in one color
+//   types <word>...             keywords highlighted in another color, such as type names
+//   comment <start>             start of single-line comments
+//   multiline <start> <end>     delimiters of multi-line comments
+//   strings [<quotes>]          highlight strings started by each of the quote chars, " and ' by default
+//   numbers                     highlight numbers
+// Returns 0 on success, -1 with the reason written to err if the file can't be used
+int editorSyntaxLoad(const char *path, struct editorSyntax *syntax, char *err, size_t errlen) {
+    memset(syntax, 0, sizeof(struct editorSyntax));
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        snprintf(err, errlen, "%s", strerror(errno));
+        return -1;
+    }
+
+    int nmatch = 0;
+    int nkeywords = 0;
+    int lineno = 0;
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    err[0] = '\0';
+
+    while (err[0] == '\0' && (linelen = getline(&line, &linecap, fp)) != -1) {
+        lineno++;
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) line[--linelen] = '\0';
+
+        char *p = line;
+        char *directive = editorSyntaxWord(&p);
+        if (directive == NULL || directive[0] == '#') continue;
+
+        char *arg = editorSyntaxWord(&p);
+        char *arg2 = arg ? editorSyntaxWord(&p) : NULL;
+
+        if (!strcmp(directive, "filetype") && arg && !arg2) {
+            free(syntax->filetype);
+            syntax->filetype = strdup(arg);
+        } else if (!strcmp(directive, "match") && arg) {
+            for (; arg; arg = arg2, arg2 = arg ? editorSyntaxWord(&p) : NULL)
+                syntax->filematch = editorSyntaxListAdd(syntax->filematch, &nmatch, arg, "");
+        } else if ((!strcmp(directive, "keywords") || !strcmp(directive, "types")) && arg) {
+            // Keywords of the second kind end in a pipe char, like in HLDB
+            const char *suffix = directive[0] == 't' ? "|" : "";
+            for (; arg; arg = arg2, arg2 = arg ? editorSyntaxWord(&p) : NULL)
+                syntax->keywords = editorSyntaxListAdd(syntax->keywords, &nkeywords, arg, suffix);
+        } else if (!strcmp(directive, "comment") && arg && !arg2) {
+            free(syntax->singleline_comment_start);
+            syntax->singleline_comment_start = strdup(arg);
+        } else if (!strcmp(directive, "multiline") && arg && arg2 && !editorSyntaxWord(&p)) {
+            free(syntax->multiline_comment_start);
+            free(syntax->multiline_comment_end);
+            syntax->multiline_comment_start = strdup(arg);
+            syntax->multiline_comment_end = strdup(arg2);
+        } else if (!strcmp(directive, "strings") && !arg2) {
+            if (arg && strlen(arg) > LEX_MAX_QUOTES) {
+                snprintf(err, errlen, "line %d: at most %d quote chars", lineno, LEX_MAX_QUOTES);
+                break;
+            }
+            free(syntax->quotes);
+            syntax->quotes = strdup(arg ? arg : "\"'");
+            syntax->flags |= HL_HIGHLIGHT_STRINGS;
+        } else if (!strcmp(directive, "numbers") && !arg) {
+            syntax->flags |= HL_HIGHLIGHT_NUMBERS;
+        } else {
+            snprintf(err, errlen, "line %d: can't make sense of %s", lineno, directive);
+        }
+    }
+
+    free(line);
+    fclose(fp);
+
+    if (err[0] == '\0' && syntax->filetype == NULL) snprintf(err, errlen, "no filetype");
+    if (err[0] == '\0' && syntax->filematch == NULL) snprintf(err, errlen, "no match");
+    if (err[0] != '\0') {
+        editorSyntaxFree(syntax);
+        return -1;
+    }
+
+    // An empty keyword list still has to be a list
+    if (syntax->keywords == NULL) syntax->keywords = editorSyntaxListAdd(NULL, &nkeywords, "", "");
+
+    return 0;
+}
+
+// Loads every syntax file in the syntax directory, in order of their names
+// The directory is the one named by SIMPLE_TEXT_EDITOR_SYNTAX, or SYNTAX_DIR
+// in the home directory. Without it, only the built-in filetypes are known
+// A file that can't be used is skipped, the first one and why is written to report,
+// which is left empty if every file could be used
+// Called before any file is opened, pointers into the list are kept from then on
+void editorSyntaxLoadAll(char *report, size_t reportlen) {
+    report[0] = '\0';
+
+    const char *env = getenv(SYNTAX_DIR_ENV);
+    const char *home = getenv("HOME");
+    if (env == NULL && home == NULL) return;
+
+    size_t dirlen = env ? strlen(env) + 1 : strlen(home) + sizeof(SYNTAX_DIR) + 1;
+    char *dir = malloc(dirlen);
+    if (dir == NULL) die("malloc");
+    if (env) snprintf(dir, dirlen, "%s", env);
+    else snprintf(dir, dirlen, "%s/%s", home, SYNTAX_DIR);
+
+    struct dirent **names;
+    int n = scandir(dir, &names, NULL, alphasort);
+    if (n == -1) {
+        free(dir);
+        return;
+    }
+
+    for (int j = 0; j < n; j++) {
+        const char *name = names[j]->d_name;
+        size_t namelen = strlen(name);
+        size_t suffixlen = strlen(SYNTAX_SUFFIX);
+
+        if (namelen > suffixlen && !strcmp(name + namelen - suffixlen, SYNTAX_SUFFIX)) {
+            size_t len = strlen(dir) + namelen + 2;
+            char *path = malloc(len);
+            if (path == NULL) die("malloc");
+            snprintf(path, len, "%s/%s", dir, name);
+
+            struct editorSyntax syntax;
+            char err[80];
+            if (editorSyntaxLoad(path, &syntax, err, sizeof(err)) == 0) {
+                E.syntaxes = realloc(E.syntaxes, sizeof(struct editorSyntax) * (E.nsyntaxes + 1));
+                if (E.syntaxes == NULL) die("realloc");
+                E.syntaxes[E.nsyntaxes++] = syntax;
+            } else if (report[0] == '\0') {
+                snprintf(report, reportlen, "Syntax file %s: %s", name, err);
+            }
+
+            free(path);
+        }
+
+        free(names[j]);
+    }
+
+    free(names);
+    free(dir);
+}
+
+/*** row storage ***/
+
+// Returns a pointer to the erow at the given row index of the file
+// Rows at or after the gap are stored gaplen slots further along the array
+erow *editorRowAt(int at) {
+    // Rows of a file opened with -R come from its row cache
+    if (E.view != NULL) return editorViewRow(E.view, at);
+
+    return &E.row[at < E.gap ? at : at + E.gaplen];
+}
+
+// Returns a pointer to the erow at the given row index of a parked buffer
+erow *editorBufferRowAt(struct editorBuffer *b, int at) {
+    return &b->row[at < b->gap ? at : at + b->gaplen];
+}
+
+// Returns the row index of an erow stored in the row array
+// Replaces a per-row idx field, which had to be renumbered on every insert and delete
+int editorRowIndex(erow *row) {
+    if (E.view != NULL) return ((struct viewRow *) row)->line;
+
+    int slot = row - E.row;
+    return slot < E.gap ? slot : slot - E.gaplen;
+}
+
+// Moves the gap so that it starts at the given row index
+// Only the rows between the old and the new gap position are shifted
+void editorRowMoveGap(int at) {
+    if (at < E.gap) {
+        // Shift the rows in [at, gap) to the back end of the gap
+        memmove(&E.row[at + E.gaplen], &E.row[at], sizeof(erow) * (E.gap - at));
+    } else if (at > E.gap) {
+        // Shift the rows in [gap, at) from the back end of the gap to the front
+        memmove(&E.row[E.gap], &E.row[E.gap + E.gaplen], sizeof(erow) * (at - E.gap));
+    }
+
+    E.gap = at;
+}
+
+// Makes sure the gap has room for at least n more rows
+// Capacity grows geometrically so inserting rows is amortized O(1)
+void editorRowReserve(int n) {
+    if (E.gaplen >= n) return;
+
+    int newcap = E.rowcap ? E.rowcap * 2 : 16;
+    while (newcap - E.numrows < n) newcap *= 2;
+    erow *new = realloc(E.row, sizeof(erow) * newcap);
+    if (new == NULL) die("realloc");
+
+    // Move the rows after the gap to the end of the larger array
+    // The gap may not be empty when more than one row is reserved
+    int after = E.numrows - E.gap;
+    memmove(&new[newcap - after], &new[E.gap + E.gaplen], sizeof(erow) * after);
+
+    E.row = new;
+    E.gaplen = newcap - E.numrows;
+    E.rowcap = newcap;
+}
+
+/*** row operations ***/
+
+// Calculate the render position of cursor position cx, given the render position rx of char j
+// Scans the chars from j on, which has to be the start of a UTF-8 char
+int editorRowScanCxToRx(erow *row, int j, int rx, int cx) {
+    int attach = editorCharAttach(row->chars, row->size, j);
+
+    // Loop through the chars to the left of the cursor position (cx)
+    // a run of ASCII chars other than tabs at a time, editorAsciiSpan() finds
+    // the end of the run with vector instructions and each of its chars takes
+    // up one column. Only tabs and the chars of other scripts are looked at one by one
+    while (j < cx) {
+        int n = editorAsciiSpan(&row->chars[j], cx - j);
+        if (n > 0) {
+            rx += n;
+            j += n;
+            editorCharColumns((unsigned char) row->chars[j - 1], &attach);
+            continue;
+        }
+
+        if (row->chars[j] == '\t') {
+            // rx % TAB_STOP_LENGTH for how many columns we're to the right of the last tab stop
+            // TAB_STOP_LENGTH - 1 for how many columns we're to the left of the next tab stop
+            // Add to rx to get to the left of the next tab stop
+            rx += (TAB_STOP_LENGTH - 1) - (rx % TAB_STOP_LENGTH);
+
+            // Go to the next tab stop
+            rx++;
+            j++;
+            attach = 0;
+            continue;
+        }
+
+        int cp;
+        j += editorUtf8Decode(&row->chars[j], row->size - j, &cp);
+        rx += editorCharColumns(cp, &attach);
+    }
+
+    return rx;
+}
+
+// Calculate the cursor position of render position rx, given the render position cur_rx of char cx
+// Scans the chars from cx on, which has to be the start of a UTF-8 char
+int editorRowScanRxToCx(erow *row, int cx, int cur_rx, int rx) {
+    int attach = editorCharAttach(row->chars, row->size, cx);
+
+    // Loop through the chars in the string a run of ASCII chars other than tabs at a time
+    while (cx < row->size) {
+        // The run only has to be followed up to the given render position
+        int want = rx >= cur_rx ? rx - cur_rx + 1 : 1;
+        int n = editorAsciiSpan(&row->chars[cx], row->size - cx < want ? row->size - cx : want);
+        if (n > 0) {
+            // When the run reaches past the given render position,
+            // return the cursor position of the char at it
+            if (cur_rx + n > rx) return cx + (rx > cur_rx ? rx - cur_rx : 0);
+            cur_rx += n;
+            cx += n;
+            editorCharColumns((unsigned char) row->chars[cx - 1], &attach);
+            continue;
+        }
+
+        if (row->chars[cx] == '\t') {
+            // rx % TAB_STOP_LENGTH for how many columns we're to the right of the last tab stop
+            // TAB_STOP_LENGTH - 1 for how many columns we're to the left of the next tab stop
+            // Add to rx to get to the left of the next tab stop
+            cur_rx += (TAB_STOP_LENGTH - 1) - (cur_rx % TAB_STOP_LENGTH);
+
+            // Go to the next tab stop
+            cur_rx++;
+
+            // When the tab reaches past the given render position, return its position
+            if (cur_rx > rx) return cx;
+            cx++;
+            attach = 0;
+            continue;
+        }
+
+        // A wide char covers two render positions, either one gives its position
+        // Combining marks have none of their own, so they're never the char at one
+        int cp;
+        int len = editorUtf8Decode(&row->chars[cx], row->size - cx, &cp);
+        cur_rx += editorCharColumns(cp, &attach);
+        if (cur_rx > rx) return cx;
+        cx += len;
+    }
+
+    // Return in the case that the caller provided a 
+    // render position that is out of range
+    return cx;
+}
+
+// Makes room for n checkpoints in a row's column index
+struct colIndex *editorColIndexReserve(erow *row, int n) {
+    struct colIndex *cols = row->cols;
+    if (cols != NULL && n <= cols->cap) return cols;
+
+    int cap = cols != NULL ? cols->cap : 0;
+    if (cap < n) cap = n + n / 4;
+    cols = realloc(cols, sizeof(struct colIndex) + sizeof(struct colCheckpoint) * cap);
+    if (cols == NULL) die("realloc");
+    if (row->cols == NULL) cols->n = 0;
+    cols->cap = cap;
+
+    row->cols = cols;
+    return cols;
+}
+
+// Fills in the checkpoints of a row's column index after checkpoint k,
+// about every COL_INDEX_STEP-th char up to the char at end
+// The slots after k have to be free for them, up to the one returned
+// Returns the index of the last checkpoint filled in
+int editorColIndexFill(erow *row, int k, int end) {
+    struct colCheckpoint *cp = row->cols->cp;
+
+    for (int cx = cp[k].cx + COL_INDEX_STEP; cx < end; cx += COL_INDEX_STEP) {
+        int at = editorUtf8Start(row->chars, row->size, cx);
+        cp[k + 1].cx = at;
+        cp[k + 1].rx = editorRowScanCxToRx(row, cp[k].cx, cp[k].rx, at);
+        cp[k].tab = memchr(&row->chars[cp[k].cx], '\t', at - cp[k].cx) != NULL;
+        k++;
+    }
+
+    return k;
+}
+
+// Number of checkpoints editorColIndexFill() adds after a checkpoint at cx, up to end
+int editorColIndexFillCount(int cx, int end) {
+    return end > cx + 1 ? (end - cx - 1) / COL_INDEX_STEP : 0;
+}
+
+// Returns the last checkpoint of a column index at or before cx
+int editorColIndexFind(struct colIndex *cols, int cx) {
+    int lo = 0, hi = cols->n - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (cols->cp[mid].cx <= cx) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Returns the column index of a long row, building it if the row doesn't have a current one
+// Returns null for rows short enough to scan from the start
+struct colIndex *editorRowColIndex(erow *row) {
+    if (row->size < COL_INDEX_MIN_ROW) return NULL;
+
+    // The index is kept as long as it's current for the row as it is now
+    struct colIndex *cols = row->cols;
+    if (cols != NULL && cols->chars == row->chars && cols->size == row->size) return cols;
+
+    cols = editorColIndexReserve(row, editorColIndexFillCount(0, row->size) + 1);
+    cols->chars = row->chars;
+    cols->size = row->size;
+
+    // Each checkpoint continues the scan from the one before it
+    cols->cp[0].cx = 0;
+    cols->cp[0].rx = 0;
+    int last = editorColIndexFill(row, 0, row->size);
+    cols->cp[last].tab = memchr(&row->chars[cols->cp[last].cx], '\t', row->size - cols->cp[last].cx) != NULL;
+    cols->n = last + 1;
+
+    return cols;
+}
+
+// Throws away the column index of a row
+void editorRowDropColIndex(erow *row) {
+    free(row->cols);
+    row->cols = NULL;
+}
+
+// Brings the column index of a row up to date after removed chars at offset at
+// were replaced by inserted ones
+// The checkpoints before the edit stay, the ones in it are filled in again and
+// the ones after it move by the change in length and columns. A change in columns
+// that isn't a whole number of tab stops changes how wide the next tab is, so the
+// render positions after it are worked out again up to the first tab
+void editorRowShiftColIndex(erow *row, int at, int removed, int inserted) {
+    struct colIndex *cols = row->cols;
+    if (cols == NULL) return;
+
+    // An index that wasn't current before the edit is built again when it's needed
+    if (row->size < COL_INDEX_MIN_ROW || cols->size != row->size - inserted + removed) {
+        editorRowDropColIndex(row);
+        return;
+    }
+
+    // The last checkpoint before the edit and the first one after it
+    int i = at > 0 ? editorColIndexFind(cols, at - 1) : 0;
+    int j = i + 1;
+    while (j < cols->n && cols->cp[j].cx < at + removed) j++;
+
+    // Make room for the checkpoints the edited chars get, and move the ones after them
+    int d = inserted - removed;
+    int end = j < cols->n ? cols->cp[j].cx + d : row->size;
+    int m = editorColIndexFillCount(cols->cp[i].cx, end);
+    int tail = cols->n - j;
+    cols = editorColIndexReserve(row, i + 1 + m + tail);
+    memmove(&cols->cp[i + 1 + m], &cols->cp[j], sizeof(struct colCheckpoint) * tail);
+    cols->chars = row->chars;
+    cols->size = row->size;
+    cols->n = i + 1 + m + tail;
+
+    int k = editorColIndexFill(row, i, end);
+    struct colCheckpoint *cp = cols->cp;
+    cp[k].tab = memchr(&row->chars[cp[k].cx], '\t', end - cp[k].cx) != NULL;
+
+    // Shift the checkpoints after the edit
+    int shift = 0;
+    for (k++; k < cols->n; k++) {
+        cp[k].cx += d;
+
+        if (k == i + 1 + m || (shift % TAB_STOP_LENGTH != 0 && cp[k - 1].tab)) {
+            int rx = editorRowScanCxToRx(row, cp[k - 1].cx, cp[k - 1].rx, cp[k].cx);
+            shift = rx - cp[k].rx;
+            cp[k].rx = rx;
+        } else {
+            cp[k].rx += shift;
+        }
+    }
+}
+
+// Calculate the value of the horizontal render position from the cursor position
+// Rows with UTF-8 text look it up in their glyphs, long rows start from
+// the checkpoint at or before the cursor position
+int editorRowCxToRx(erow *row, int cx) {
+    if (row->glyphs != NULL) {
+        const struct rowGlyph *g = row->glyphs->g;
+        int n = row->glyphs->n;
+        if (cx >= row->size) return g[n].rx;
+
+        // A run of ASCII chars has one column per char, anything else
+        // is a single char the cursor is on the first column of
+        int k = editorGlyphAtCx(g, n, cx);
+        if (g[k + 1].cx - g[k].cx == g[k + 1].rx - g[k].rx) return g[k].rx + cx - g[k].cx;
+        return g[k].rx;
+    }
+
+    struct colIndex *cols = editorRowColIndex(row);
+    if (cols == NULL || cx <= 0) return editorRowScanCxToRx(row, 0, 0, cx);
+
+    int k = editorColIndexFind(cols, cx);
+    return editorRowScanCxToRx(row, cols->cp[k].cx, cols->cp[k].rx, cx);
+}
+
+// Calculate the cursor position from the horizontal render position
+// Rows with UTF-8 text look it up in their glyphs, long rows start from the last
+// checkpoint at or before the render position, every char before a checkpoint
+// ends at or before its render position
+int editorRowRxToCx(erow *row, int rx) {
+    if (row->glyphs != NULL) {
+        const struct rowGlyph *g = row->glyphs->g;
+        int n = row->glyphs->n;
+        if (rx >= g[n].rx) return row->size;
+
+        int k = editorGlyphAtRx(g, n, rx);
+        if (g[k + 1].cx - g[k].cx == g[k + 1].rx - g[k].rx) return g[k].cx + rx - g[k].rx;
+        return g[k].cx;
+    }
+
+    struct colIndex *cols = editorRowColIndex(row);
+    if (cols == NULL) return editorRowScanRxToCx(row, 0, 0, rx);
+
+    // Binary search for the checkpoint, the render positions only go up
+    int lo = 0, hi = cols->n - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (cols->cp[mid].rx <= rx) lo = mid;
+        else hi = mid - 1;
+    }
+
+    return editorRowScanRxToCx(row, cols->cp[lo].cx, cols->cp[lo].rx, rx);
+}
+
+// Throws away the glyphs of a row that's all ASCII now or too long to have them
+void editorRowDropGlyphs(erow *row) {
+    editorPoolFree(row->glyphs, row->glyphclass);
+    row->glyphs = NULL;
+    row->glyphclass = 0;
+}
+
+// Lays out a row with UTF-8 text in glyphs and keeps them with the row
+// Writes the render string to render unless it's null, see editorLayoutGlyphs()
+void editorRowLayout(erow *row, char *render) {
+    int n = editorLayoutGlyphs(row->chars, row->size, 0, 0, render);
+
+    row->glyphs = editorPoolGrow(row->glyphs, &row->glyphclass, 0,
+                                 sizeof(struct rowGlyphs) + sizeof(struct rowGlyph) * (n + 1));
+    row->glyphs->n = n;
+    memcpy(row->glyphs->g, E.glyphbuf, sizeof(struct rowGlyph) * (n + 1));
+}
+
+// Returns the number of screen columns a rendered row takes up
+// Only differs from its render size for rows with UTF-8 text, a long row's render
+// size is its number of columns already
+int editorRowColumns(erow *row) {
+    if (row->glyphs != NULL) return row->glyphs->g[row->glyphs->n].rx;
+    return row->rsize;
+}
+
+// Use the string of an erow to fill the contents of the render string
+// Rows with chars other than ASCII are also laid out in glyphs, which is where the
+// screen columns of their chars are looked up from then on, so their chars only
+// have to be decoded here. Rows that are all ASCII, which most are, skip that
+void editorRenderRow(erow *row) {
+    int j;
+    int tabs = 0;
+    int idx = 0;
+
+    // A long row has no render string or highlighting of its own,
+    // only the part of it on the screen is rendered when it's drawn
+    // Its render size is still needed to know how far it can be scrolled
+    if (row->size >= LONG_LINE_MIN) {
+        if (!(row->flags & ROW_RENDER_ALIAS)) editorPoolFree(row->render, row->renderclass);
+        editorPoolFree(row->hl, row->hlclass);
+        editorRowDropGlyphs(row);
+        row->render = NULL;
+        row->renderclass = 0;
+        row->hl = NULL;
+        row->hlclass = 0;
+        row->flags &= ~ROW_RENDER_ALIAS;
+        row->flags |= ROW_LONG;
+        row->rsize = editorRowCxToRx(row, row->size);
+        return;
+    }
+    row->flags &= ~ROW_LONG;
+
+    // Count the number of tabs contained in the string
+    // to know how much memory to allocate for render
+    tabs = editorCountByte(row->chars, row->size, '\t');
+
+    int ascii = editorIsAscii(row->chars, row->size);
+    if (ascii) editorRowDropGlyphs(row);
+
+    // Without tabs the render string is the same as the chars,
+    // so the row's chars are shown as they are instead of being copied
+    if (tabs == 0) {
+        if (!(row->flags & ROW_RENDER_ALIAS)) editorPoolFree(row->render, row->renderclass);
+        row->render = row->chars;
+        row->renderclass = 0;
+        row->rsize = row->size;
+        row->flags |= ROW_RENDER_ALIAS;
+        if (!ascii) editorRowLayout(row, NULL);
+        return;
+    }
+
+    // The chars were shown as they are until now,
+    // they might have moved since, so don't touch the old pointer
+    if (row->flags & ROW_RENDER_ALIAS) {
+        row->render = NULL;
+        row->renderclass = 0;
+        row->flags &= ~ROW_RENDER_ALIAS;
+    }
+
+    // Make sure the render buffer can hold the render string
+    // It's usually big enough already after a small edit
+    row->render = editorPoolGrow(row->render, &row->renderclass, 0,
+                                 row->size + tabs * (TAB_STOP_LENGTH - 1) + 1);
+
+    // Where the tabs of a row with UTF-8 text go to depends on the columns of the chars
+    // before them, so the render string is written while it's laid out
+    if (!ascii) {
+        editorRowLayout(row, row->render);
+        row->rsize = row->glyphs->g[row->glyphs->n].ridx;
+        row->render[row->rsize] = '\0';
+        return;
+    }
+
+    // Copy chars stored in the erow to the render buffer
+    // Render tabs as multiple space chars
+    // The chars between tabs are copied a run at a time
+    j = 0;
+    while (j < row->size) {
+        const char *tab = memchr(&row->chars[j], '\t', row->size - j);
+        int n = (tab ? tab - row->chars : row->size) - j;
+        memcpy(&row->render[idx], &row->chars[j], n);
+        idx += n;
+        j += n;
+
+        // If the char in the string is a tab, render it as a space
+        // and append spaces until we get to a tab stop (a column divisible by 8)
+        if (tab) {
+            row->render[idx++] = ' ';
+            while (idx % TAB_STOP_LENGTH != 0) row->render[idx++] = ' ';
+            j++;
+        }
+    }
+
+    // Terminate render string with null char
+    row->render[idx] = '\0';
+
+    // idx contains the number of chars we copied into render
+    // Assign it to render size
+    row->rsize = idx;
+}
+
+// Updates an erow after removed chars at offset at were replaced by inserted ones
+void editorUpdateRow(erow *row, int at, int removed, int inserted) {
+    editorRowShiftColIndex(row, at, removed, inserted);
+    editorRowShiftStates(row, at, removed, inserted);
+    editorRenderRow(row);
+
+    // The row gets highlighted again the next time it's drawn
+    editorSyntaxInvalidate(editorRowIndex(row));
+}
+
+// Opens up an empty erow at the specified index and returns it
+// The caller is expected to fill in the size and chars of the new row
+erow *editorRowSlot(int at) {
+    // Make room for the new row and move the gap to the specified index,
+    // the new row takes the first slot of the gap
+    editorRowReserve(1);
+    editorRowMoveGap(at);
+    erow *row = &E.row[at];
+    E.gap++;
+    E.gaplen--;
+
+    // Update number of rows
+    E.numrows++;
+
+    // Rows after the new one shift down, so the range of rows
+    // whose comment state has to be scanned again does too
+    if (at < E.hl_dirty) E.hl_dirty++;
+    if (at < E.hl_dirty_end) E.hl_dirty_end++;
+
+    // Initialize render and highlighting
+    row->size = 0;
+    row->chars = NULL;
+    row->rsize = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->hl_open_comment = 0;
+    row->hl_entry = 0;
+    row->flags = ROW_HL_STALE;
+    row->cols = NULL;
+    row->states = NULL;
+    row->glyphs = NULL;
+    row->charsclass = 0;
+    row->renderclass = 0;
+    row->hlclass = 0;
+    row->glyphclass = 0;
+
+    return row;
+}
+
+// Inserts a row at the specified index 
+void editorInsertRow(int at, char *s, size_t len) {
+    // If the index is not within the row, then exit the function
+    if (at < 0 || at > E.numrows) return;
+
+    // Get an empty row at the index
+    erow *row = editorRowSlot(at);
+
+    // Set row size to length of the line
+    row->size = len;
+
+    // Allocate memory for the line 
+    row->chars = editorPoolAlloc(len + 1, &row->charsclass);
+
+    // Store line to chars field which points to the allocated memory
+    memcpy(row->chars, s, len);
+
+    // Terminate string with null char
+    row->chars[len] = '\0';
+
+    // The render string is filled in when the row is first drawn,
+    // so inserting many rows at once doesn't render rows nobody looks at
+    editorSyntaxInvalidate(at);
+
+    // Increment in each row operation that makes a change to the text
+    E.dirty++;
+}
+
+// Appends a row whose chars point into the memory-mapped file
+// The row gets no render or highlighting until editorRowMaterialize() is called on it
+void editorAppendMappedRow(char *s, size_t len) {
+    erow *row = editorRowSlot(E.numrows);
+    row->size = len;
+    row->chars = s;
+    row->flags |= ROW_MAPPED;
+
+    // The row's comment state is scanned when a row after it is drawn
+    editorSyntaxInvalidate(E.numrows - 1);
+}
+
+// Inserts the lines of a text as new rows at the specified index, all at once
+// The text holds one line per row separated by newlines, so a text ending in
+// a newline ends with an empty row. With strip_cr, carriage returns before
+// each newline are dropped, as when lines are read from a file
+// Inserting them one by one with editorInsertRow() would check the gap and
+// widen the range of rows whose comment state has to be scanned again for each
+// row, here the gap is moved and grown once for all of them and the range is
+// widened once, so the rows are scanned in one go when they're needed
+// E.dirty is left alone, it's up to the caller whether the rows are a change
+// Returns the number of rows inserted
+int editorInsertRows(int at, const char *s, size_t len, int strip_cr) {
+    if (at < 0 || at > E.numrows) return 0;
+
+    const char *end = s + len;
+    const char *p;
+
+    // Count the lines first, so the gap only has to grow once
+    int n = 1;
+    for (p = s; (p = memchr(p, '\n', end - p)) != NULL; p++) n++;
+
+    editorRowMoveGap(at);
+    editorRowReserve(n);
+
+    for (p = s; ; ) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *eol = nl ? nl : end;
+
+        size_t linelen = eol - p;
+        while (strip_cr && nl && linelen > 0 && p[linelen - 1] == '\r') linelen--;
+
+        // The new rows fill the gap from its start, and get rendered when they're first drawn
+        erow *row = &E.row[E.gap++];
+        memset(row, 0, sizeof(erow));
+        row->flags = ROW_HL_STALE;
+        row->size = linelen;
+        row->chars = editorPoolAlloc(linelen + 1, &row->charsclass);
+        memcpy(row->chars, p, linelen);
+        row->chars[linelen] = '\0';
+
+        if (nl == NULL) break;
+        p = nl + 1;
+    }
+
+    E.gaplen -= n;
+
+    // Rows after the new ones shift down, and the new ones have to be scanned
+    int clean = E.hl_dirty >= E.numrows;
+    E.numrows += n;
+    if (clean) {
+        E.hl_dirty = at;
+        E.hl_dirty_end = at + n;
+    } else {
+        if (at < E.hl_dirty) E.hl_dirty = at;
+        if (at < E.hl_dirty_end) E.hl_dirty_end += n;
+        if (at + n > E.hl_dirty_end) E.hl_dirty_end = at + n;
+    }
+
+    return n;
+}
+
+// Gives a row its own copy of its chars before they're modified
+// Rows loaded from the mapped file share the read-only mapping until then
+void editorRowOwnChars(erow *row) {
+    if (!(row->flags & ROW_MAPPED)) return;
+
+    char *chars = editorPoolAlloc(row->size + 1, &row->charsclass);
+    memcpy(chars, row->chars, row->size);
+    chars[row->size] = '\0';
+
+    row->chars = chars;
+    row->flags &= ~ROW_MAPPED;
+
+    // A row without tabs is shown from its chars, which moved
+    if (row->flags & ROW_RENDER_ALIAS) row->render = chars;
+}
+
+// Makes sure the row at the specified index is rendered and its highlighting is current
+// Called for rows that scroll into view, so rows of a large file that are
+// never looked at don't pay for a render and hl buffer
+void editorRowMaterialize(int at) {
+    erow *row = editorRowAt(at);
+
+    if (row->render == NULL && !(row->flags & ROW_LONG)) editorRenderRow(row);
+    editorUpdateSyntax(row);
+}
+
+// Frees the memory owned by the erow being deleted
+void editorFreeRow(erow *row) {
+    if (!(row->flags & ROW_RENDER_ALIAS)) editorPoolFree(row->render, row->renderclass);
+    if (!(row->flags & ROW_MAPPED)) editorPoolFree(row->chars, row->charsclass);
+    editorPoolFree(row->hl, row->hlclass);
+    editorPoolFree(row->glyphs, row->glyphclass);
+    free(row->cols);
+    free(row->states);
+}
+
+// Deletes n rows starting at the specified index, all at once
+// The gap is moved once and grown over all of them, instead of once per row
+// E.dirty is left alone, it's up to the caller whether it's a change
+void editorDelRows(int at, int n) {
+    if (at < 0 || n <= 0 || at + n > E.numrows) return;
+
+    // Free the memory of the rows being deleted
+    for (int j = at; j < at + n; j++) editorFreeRow(editorRowAt(j));
+
+    // Move the gap to the row after the deleted ones and grow it backwards over them
+    editorRowMoveGap(at + n);
+    E.gap -= n;
+    E.gaplen += n;
+
+    // Rows after the deleted ones shift up, so the range of rows
+    // whose comment state has to be scanned again does too
+    if (at + n <= E.hl_dirty) E.hl_dirty -= n;
+    else if (at < E.hl_dirty) E.hl_dirty = at;
+    if (at + n <= E.hl_dirty_end) E.hl_dirty_end -= n;
+    else if (at < E.hl_dirty_end) E.hl_dirty_end = at;
+
+    E.numrows -= n;
+
+    // The row that took the deleted rows' place may start in a different state
+    if (at < E.numrows) editorSyntaxInvalidate(at);
+}
+
+// Deletes a row
+void editorDelRow(int at) {
+    // If the index is not within the row, then exit the function
+    if (at < 0 || at >= E.numrows) return;
+
+    // Free the memory of the row being deleted
+    editorFreeRow(editorRowAt(at));
+
+    // Move the gap to the row after the deleted one and
+    // grow the gap backwards over the deleted row
+    editorRowMoveGap(at + 1);
+    E.gap--;
+    E.gaplen++;
+
+    // Rows after the deleted one shift up, so the range of rows
+    // whose comment state has to be scanned again does too
+    if (at < E.hl_dirty) E.hl_dirty--;
+    if (at < E.hl_dirty_end) E.hl_dirty_end--;
+
+    // Decrement the number of rows
+    E.numrows--;
+
+    // The row that took the deleted row's place may start in a different state
+    if (at < E.numrows) editorSyntaxInvalidate(at);
+
+    // Increment in each row operation that makes a change to the text
+    E.dirty++;
+}
+
+// Inserts a single char into an erow at a given position
+void editorRowInsertChar(erow *row, int at, int c) {
+    // Validate the index we want to insert into
+    // Allowed to go one char past the end of the string, so we insert at the end
+    if (at < 0 || at > row->size) at = row->size;
+
+    // Copy the chars out of the mapped file before changing them
+    editorRowOwnChars(row);
+
+    // Make room for one more byte in the chars of the erow
+    // Add 2 because we need to make space for the null byte
+    // The spare room of the buffer usually has space for it already
+    row->chars = editorPoolGrow(row->chars, &row->charsclass, row->size + 1, row->size + 2);
+
+    // Move the char at the index we are inserting to the next index
+    // Using memmove() because we are handling overlapping memory areas
+    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+
+    // Increment size of array 
+    row->size++;
+
+    // Assign character at the given position in the array
+    row->chars[at] = c;
+
+    // Update the render string to update the new row content
+    editorUpdateRow(row, at, 0, 1);
+
+    // Increment in each row operation that makes a change to the text
+    E.dirty++;
+}
+
+// Inserts a string into an erow at a given position
+void editorRowInsertString(erow *row, int at, const char *s, size_t len) {
+    // Validate the index we want to insert into
+    if (at < 0 || at > row->size) at = row->size;
+
+    // Copy the chars out of the mapped file before changing them
+    editorRowOwnChars(row);
+
+    // Make room for the string and the null byte
+    row->chars = editorPoolGrow(row->chars, &row->charsclass, row->size + 1, row->size + len + 1);
+
+    // Move the chars after the index past the inserted string, including the null byte
+    memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+
+    // Update the render string to update the new row content
+    editorUpdateRow(row, at, 0, len);
+
+    // Increment in each row operation that makes a change to the text
+    E.dirty++;
+}
+
+// Appends a string to the end of a row
+void editorRowAppendString(erow *row, char *s, size_t len) {
+    // Copy the chars out of the mapped file before changing them
+    editorRowOwnChars(row);
+
+    // After appending, the row's new size is row->size + len + 1
+    // Make sure the chars buffer holds that much
+    row->chars = editorPoolGrow(row->chars, &row->charsclass, row->size + 1, row->size + len + 1);
+
+    // Copy the given string to the end of the current string content of the row
+    memcpy(&row->chars[row->size], s, len);
+
+    // Increase the row size by the length of the appended string
+    row->size += len;
+
+    // Append null byte at the end of the new string
+    row->chars[row->size] = '\0';
+
+    // Update the render string to update the new row content
+    editorUpdateRow(row, row->size - len, 0, len);
+
+    // Increment in each row operation that makes a change to the text
+    E.dirty++;
+}
+
+// Deletes len chars of an erow starting at a given position
+void editorRowDelChars(erow *row, int at, int len) {
+    // If the range is not within the row, then exit the function
+    if (at < 0 || len <= 0 || at + len > row->size) return;
+
+    // Copy the chars out of the mapped file before changing them
+    editorRowOwnChars(row);
+
+    // Move the chars after the range, including the null byte, over it
+    memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+    row->size -= len;
+
+    // Update the render string to update the new row content
+    editorUpdateRow(row, at, len, 0);
+
+    // Increment in each row operation that makes a change to the text
+    E.dirty++;
+}
+
+// Joins the chars of row y before x with the chars of row ey from ex on, and deletes
+// the rows after y up to ey, as when the text between the two positions is deleted
+// The shorter side is copied over to the other one, so joining a short row to a
+// long one doesn't copy the long one to a new buffer and leave its old buffer behind
+void editorRowJoin(int y, int x, int ey, int ex) {
+    erow *row = editorRowAt(y);
+    erow *last = editorRowAt(ey);
+
+    if (x < last->size - ex) {
+        // Put the start of the first row in place of the deleted start of the last one
+        editorRowDelChars(last, 0, ex);
+        if (x > 0) editorRowInsertString(last, 0, row->chars, x);
+        editorDelRows(y, ey - y);
+    } else {
+        editorRowDelChars(row, x, row->size - x);
+        editorRowAppendString(row, &last->chars[ex], last->size - ex);
+        editorDelRows(y + 1, ey - y);
+    }
+}
+
+// Deletes a character in an erow
+void editorRowDelChar(erow *row, int at) {
+    // If the index is not within the row, then exit the function
+    if (at < 0 || at >= row->size) return;
+
+    // Copy the chars out of the mapped file before changing them
+    editorRowOwnChars(row);
+
+    // Shift the chars to the left to accommodate for the deleted char
+    // by overwriting it with the chars that come after it
+    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+
+    // Decrement row size
+    row->size--;
+
+    // Update the render string to update the new row content
+    editorUpdateRow(row, at, 1, 0);
+
+    // Increment in each row operation that makes a change to the text
+    E.dirty++;
+}
+
+/*** viewer ***/
+
+// Returns the start of a line of a file opened with -R
+// It's found from the line index and the lines after the indexed one, without
+// the row cache, so search workers can call it while the main thread draws
+const char *editorViewLineStart(struct editorView *v, int at) {
+    const char *p = v->map + v->index[at / VIEW_INDEX_STEP];
+    const char *end = v->map + v->len;
+
+    int k;
+    for (k = at % VIEW_INDEX_STEP; k > 0; k--) p = (const char *) memchr(p, '\n', end - p) + 1;
+
+    return p;
+}
+
+// Returns the length of the line of a file opened with -R that starts at *p,
+// without its line break and any carriage returns before it, and moves *p to the next line
+int editorViewLineNext(struct editorView *v, const char **p) {
+    const char *end = v->map + v->len;
+    const char *nl = memchr(*p, '\n', end - *p);
+    const char *eol = nl ? nl : end;
+
+    size_t len = eol - *p;
+    while (len > 0 && (*p)[len - 1] == '\r') len--;
+
+    *p = nl ? nl + 1 : end;
+    return len;
+}
+
+// Finds the slot of the row cache holding a line, -1 if it isn't cached
+int editorViewFind(struct editorView *v, int at) {
+    int i;
+    for (i = v->buckets[at & (VIEW_CACHE_BUCKETS - 1)]; i != -1; i = v->rows[i].hnext) {
+        if (v->rows[i].line == at) return i;
+    }
+
+    return -1;
+}
+
+// Takes a slot of the row cache out of the list of slots in order of use
+void editorViewUnlink(struct editorView *v, int i) {
+    struct viewRow *r = &v->rows[i];
+
+    if (r->prev != -1) v->rows[r->prev].next = r->next;
+    else v->newest = r->next;
+    if (r->next != -1) v->rows[r->next].prev = r->prev;
+    else v->oldest = r->prev;
+}
+
+// Returns whether a line of a file opened with -R up to the one the comment scan got to
+// starts inside a multi-line comment, scanning the lines after the indexed line before it
+int editorViewLineEntry(struct editorView *v, int at) {
+    if (E.syntax == NULL) return 0;
+
+    int j = at - at % VIEW_INDEX_STEP;
+    int in = v->entry[j / VIEW_INDEX_STEP];
+    const char *p = v->map + v->index[j / VIEW_INDEX_STEP];
+
+    for (; j < at; j++) {
+        const char *line = p;
+        int len = editorViewLineNext(v, &p);
+        in = editorSyntaxScanState(line, len, in);
+    }
+
+    return in;
+}
+
+// Gives a cached line of a file opened with -R the state it starts in once the
+// comment scan got to it, until then it's highlighted as if it started in plain code
+// A line drawn right after the one before it takes the state that one was left in
+void editorViewRowEntry(struct editorView *v, struct viewRow *r) {
+    if (r->known || r->line > E.hl_dirty) return;
+
+    int in;
+    int prev = r->line % VIEW_INDEX_STEP != 0 ? editorViewFind(v, r->line - 1) : -1;
+    if (prev != -1 && v->rows[prev].known) {
+        erow *row = &v->rows[prev].row;
+        if (row->hl != NULL && !(row->flags & (ROW_HL_STALE | ROW_LONG))) in = row->hl_open_comment;
+        else in = editorSyntaxScanState(row->chars, row->size, row->hl_entry);
+    } else {
+        in = editorViewLineEntry(v, r->line);
+    }
+
+    r->known = 1;
+    if (in != r->row.hl_entry) {
+        r->row.hl_entry = in;
+        r->row.flags |= ROW_HL_STALE;
+    }
+}
+
+// Returns the erow of a line of a file opened with -R
+// Only the VIEW_CACHE_ROWS lines used last have an erow, a line that
+// isn't cached takes the slot of the one that was used longest ago,
+// whose render and hl go back to the row memory pool
+erow *editorViewRow(struct editorView *v, int at) {
+    int i = editorViewFind(v, at);
+
+    if (i != -1) {
+        // Move the line to the front of the list
+        if (v->newest != i) {
+            editorViewUnlink(v, i);
+            v->rows[i].prev = -1;
+            v->rows[i].next = v->newest;
+            v->rows[v->newest].prev = i;
+            v->newest = i;
+        }
+        editorViewRowEntry(v, &v->rows[i]);
+        return &v->rows[i].row;
+    }
+
+    // A line right after a cached one starts after it, which saves
+    // looking for it from the indexed line when rows are drawn in order
+    const char *p;
+    int prev = at > 0 ? editorViewFind(v, at - 1) : -1;
+    if (prev != -1) {
+        p = v->rows[prev].row.chars;
+        editorViewLineNext(v, &p);
+    } else {
+        p = editorViewLineStart(v, at);
+    }
+
+    if (v->used < VIEW_CACHE_ROWS) {
+        i = v->used++;
+    } else {
+        // Evict the line used longest ago
+        i = v->oldest;
+        editorViewUnlink(v, i);
+
+        int *link = &v->buckets[v->rows[i].line & (VIEW_CACHE_BUCKETS - 1)];
+        while (*link != i) link = &v->rows[*link].hnext;
+        *link = v->rows[i].hnext;
+
+        editorFreeRow(&v->rows[i].row);
+    }
+
+    struct viewRow *r = &v->rows[i];
+
+    // The row points into the mapped file like a row of a file opened for editing
+    memset(&r->row, 0, sizeof(erow));
+    r->row.chars = (char *) p;
+    r->row.size = editorViewLineNext(v, &p);
+    r->row.flags = ROW_MAPPED | ROW_HL_STALE;
+    r->line = at;
+    r->known = 0;
+
+    int h = at & (VIEW_CACHE_BUCKETS - 1);
+    r->hnext = v->buckets[h];
+    v->buckets[h] = i;
+
+    r->prev = -1;
+    r->next = v->newest;
+    if (v->newest != -1) v->rows[v->newest].prev = i;
+    v->newest = i;
+    if (v->oldest == -1) v->oldest = i;
+
+    editorViewRowEntry(v, r);
+    return &r->row;
+}
+
+// Returns the line of a file opened with -R that the byte at the given offset is on
+// The line index is binary searched for the last indexed line starting at or
+// before the offset, then lines are counted from there
+int editorViewLineAt(struct editorView *v, size_t offset) {
+    int lo = 0;
+    int hi = v->nindex - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (v->index[mid] <= offset) lo = mid;
+        else hi = mid - 1;
+    }
+
+    int at = lo * VIEW_INDEX_STEP;
+    const char *p = v->map + v->index[lo];
+    while (at < v->numrows - 1) {
+        const char *next = p;
+        editorViewLineNext(v, &next);
+        if ((size_t) (next - v->map) > offset) break;
+        p = next;
+        at++;
+    }
+
+    return at;
+}
+
+// Counts the lines of a file opened with -R from the given offset on and adds them to the line index
+// The offset is the start of line v->numrows, which is where a file that
+// grew picks up, past the lines that were already indexed
+void editorViewScan(struct editorView *v, size_t from) {
+    const char *p = v->map + from;
+    const char *end = v->map + v->len;
+
+    while (p < end) {
+        if (v->numrows % VIEW_INDEX_STEP == 0 && v->numrows / VIEW_INDEX_STEP == v->nindex) {
+            if (v->nindex == v->indexcap) {
+                v->indexcap *= 2;
+                v->index = realloc(v->index, sizeof(size_t) * v->indexcap);
+                v->entry = realloc(v->entry, v->indexcap);
+                if (v->index == NULL || v->entry == NULL) die("realloc");
+            }
+            v->index[v->nindex++] = p - v->map;
+        }
+        v->numrows++;
+
+        const char *nl = memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+    }
+}
+
+// Moves the comment scan of a file opened with -R back to a line it already got past,
+// as when the filetype or the line changed
+// The cached rows of the line and the ones after it go back to plain code until it gets to them again
+void editorViewRewind(struct editorView *v, int at) {
+    v->scanline = at;
+    v->scanpos = at < v->numrows ? (size_t) (editorViewLineStart(v, at) - v->map) : v->len;
+    v->scanlen = -1;
+    v->scanat = 0;
+    v->scanstate = at < v->numrows && editorViewLineEntry(v, at) ? LEX_MLCOMMENT : LEX_SEP;
+    E.hl_dirty = at;
+
+    for (int i = 0; i < v->used; i++) {
+        if (v->rows[i].line >= at) v->rows[i].known = 0;
+    }
+}
+
+// Scans the lines of a file opened with -R for the state each indexed line starts in,
+// see editorSyntaxPropagate()
+// The scan goes through the file once, from where it got to the last time, and the
+// index keeps the state only every VIEW_INDEX_STEP lines, the lines in between
+// work theirs out from there when they're drawn
+// A long line is scanned HL_PROPAGATE_CHECK_BYTES chars at a time, it's left partway
+// if the time is up and the scan goes on from there the next time
+// Returns 1 if every line before upto was scanned, 0 if the budget ran out first
+int editorViewPropagate(struct editorView *v, int upto, long long budget_us) {
+    if (E.syntax == NULL) {
+        E.hl_dirty = E.numrows;
+        return 1;
+    }
+
+    // The frontier was moved back, as when the filetype changed
+    if (E.hl_dirty != v->scanline) editorViewRewind(v, E.hl_dirty);
+
+    struct editorLexer *lx = E.syntax->lexer;
+    long long deadline = editorMonotonicUs() + budget_us;
+    int rows = 0;
+    long long left = HL_PROPAGATE_CHECK_BYTES;
+
+    while (E.hl_dirty < upto) {
+        // Check the clock every so often rather than for every line
+        if (++rows == HL_PROPAGATE_CHECK_ROWS || left <= 0) {
+            if (editorMonotonicUs() >= deadline) return 0;
+            rows = 0;
+            left = HL_PROPAGATE_CHECK_BYTES;
+        }
+
+        const char *line = v->map + v->scanpos;
+        if (v->scanlen == -1) {
+            const char *next = line;
+            v->scanlen = editorViewLineNext(v, &next);
+        }
+
+        int stop = v->scanlen - v->scanat > left ? v->scanat + (int) left : v->scanlen;
+        int at = v->scanat;
+        editorSyntaxScanSpan(lx, line, v->scanlen, &v->scanat, &v->scanstate, stop);
+        left -= v->scanat - at;
+        if (v->scanat < v->scanlen) continue;
+
+        // On to the next line, which starts in the state this one ended in
+        const char *next = line;
+        editorViewLineNext(v, &next);
+        int in = v->scanstate == LEX_MLCOMMENT;
+        v->scanpos = next - v->map;
+        v->scanlen = -1;
+        v->scanat = 0;
+        v->scanstate = in ? LEX_MLCOMMENT : LEX_SEP;
+        v->scanline++;
+        E.hl_dirty++;
+
+        if (E.hl_dirty % VIEW_INDEX_STEP == 0 && E.hl_dirty / VIEW_INDEX_STEP < v->nindex)
+            v->entry[E.hl_dirty / VIEW_INDEX_STEP] = in;
+    }
+
+    return 1;
+}
+
+// Opens a file as a read-only view of its memory-mapped contents
+// Instead of an erow per line, only the offset of every VIEW_INDEX_STEP-th
+// line is kept, and lines get an erow from the row cache as they're used,
+// so a file of any size takes a bounded amount of memory besides the index
+void editorViewOpen(char *filename) {
+    free(E.filename);
+    E.filename = strdup(filename);
+    if (E.filename == NULL) die("strdup");
+
+    // Set appropriate syntax highlighting for the file type
+    editorSelectSyntaxHighlight();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) die("open");
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) die("fstat");
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        die("-R needs a regular file");
+    }
+
+    struct editorView *v = malloc(sizeof(struct editorView));
+    if (v == NULL) die("malloc");
+
+    // An empty file can't be mapped, it has no lines to show anyway
+    v->map = NULL;
+    v->len = st.st_size;
+    if (v->len > 0) {
+        v->map = mmap(NULL, v->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (v->map == MAP_FAILED) die("mmap");
+    }
+    close(fd);
+
+    // Build the line index by scanning for newlines
+    v->indexcap = 64;
+    v->index = malloc(sizeof(size_t) * v->indexcap);
+    v->entry = malloc(v->indexcap);
+    if (v->index == NULL || v->entry == NULL) die("malloc");
+    v->nindex = 0;
+    v->numrows = 0;
+    editorViewScan(v, 0);
+    if (v->nindex == 0) v->index[v->nindex++] = 0;
+    int lines = v->numrows;
+
+    // The row cache starts out empty
+    v->rows = malloc(sizeof(struct viewRow) * VIEW_CACHE_ROWS);
+    if (v->rows == NULL) die("malloc");
+    v->used = 0;
+    v->newest = -1;
+    v->oldest = -1;
+    memset(v->buckets, -1, sizeof(v->buckets));
+
+    E.view = v;
+    E.numrows = lines;
+
+    // The comment state is scanned from the start while idle, the first line starts in plain code
+    v->entry[0] = 0;
+    editorViewRewind(v, 0);
+    E.hl_dirty_end = 0;
+    E.dirty = 0;
+}
+
+// Unmaps a file opened with -R and frees its index and row cache
+void editorViewFree(struct editorView *v) {
+    int i;
+    for (i = 0; i < v->used; i++) editorFreeRow(&v->rows[i].row);
+    free(v->rows);
+    free(v->index);
+    free(v->entry);
+    if (v->map != NULL) munmap(v->map, v->len);
+    free(v);
+}
+
+/*** editor operations ***/
+
+// Refuses to edit a file opened with -R, which is only viewed
+// Returns 1 if the buffer can't be edited
+int editorReadOnly() {
+    if (E.view == NULL) return 0;
+
+    editorSetStatusMessage("Read-only, the file was opened with -R");
+    return 1;
+}
+
+// Insert a character in the position that the cursor is at
+void editorInsertChar(int c) {
+    if (editorReadOnly()) return;
+    editorStoreUnshare();
+
+    // Record the char, along with the line break of the row
+    // it creates when typed on the tilde line
+    char text[2] = { c, '\n' };
+    editorUndoRecord(UNDO_INSERT, E.cy, E.cx, text, E.cy == E.numrows ? 2 : 1, 1);
+
+    // If the cursor is on the tilde line after the end of the file,
     // then we append a new row to the file before inserting a char
     if (E.cy == E.numrows) {
         editorInsertRow(E.numrows, "", 0);
     }
 
-    // Insert char at the cursor's position
-    editorRowInsertChar(&E.row[E.cy], E.cx, c);
+    // Insert char at the cursor's position
+    editorRowInsertChar(editorRowAt(E.cy), E.cx, c);
+
+    // After inserting, move the cursor forward to allow
+    // the next char the user inserts to go after the inserted char
+    E.cx++;
+}
+
+// Inserts a new line
+void editorInsertNewline() {
+    if (editorReadOnly()) return;
+    editorStoreUnshare();
+
+    editorUndoRecord(UNDO_INSERT, E.cy, E.cx, "\n", 1, 0);
+
+    // If the cursor is at the start of a line,
+    // then insert a blank row before the line the cursor is on
+    // Otherwise, split the line the cursor is on into two rows
+    // A split near the start of a row moves the chars left of the cursor
+    // to a new row before it, so the long side of the row stays where it is
+    if (E.cx == 0) {
+        editorInsertRow(E.cy, "", 0);
+    } else if (E.cx < editorRowAt(E.cy)->size - E.cx) {
+        editorInsertRow(E.cy, editorRowAt(E.cy)->chars, E.cx);
+        editorRowDelChars(editorRowAt(E.cy + 1), 0, E.cx);
+    } else {
+        // Get the current row
+        erow *row = editorRowAt(E.cy);
+
+        // Insert the row's chars right of the cursor to 
+        // create a new row after the current row
+        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+
+        // Reassign pointer since realloc() might move 
+        // around and invalidate the pointer
+        row = editorRowAt(E.cy);
+
+        // Copy the chars out of the mapped file before truncating them
+        editorRowOwnChars(row);
+
+        // Truncate the size of the current row by setting
+        // size to the position of the cursor
+        int removed = row->size - E.cx;
+        row->size = E.cx;
+
+        // Append null byte at the end of the current row 
+        // since it was truncated
+        row->chars[row->size] = '\0';
+
+        // Update the render string to update the current row content
+        editorUpdateRow(row, E.cx, removed, 0);
+    }
+
+    // Move the cursor to the beginning of the row
+    E.cy++;
+    E.cx = 0;
+}
+
+// Returns the length of the first line of a string, and
+// the length of the line ending after it in eollen
+// '\n', '\r' and "\r\n" each end a line, since terminals paste newlines as '\r'
+size_t editorLineLength(const char *s, size_t len, size_t *eollen) {
+    size_t j = 0;
+    while (j < len && s[j] != '\n' && s[j] != '\r') j++;
+
+    if (j == len) *eollen = 0;
+    else if (s[j] == '\r' && j + 1 < len && s[j + 1] == '\n') *eollen = 2;
+    else *eollen = 1;
+
+    return j;
+}
+
+// Inserts text at the cursor position without recording it for undo
+// The lines of the text are separated by '\n', as editorInsertText() leaves them
+// The lines after the first become new rows in one step through editorInsertRows(),
+// rather than going through editorInsertChar() and editorInsertNewline() per key
+void editorPutText(const char *s, size_t len) {
+    if (len == 0) return;
+
+    // If the cursor is on the tilde line after the end of the file,
+    // then we append a new row to the file before inserting
+    if (E.cy == E.numrows) {
+        editorInsertRow(E.numrows, "", 0);
+    }
+
+    const char *nl = memchr(s, '\n', len);
+
+    // Text without a line break goes into the current row
+    if (nl == NULL) {
+        editorRowInsertString(editorRowAt(E.cy), E.cx, s, len);
+        E.cx += len;
+        return;
+    }
+
+    erow *row = editorRowAt(E.cy);
+    size_t taillen = row->size - E.cx;
+
+    // With fewer chars before the cursor than after it, the last line of the text
+    // takes the place of the chars before the cursor and the other lines become
+    // rows before it, so the long side of the row stays where it is
+    if ((size_t) E.cx < taillen) {
+        size_t lastnl = len - 1;
+        while (s[lastnl] != '\n') lastnl--;
+        size_t lastlen = len - lastnl - 1;
+
+        int headlen = E.cx;
+        char *head = malloc(headlen + 1);
+        if (head == NULL) die("malloc");
+        memcpy(head, row->chars, headlen);
+
+        editorRowDelChars(row, 0, headlen);
+        if (lastlen > 0) editorRowInsertString(row, 0, &s[lastnl + 1], lastlen);
+
+        // The chars that were before the cursor start the first of the new rows
+        int n = editorInsertRows(E.cy, s, lastnl, 0);
+        if (headlen > 0) editorRowInsertString(editorRowAt(E.cy), 0, head, headlen);
+        free(head);
+
+        E.dirty++;
+        E.cy += n;
+        E.cx = lastlen;
+        return;
+    }
+
+    // Split the current row at the cursor, the chars after
+    // the cursor end up after the last line of the text
+    char *tail = malloc(taillen + 1);
+    if (tail == NULL) die("malloc");
+    memcpy(tail, &row->chars[E.cx], taillen);
+
+    // The first line of the text replaces them in the current row, as a single
+    // edit so the row's indexes know the chars after the cursor went away
+    size_t linelen = nl - s;
+    editorRowOwnChars(row);
+    row->chars = editorPoolGrow(row->chars, &row->charsclass, E.cx, E.cx + linelen + 1);
+    memcpy(&row->chars[E.cx], s, linelen);
+    row->size = E.cx + linelen;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row, E.cx, taillen, linelen);
+    s += linelen + 1;
+    len -= linelen + 1;
+
+    // Every other line becomes a new row, all inserted at once,
+    // and the cursor ends up at the end of the last line of the text
+    int n = editorInsertRows(E.cy + 1, s, len, 0);
+    E.dirty++;
+    E.cy += n;
+    E.cx = editorRowAt(E.cy)->size;
+
+    // Put the rest of the split row back after the cursor
+    editorRowAppendString(editorRowAt(E.cy), tail, taillen);
+    free(tail);
+}
+
+// Inserts text at the cursor position, as when it's pasted
+// The text is recorded for undo as a single entry with its line breaks
+// turned into '\n', so undoing it takes it out again in one step
+void editorInsertText(const char *s, size_t len) {
+    if (len == 0 || editorReadOnly()) return;
+
+    editorStoreUnshare();
+
+    // Room for the text and the line break of the row
+    // it creates when inserted on the tilde line
+    char *text = malloc(len + 1);
+    if (text == NULL) die("malloc");
+
+    size_t n = 0;
+    size_t j = 0;
+    while (j < len) {
+        size_t eollen;
+        size_t linelen = editorLineLength(&s[j], len - j, &eollen);
+        memcpy(&text[n], &s[j], linelen);
+        n += linelen;
+        j += linelen;
+        if (eollen) text[n++] = '\n';
+        j += eollen;
+    }
+
+    text[n] = '\n';
+    editorUndoRecord(UNDO_INSERT, E.cy, E.cx, text, E.cy == E.numrows ? n + 1 : n, 0);
+    editorPutText(text, n);
+    free(text);
+}
+
+// Deletes text starting at a position without recording it for undo
+// len counts the line break at the end of each row as one char, the
+// rows in between are deleted and the ends are joined into one row
+// The cursor ends up where the text was
+void editorDeleteText(int y, int x, size_t len) {
+    // Find the row and the position in it where the deleted text ends
+    int ey = y;
+    size_t ex = x + len;
+    while (ey < E.numrows && ex > (size_t) editorRowAt(ey)->size) {
+        ex -= editorRowAt(ey)->size + 1;
+        ey++;
+    }
+
+    if (ey == y) {
+        // The text is all on one row
+        editorRowDelChars(editorRowAt(y), x, len);
+    } else if (ey == E.numrows) {
+        // The text runs to the end of the file, the rows it
+        // covers go and the first one is cut at the start of the text
+        if (x > 0) {
+            erow *row = editorRowAt(y);
+            editorRowDelChars(row, x, row->size - x);
+            y++;
+        }
+        editorDelRows(y, E.numrows - y);
+        E.dirty++;
+    } else {
+        // Join what's left of the first and the last row,
+        // and delete the rows in between, all at once
+        editorRowJoin(y, x, ey, ex);
+        E.dirty++;
+    }
+
+    E.cy = y;
+    E.cx = x;
+}
+
+// Deletes the character left of the cursor
+void editorDelChar() {
+    // If cursor is at the end of the file, there's nothing
+    // to delete, so exit the function
+    if (E.cy == E.numrows) return;
+
+    // If cursor is at the beginning of the first line,
+    // there's nothing to do, so exit the function
+    if (E.cx == 0 && E.cy == 0) return;
+
+    if (editorReadOnly()) return;
+    editorStoreUnshare();
+
+    // Get the row where the cursor is on
+    erow *row = editorRowAt(E.cy);
+
+    // If there's a char left of the cursor,
+    // proceed to delete it and move the cursor one to the left
+    // Otherwise if the cursor is at the beginning of ar row, 
+    // set the cursor to the end of the preceding line, append the current 
+    // line to the end of the preceding line, and delete the current line
+    // A UTF-8 char is deleted whole, along with the combining marks over it
+    if (E.cx > 0) {
+        int at = editorCharStart(row->chars, row->size, E.cx - 1);
+        editorUndoRecord(UNDO_DELETE, E.cy, at, &row->chars[at], E.cx - at, 1);
+        editorRowDelChars(row, at, E.cx - at);
+        E.cx = at;
+    } else {
+        editorUndoRecord(UNDO_DELETE, E.cy - 1, editorRowAt(E.cy - 1)->size, "\n", 1, 1);
+        E.cx = editorRowAt(E.cy - 1)->size;
+        editorRowJoin(E.cy - 1, E.cx, E.cy, 0);
+        E.cy--;
+    }
+}
+
+/*** undo ***/
+
+// Rounds an arena allocation up so the entry after it stays aligned
+size_t editorUndoRound(size_t n) {
+    return (n + UNDO_ALIGN - 1) & ~(size_t) (UNDO_ALIGN - 1);
+}
+
+// Returns the text an undo entry inserted or deleted, stored right after it
+char *editorUndoText(struct undoEntry *e) {
+    return (char *) e + editorUndoRound(sizeof(struct undoEntry));
+}
+
+// Number of arena bytes an entry with len bytes of text takes up
+size_t editorUndoEntrySize(size_t len) {
+    return editorUndoRound(sizeof(struct undoEntry)) + editorUndoRound(len);
+}
+
+// Frees a block of the arena
+void editorUndoFreeBlock(struct undoBlock *b) {
+    E.undo.bytes -= b->size;
+    free(b);
+}
+
+// Forgets the whole history
+void editorUndoClear() {
+    struct editorUndo *u = &E.undo;
+
+    while (u->first != NULL) {
+        struct undoBlock *next = u->first->next;
+        editorUndoFreeBlock(u->first);
+        u->first = next;
+    }
+
+    u->last = NULL;
+    u->oldest = NULL;
+    u->newest = NULL;
+    u->current = NULL;
+    u->sealed = 1;
+}
+
+// Forgets the edits that were undone and could still be redone
+// They're always the newest entries, so the arena is cut back to
+// where the first of them starts
+void editorUndoDropRedo() {
+    struct editorUndo *u = &E.undo;
+
+    if (u->current == u->newest) return;
+    if (u->current == NULL) {
+        editorUndoClear();
+        return;
+    }
+
+    struct undoEntry *first = u->current->next;
+    struct undoBlock *b = first->block;
+    b->used = (char *) first - (char *) b;
+
+    // Free the blocks after the one the first dropped entry is in
+    while (b->next != NULL) {
+        struct undoBlock *next = b->next->next;
+        editorUndoFreeBlock(b->next);
+        b->next = next;
+    }
+    u->last = b;
+
+    u->current->next = NULL;
+    u->newest = u->current;
+}
+
+// Drops the oldest blocks of the arena, with the edits in them,
+// until the history fits in UNDO_MAX_BYTES again
+// The newest block always stays, it has the entry being added
+void editorUndoTrim() {
+    struct editorUndo *u = &E.undo;
+
+    while (u->bytes > UNDO_MAX_BYTES && u->first != u->last) {
+        struct undoBlock *b = u->first;
+
+        while (u->oldest != NULL && u->oldest->block == b) u->oldest = u->oldest->next;
+        if (u->oldest != NULL) u->oldest->prev = NULL;
+
+        u->first = b->next;
+        editorUndoFreeBlock(b);
+    }
+}
+
+// Bump allocates a new entry with room for len bytes of text at the end of the log
+// Returns null if the text is too big for the history to hold at all
+struct undoEntry *editorUndoAlloc(size_t len) {
+    struct editorUndo *u = &E.undo;
+    size_t need = editorUndoEntrySize(len);
+    size_t header = editorUndoRound(sizeof(struct undoBlock));
+
+    if (header + need > UNDO_MAX_BYTES) return NULL;
+
+    // Start a new block if the entry doesn't fit in the last one
+    // An entry bigger than a block gets a block of its own
+    struct undoBlock *b = u->last;
+    if (b == NULL || b->used + need > b->size) {
+        size_t size = header + need > UNDO_BLOCK_SIZE ? header + need : UNDO_BLOCK_SIZE;
+        b = malloc(size);
+        if (b == NULL) die("malloc");
+        b->next = NULL;
+        b->size = size;
+        b->used = header;
+
+        if (u->last) u->last->next = b;
+        else u->first = b;
+        u->last = b;
+        u->bytes += size;
+    }
+
+    struct undoEntry *e = (struct undoEntry *) ((char *) b + b->used);
+    b->used += need;
+    e->block = b;
+    e->len = len;
+
+    // Link the entry after the newest one
+    e->prev = u->newest;
+    e->next = NULL;
+    if (u->newest) u->newest->next = e;
+    else u->oldest = e;
+    u->newest = e;
+    u->current = e;
+
+    editorUndoTrim();
+
+    return e;
+}
+
+// Appends a char to the text of the newest entry if it's the last thing in its block
+// and the block has room for it
+// Returns 0 if the entry can't grow
+int editorUndoExtend(struct undoEntry *e, char c) {
+    struct undoBlock *b = e->block;
+    char *end = (char *) e + editorUndoEntrySize(e->len);
+
+    if (end != (char *) b + b->used) return 0;
+
+    size_t grow = editorUndoEntrySize(e->len + 1) - editorUndoEntrySize(e->len);
+    if (b->used + grow > b->size) return 0;
+
+    b->used += grow;
+    editorUndoText(e)[e->len++] = c;
+    return 1;
+}
+
+// Records an edit in the undo log before it's made
+// Positions count line breaks as '\n' chars at the end of each row, and
+// text inserted or deleted at the tilde line after the last row ends with one
+// Typed chars of a run that directly follow each other are merged into one
+// entry, and a run of typed or deleted chars is undone as a whole
+// Anything that isn't part of a run is a group of its own
+void editorUndoRecord(int type, int y, int x, const char *text, size_t len, int run) {
+    struct editorUndo *u = &E.undo;
+
+    // A new edit makes the undone ones impossible to redo
+    editorUndoDropRedo();
+
+    struct undoEntry *last = u->newest;
+    int join = run && !u->sealed && last != NULL && last->type == type;
+
+    // Merge a typed char into the entry of the chars typed right before it
+    if (join && type == UNDO_INSERT && len == 1 && text[0] != '\n' &&
+        last->y == y && last->x + (int) last->len == x &&
+        editorUndoExtend(last, text[0])) {
+        return;
+    }
+
+    if (!join) u->group++;
+
+    struct undoEntry *e = editorUndoAlloc(len);
+
+    // An edit too big to keep leaves nothing before it worth undoing
+    if (e == NULL) {
+        editorUndoClear();
+        return;
+    }
+
+    e->type = type;
+    e->y = y;
+    e->x = x;
+    e->cy = E.cy;
+    e->cx = E.cx;
+    e->group = u->group;
+    memcpy(editorUndoText(e), text, len);
+
+    u->sealed = !run;
+}
+
+// Ends the run of typed or deleted chars, so the next edit starts a new group
+void editorUndoSeal() {
+    E.undo.sealed = 1;
+}
+
+// Inserts text at a position, the way an undo entry recorded it
+void editorUndoInsertAt(int y, int x, const char *text, size_t len) {
+    E.cy = y;
+    E.cx = x;
+
+    // Text inserted at the tilde line ends with the line break that
+    // made it a row of its own
+    if (y == E.numrows) {
+        editorInsertRow(E.numrows, "", 0);
+        len--;
+    }
+
+    editorPutText(text, len);
+}
+
+// Undoes the edits of the newest group that wasn't undone yet
+// A paste is a single entry, so it's taken back in one step however many rows it has
+void editorUndo() {
+    struct editorUndo *u = &E.undo;
+
+    editorUndoSeal();
+
+    if (u->current == NULL) {
+        editorSetStatusMessage("Nothing to undo");
+        return;
+    }
+
+    editorStoreUnshare();
+
+    unsigned int group = u->current->group;
+    while (u->current != NULL && u->current->group == group) {
+        struct undoEntry *e = u->current;
+
+        if (e->type == UNDO_INSERT) editorDeleteText(e->y, e->x, e->len);
+        else editorUndoInsertAt(e->y, e->x, editorUndoText(e), e->len);
+
+        // Put the cursor back where it was before the edit
+        E.cy = e->cy;
+        E.cx = e->cx;
+
+        u->current = e->prev;
+    }
+}
+
+// Makes the edits of the oldest undone group again
+void editorRedo() {
+    struct editorUndo *u = &E.undo;
+
+    editorUndoSeal();
+
+    struct undoEntry *e = u->current ? u->current->next : u->oldest;
+    if (e == NULL) {
+        editorSetStatusMessage("Nothing to redo");
+        return;
+    }
+
+    editorStoreUnshare();
+
+    unsigned int group = e->group;
+    while (e != NULL && e->group == group) {
+        // The cursor ends up after inserted text and where deleted text was
+        if (e->type == UNDO_INSERT) editorUndoInsertAt(e->y, e->x, editorUndoText(e), e->len);
+        else editorDeleteText(e->y, e->x, e->len);
+
+        u->current = e;
+        e = e->next;
+    }
+}
+
+/*** file i/o ***/
+
+// Writes the iovec array to a file descriptor, retrying until everything is written
+// writev() may write less than asked for, so the array is advanced past
+// whatever made it out and the rest is written again
+// Returns 0 on success and -1 on error with errno set
+int editorWriteAll(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        // Skip the entries that were written completely
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        // Move the start of a partly written entry past the written bytes
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+// Writes every row followed by a newline to a file descriptor
+// Rows are handed to writev() straight from where they live, a batch of
+// SAVE_IOV_BATCH entries at a time, so saving a big file doesn't need
+// a second copy of it in memory
+// Returns the number of bytes written, or -1 on error with errno set
+long long editorWriteRows(int fd, struct editorBuffer *b) {
+    static char newline = '\n';
+    struct iovec iov[SAVE_IOV_BATCH];
+    long long total = 0;
+    int j = 0;
+
+    while (j < b->numrows) {
+        int n = 0;
+
+        // Fill the batch with row contents and the newlines between them
+        while (j < b->numrows && n + 2 <= SAVE_IOV_BATCH) {
+            erow *row = editorBufferRowAt(b, j);
+            if (row->size > 0) {
+                iov[n].iov_base = row->chars;
+                iov[n].iov_len = row->size;
+                n++;
+            }
+            iov[n].iov_base = &newline;
+            iov[n].iov_len = 1;
+            n++;
+
+            total += (long long) row->size + 1;
+            j++;
+        }
+
+        if (editorWriteAll(fd, iov, n) == -1) return -1;
+    }
+
+    return total;
+}
+
+// Loads a regular file by memory-mapping it
+// Rows point straight into the mapping and are only rendered and highlighted
+// once they're drawn or edited, so opening a huge file costs one pass
+// over it to find the newlines and one erow per line
+// Returns -1 without loading anything if the file can't be mapped
+int editorOpenMapped(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    // Only map big regular files, pipes and smaller files are read with getline() instead
+    // A private mapping still shows what other programs write to the file, so files that
+    // are read in a moment are copied and can't change under the buffer at all
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < MAP_MIN_SIZE) {
+        close(fd);
+        return -1;
+    }
+
+    // Map the file read-only
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    // The rows' storage keeps the mapping alive, along with any copies of it made for other buffers
+    E.store->map = malloc(sizeof(struct editorMap));
+    if (E.store->map == NULL) die("malloc");
+    E.store->map->addr = map;
+    E.store->map->len = st.st_size;
+    E.store->map->refs = 1;
+    E.store->map->fd = fd;
+    E.store->map->mtime = st.st_mtim;
+    E.store->size = st.st_size;
+
+    // Build the row index by scanning for newlines
+    // memchr() is vectorized in glibc and picks the version for the
+    // CPU at runtime, so this scans many bytes per step
+    char *p = map;
+    char *end = map + st.st_size;
+    while (p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        char *eol = nl ? nl : end;
+
+        // Strip off the newline and any carriage returns before it
+        size_t linelen = eol - p;
+        while (linelen > 0 && p[linelen - 1] == '\r') linelen--;
+
+        // Append line to erow struct array without copying it
+        editorAppendMappedRow(p, linelen);
+
+        p = eol + 1;
+    }
+
+    return 0;
+}
+
+// Opens and reads a files from disk
+void editorOpen(char *filename) {
+    // Free used memory to update the filename
+    free(E.filename);
+
+    // Duplicate the filename and store it as a global state
+    E.filename = strdup(filename);
+
+    // Remember which file the rows come from, so another buffer opening it can share them
+    free(E.store->path);
+    E.store->path = realpath(filename, NULL);
+
+    // Set appropriate syntax highlighting for the file type
+    editorSelectSyntaxHighlight();
+
+    // Regular files are memory-mapped instead of read line by line
+    if (editorOpenMapped(filename) == 0) {
+        // File is unchanged when opened
+        E.dirty = 0;
+        return;
+    }
+
+    // Opens the file that the user passed as the arg for reading
+    FILE *fp = fopen(filename, "r");
+
+    // If fopen failed to open the file, error out
+    if (!fp) die("fopen");
+    
+    // Pointer that points to the buffer where the read message will be stored
+    char *line = NULL;
+
+    // Size of the buffer pointed to by the message pointer
+    size_t linecap = 0;
+
+    // Length of the message
+    ssize_t linelen;
+
+    // Read lines from the file and store to the allocated buffer
+    // Updates pointer and allocates necessary memory
+    // Check if the returned value is not the end of the file 
+    // -1 indicates there are no more lines to read
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        // Count the bytes read, a followed file is read on from there
+        E.store->size += linelen;
+
+        // Strip off newline or carriage return at the end of the line 
+        // before copying it to the erow since each erow represents one line of text
+        // there's no reason to store a newline character at the end of each one
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+            linelen--;
+
+        // Append line to erow struct array
+        editorInsertRow(E.numrows, line, linelen);
+    }
+
+    // Free the memory used by the buffer 
+    free(line);
+
+    // Close the file since we're done reading
+    fclose(fp);
+
+    // File is unchanged when opened
+    E.dirty = 0;
+}
+
+// Writes the rows of a buffer to a file
+// The rows are written to a temporary file next to the target, which is
+// flushed and then renamed over it, so a failed or interrupted save never
+// leaves a half-written file behind
+// Note: rows still pointing into the memory-mapped original stay valid,
+// because the old file lives on until it's unmapped
+// The file gets the permissions of modefile, which is the file itself unless it's a backup,
+// or if there's no modefile those of a new file created under the given umask
+// Runs on the save thread, so it only reads the chars and sizes of the rows
+// Returns the number of bytes written, or -1 on error with errno set
+long long editorSaveFile(const char *filename, const char *modefile, mode_t mask, struct editorBuffer *b) {
+    // Write to the file a symlink points to rather than replacing the link
+    // A file that doesn't exist yet is created under its own name
+    char *target = realpath(filename, NULL);
+    if (target == NULL) target = strdup(filename);
+    if (target == NULL) return -1;
+
+    // Build the temporary file name in the same directory as the target,
+    // since rename() can't move a file across filesystems
+    size_t tmplen = strlen(target) + sizeof(".XXXXXX");
+    char *tmp = malloc(tmplen);
+    if (tmp == NULL) {
+        free(target);
+        return -1;
+    }
+    snprintf(tmp, tmplen, "%s.XXXXXX", target);
+
+    // Keep the permissions of the file being replaced, a backup gets those of the file it's of
+    // A new file gets 0644 less the umask, like open() with O_CREAT would give it
+    struct stat st;
+    mode_t mode;
+    if (stat(modefile, &st) == 0) {
+        mode = st.st_mode & 07777;
+    } else {
+        mode = 0644 & ~mask;
+    }
+
+    long long len = -1;
+    int fd = mkstemp(tmp);
+
+    if (fd != -1) {
+        // Write the rows, set the permissions and make sure
+        // the contents reached the disk before the rename
+        if (fchmod(fd, mode) == -1 ||
+            (len = editorWriteRows(fd, b)) == -1 ||
+            fsync(fd) == -1) {
+            len = -1;
+        }
+
+        // Closing can report write errors too
+        if (close(fd) == -1) len = -1;
+
+        // Replace the target with the fully written temporary file
+        if (len != -1 && rename(tmp, target) == -1) len = -1;
+
+        if (len == -1) {
+            // Remove the temporary file, keeping the error that made the save fail
+            int saved_errno = errno;
+            unlink(tmp);
+            errno = saved_errno;
+        } else {
+            // Flush the directory as well so the rename itself survives a crash
+            char *slash = strrchr(target, '/');
+            if (slash != NULL) *slash = '\0';
+            int dirfd = open(slash != NULL ? (slash == target ? "/" : target) : ".", O_RDONLY);
+            if (dirfd != -1) {
+                fsync(dirfd);
+                close(dirfd);
+            }
+        }
+    }
+
+    // Keep the error across the frees
+    int saved_errno = errno;
+    free(tmp);
+    free(target);
+    errno = saved_errno;
+
+    return len;
+}
+
+/*** buffers ***/
+
+// Creates the storage for the rows of a buffer, used by that buffer alone
+struct editorStore *editorStoreNew() {
+    struct editorStore *store = malloc(sizeof(struct editorStore));
+    if (store == NULL) die("malloc");
+
+    store->refs = 1;
+    store->path = NULL;
+    store->map = NULL;
+    store->size = 0;
+
+    return store;
+}
+
+// Drops a reference to a file mapping, unmapping the file once no rows point into it
+void editorMapRelease(struct editorMap *map) {
+    if (map == NULL || --map->refs > 0) return;
+
+    munmap(map->addr, map->len);
+    close(map->fd);
+    free(map);
+}
+
+// Copies the rows of the buffer being edited out of its mapped file once another
+// program changed the file's size or contents
+// Reading the pages past a truncated file's new end faults with SIGBUS, even in a
+// redraw, and the rest of a private mapping shows what the file holds now. So the
+// rows that still point into the file get a copy of what's left of them, rows
+// past its new end are emptied, and the buffer counts as modified, since lines
+// that weren't edited may no longer be what was opened
+// The rows can't change while the search prompt is open, so it's checked after that
+// Returns 1 if the file changed
+int editorMapChanged() {
+    struct editorMap *map = E.store->map;
+    if (map == NULL || E.search.active) return 0;
+
+    struct stat st;
+    if (fstat(map->fd, &st) == -1 || ((size_t) st.st_size == map->len &&
+        st.st_mtim.tv_sec == map->mtime.tv_sec && st.st_mtim.tv_nsec == map->mtime.tv_nsec))
+        return 0;
+
+    // Other buffers sharing the rows keep the mapping until they're looked at
+    editorStoreUnshare();
+    map = E.store->map;
+
+    const char *end = map->addr + ((size_t) st.st_size < map->len ? (size_t) st.st_size : map->len);
+    for (int j = 0; j < E.numrows; j++) {
+        erow *row = editorRowAt(j);
+        if (!(row->flags & ROW_MAPPED)) continue;
+
+        if (row->chars >= end) row->size = 0;
+        else if (row->chars + row->size > end) row->size = end - row->chars;
+        editorRowOwnChars(row);
+
+        // The row is rendered and highlighted again from the copy when it's drawn
+        if (!(row->flags & ROW_RENDER_ALIAS)) editorPoolFree(row->render, row->renderclass);
+        editorPoolFree(row->hl, row->hlclass);
+        editorRowDropGlyphs(row);
+        editorRowDropColIndex(row);
+        free(row->states);
+        row->render = NULL;
+        row->renderclass = 0;
+        row->rsize = 0;
+        row->hl = NULL;
+        row->hlclass = 0;
+        row->states = NULL;
+        row->flags = (row->flags & ~(ROW_RENDER_ALIAS | ROW_HL_RAW | ROW_LONG)) | ROW_HL_STALE;
+    }
+
+    editorMapRelease(map);
+    E.store->map = NULL;
+
+    // The cursor's row may have been cut short
+    if (E.cy < E.numrows && E.cx > editorRowAt(E.cy)->size) E.cx = editorRowAt(E.cy)->size;
+
+    E.hl_dirty = 0;
+    E.hl_dirty_end = E.numrows;
+    E.dirty++;
+    editorSetStatusMessage("%s was changed by another program, lines you didn't edit may differ", E.filename);
+    return 1;
+}
+
+// Gives the buffer in E rows of its own before they're edited
+// Rows shared with other buffers are copied into a new array, so those
+// buffers keep seeing the file as it was opened
+// Rows still pointing into the mapped file keep doing that, and the
+// render, hl and column index are rebuilt when the copy is drawn
+void editorStoreUnshare() {
+    struct editorStore *old = E.store;
+    if (old->refs == 1) return;
+
+    // The copy has the rows one after another with the gap at the end
+    int cap = E.numrows + 16;
+    erow *rows = malloc(sizeof(erow) * cap);
+    if (rows == NULL) die("malloc");
+
+    int j;
+    for (j = 0; j < E.numrows; j++) {
+        erow *row = &rows[j];
+        *row = *editorRowAt(j);
+
+        // Edited rows own their chars, so the copy gets its own too
+        if (!(row->flags & ROW_MAPPED)) {
+            char *chars = editorPoolAlloc(row->size + 1, &row->charsclass);
+            memcpy(chars, row->chars, row->size + 1);
+            row->chars = chars;
+        }
+
+        // The comment state carries over, the rest is filled in again as the row is drawn
+        row->rsize = 0;
+        row->render = NULL;
+        row->hl = NULL;
+        row->cols = NULL;
+        row->states = NULL;
+        row->glyphs = NULL;
+        row->renderclass = 0;
+        row->hlclass = 0;
+        row->glyphclass = 0;
+        row->flags = (row->flags & ~(ROW_RENDER_ALIAS | ROW_HL_RAW)) | ROW_HL_STALE;
+    }
+
+    E.row = rows;
+    E.rowcap = cap;
+    E.gap = E.numrows;
+    E.gaplen = cap - E.numrows;
+
+    // The new storage came from the same file and needs its mapping as long as the old one
+    struct editorStore *store = editorStoreNew();
+    if (old->path != NULL && (store->path = strdup(old->path)) == NULL) die("strdup");
+    store->map = old->map;
+    if (store->map != NULL) store->map->refs++;
+    store->size = old->size;
+
+    old->refs--;
+    E.store = store;
+}
+
+// Lets go of the rows of a parked buffer or a snapshot, freeing them
+// if no other buffer or snapshot shares them
+void editorStoreRelease(struct editorBuffer *b) {
+    struct editorStore *store = b->store;
+    if (--store->refs > 0) return;
+
+    if (b->view != NULL) {
+        editorViewFree(b->view);
+    } else {
+        int j;
+        for (j = 0; j < b->numrows; j++) editorFreeRow(editorBufferRowAt(b, j));
+        free(b->row);
+    }
+
+    editorMapRelease(store->map);
+    free(store->path);
+    free(store);
+}
+
+// Resets the state of the buffer in E to an empty buffer with no file
+void editorBufferInit() {
+    E.id = ++E.lastid;
+    E.cx = 0;
+    E.cy = 0;
+    E.rx = 0;
+    E.rowoff = 0;
+    E.coloff = 0;
+    E.numrows = 0;
+    E.row = NULL;
+    E.rowcap = 0;
+    E.gap = 0;
+    E.gaplen = 0;
+    E.hl_dirty = 0;
+    E.hl_dirty_end = 0;
+    E.store = editorStoreNew();
+    E.view = NULL;
+    E.follow = NULL;
+    E.dirty = 0;
+    E.autosaved = 0;
+    E.autosave_time = editorMonotonicUs();
+    E.filename = NULL; // Will stay null if no file is opened
+    E.syntax = NULL;
+
+    // Nothing to undo yet
+    E.undo.first = NULL;
+    E.undo.last = NULL;
+    E.undo.bytes = 0;
+    E.undo.oldest = NULL;
+    E.undo.newest = NULL;
+    E.undo.current = NULL;
+    E.undo.group = 0;
+    E.undo.sealed = 1;
+}
+
+// Copies the state of the buffer in E to a parked buffer
+void editorBufferPark(struct editorBuffer *b) {
+    b->id = E.id;
+    b->cx = E.cx;
+    b->cy = E.cy;
+    b->rx = E.rx;
+    b->rowoff = E.rowoff;
+    b->coloff = E.coloff;
+    b->numrows = E.numrows;
+    b->row = E.row;
+    b->rowcap = E.rowcap;
+    b->gap = E.gap;
+    b->gaplen = E.gaplen;
+    b->hl_dirty = E.hl_dirty;
+    b->hl_dirty_end = E.hl_dirty_end;
+    b->store = E.store;
+    b->view = E.view;
+    b->follow = E.follow;
+    b->filename = E.filename;
+    b->dirty = E.dirty;
+    b->autosaved = E.autosaved;
+    b->autosave_time = E.autosave_time;
+    b->syntax = E.syntax;
+    b->undo = E.undo;
+}
+
+// Makes a parked buffer the one in E
+void editorBufferRestore(struct editorBuffer *b) {
+    E.id = b->id;
+    E.cx = b->cx;
+    E.cy = b->cy;
+    E.rx = b->rx;
+    E.rowoff = b->rowoff;
+    E.coloff = b->coloff;
+    E.numrows = b->numrows;
+    E.row = b->row;
+    E.rowcap = b->rowcap;
+    E.gap = b->gap;
+    E.gaplen = b->gaplen;
+    E.hl_dirty = b->hl_dirty;
+    E.hl_dirty_end = b->hl_dirty_end;
+    E.store = b->store;
+    E.view = b->view;
+    E.follow = b->follow;
+    E.filename = b->filename;
+    E.dirty = b->dirty;
+    E.autosaved = b->autosaved;
+    E.autosave_time = b->autosave_time;
+    E.syntax = b->syntax;
+    E.undo = b->undo;
+}
+
+// Makes the buffer at the given index the one being edited
+// Only the small per-buffer state is swapped, the rows stay where they are
+void editorBufferSwitch(int at) {
+    if (at == E.curbuffer) return;
+
+    editorUndoSeal();
+    editorBufferPark(&E.buffers[E.curbuffer]);
+    editorBufferRestore(&E.buffers[at]);
+    E.curbuffer = at;
+
+    editorSetStatusMessage("Buffer %d of %d: %s", at + 1, E.numbuffers,
+        E.filename ? E.filename : "[No Name]");
+
+    // A followed file may have been truncated while the buffer was parked,
+    // which has to be noticed before its rows are drawn
+    if (editorFollowPending()) editorFollowIdle();
+}
+
+// Opens a file in a new buffer and switches to it
+// A file that's already open and unmodified in another buffer
+// shares that buffer's rows instead of being read again
+void editorBufferOpen(char *filename, int view) {
+    editorUndoSeal();
+
+    struct editorBuffer *buffers = realloc(E.buffers, sizeof(struct editorBuffer) * (E.numbuffers + 1));
+    if (buffers == NULL) die("realloc");
+    E.buffers = buffers;
+
+    // Park the current buffer, so every buffer can be looked at the same way
+    editorBufferPark(&E.buffers[E.curbuffer]);
+
+    char *path = realpath(filename, NULL);
+    int j;
+    for (j = 0; path != NULL && j < E.numbuffers; j++) {
+        struct editorBuffer *b = &E.buffers[j];
+        if (b->dirty == 0 && b->store->path != NULL && strcmp(b->store->path, path) == 0) break;
+    }
+
+    if (view) {
+        // A file opened with -R has rows of its own, which aren't shared
+        editorBufferInit();
+        editorViewOpen(filename);
+    } else if (path != NULL && j < E.numbuffers) {
+        // Take over the rows and their highlighting state, the new
+        // buffer gets a cursor and an undo history of its own
+        editorBufferRestore(&E.buffers[j]);
+        E.store->refs++;
+        E.id = ++E.lastid;
+        E.follow = NULL;
+        E.autosaved = 0;
+        E.autosave_time = editorMonotonicUs();
+        E.cx = 0;
+        E.cy = 0;
+        E.rx = 0;
+        E.rowoff = 0;
+        E.coloff = 0;
+        E.filename = strdup(filename);
+        if (E.filename == NULL) die("strdup");
+        E.undo.first = NULL;
+        E.undo.last = NULL;
+        E.undo.bytes = 0;
+        E.undo.oldest = NULL;
+        E.undo.newest = NULL;
+        E.undo.current = NULL;
+        E.undo.group = 0;
+        E.undo.sealed = 1;
+    } else {
+        editorBufferInit();
+        editorOpen(filename);
+    }
+    free(path);
+
+    E.curbuffer = E.numbuffers++;
+}
+
+// Closes the buffer being edited and switches to the one after it
+// The last buffer can't be closed, Ctrl-Q quits the editor instead
+void editorBufferClose() {
+    if (E.numbuffers == 1) {
+        editorSetStatusMessage("Can't close the last buffer");
+        return;
+    }
+
+    int at = E.curbuffer;
+    editorFollowStop();
+    editorBufferPark(&E.buffers[at]);
+    editorStoreRelease(&E.buffers[at]);
+    editorUndoClear();
+    free(E.filename);
+
+    // Fill the closed buffer's slot with the ones after it
+    memmove(&E.buffers[at], &E.buffers[at + 1], sizeof(struct editorBuffer) * (E.numbuffers - at - 1));
+    E.numbuffers--;
+    if (at == E.numbuffers) at--;
+
+    editorBufferRestore(&E.buffers[at]);
+    E.curbuffer = at;
+
+    editorSetStatusMessage("Buffer %d of %d: %s", at + 1, E.numbuffers,
+        E.filename ? E.filename : "[No Name]");
+}
+
+// Returns the number of buffers with unsaved changes
+int editorBuffersDirty() {
+    int n = E.dirty ? 1 : 0;
+
+    int j;
+    for (j = 0; j < E.numbuffers; j++) {
+        if (j != E.curbuffer && E.buffers[j].dirty) n++;
+    }
+
+    return n;
+}
+
+// Returns the buffer with the given id, null if it was closed
+// The buffer in E is returned parked, changes to it have to be restored
+struct editorBuffer *editorBufferFind(unsigned int id) {
+    // Park the buffer in E, so every buffer can be looked at the same way
+    editorBufferPark(&E.buffers[E.curbuffer]);
+
+    int j;
+    for (j = 0; j < E.numbuffers; j++) {
+        if (E.buffers[j].id == id) return &E.buffers[j];
+    }
+
+    return NULL;
+}
+
+// Records that the rows of a storage were written to a file
+// Buffers whose rows came from that file no longer match it,
+// so they stop being offered for sharing
+void editorBufferSaved(struct editorStore *saved, const char *filename) {
+    char *path = realpath(filename, NULL);
+
+    editorBufferPark(&E.buffers[E.curbuffer]);
+
+    int j;
+    for (j = 0; path != NULL && j < E.numbuffers; j++) {
+        struct editorStore *store = E.buffers[j].store;
+        if (store == saved || store->path == NULL) continue;
+        if (strcmp(store->path, path) == 0) {
+            free(store->path);
+            store->path = NULL;
+        }
+    }
+
+    free(saved->path);
+    saved->path = path;
+}
+
+/*** saving ***/
+
+// Body of the save thread, writes the snapshot of a job to its file
+void *editorSaveWorker(void *arg) {
+    struct editorSaveJob *job = arg;
+
+    long long len = editorSaveFile(job->filename, job->snap.filename, job->umask, &job->snap);
+    int err = errno;
+
+    pthread_mutex_lock(&job->lock);
+    job->len = len;
+    job->err = err;
+    job->done = 1;
+    pthread_mutex_unlock(&job->lock);
+
+    // Wake up the main loop
+    write(E.savenotify[1], "", 1);
+
+    return NULL;
+}
+
+// Starts writing a buffer to its file, or to its backup, on the save thread
+// Taking the snapshot only copies the buffer's state and adds a reference
+// to its row storage, the first edit made while the save is running gives
+// the buffer rows of its own, so the snapshot stays as it was
+// The caller waits for the save before it, only one is written at a time
+void editorSaveStart(struct editorBuffer *b, int autosave) {
+    struct editorSaveJob *job = malloc(sizeof(struct editorSaveJob));
+    if (job == NULL) die("malloc");
+
+    job->snap = *b;
+    job->snap.store->refs++;
+
+    // The buffer's filename goes away if it's closed, the snapshot keeps a copy
+    job->snap.filename = strdup(b->filename);
+    if (job->snap.filename == NULL) die("strdup");
+
+    size_t len = strlen(b->filename) + sizeof(AUTOSAVE_SUFFIX);
+    job->filename = malloc(len);
+    if (job->filename == NULL) die("malloc");
+    snprintf(job->filename, len, "%s%s", b->filename, autosave ? AUTOSAVE_SUFFIX : "");
+
+    job->autosave = autosave;
+    job->umask = E.umask;
+    job->len = -1;
+    job->err = 0;
+    job->done = 0;
+    pthread_mutex_init(&job->lock, NULL);
+
+    // The main loop polls the read end of the wakeup pipe, which is made with the first save
+    if (E.savenotify[0] == -1) {
+        if (pipe(E.savenotify) == -1) die("pipe");
+        fcntl(E.savenotify[0], F_SETFL, O_NONBLOCK);
+        fcntl(E.savenotify[1], F_SETFL, O_NONBLOCK);
+    }
+
+    if (pthread_create(&job->thread, NULL, editorSaveWorker, job) != 0) die("pthread_create");
+
+    E.save = job;
+}
+
+// Reports the result of the save the thread finished and lets go of its snapshot
+void editorSaveFinish() {
+    struct editorSaveJob *job = E.save;
+    E.save = NULL;
+
+    pthread_join(job->thread, NULL);
+    pthread_mutex_destroy(&job->lock);
+
+    // The buffer may have been switched away from or closed in the meantime
+    struct editorBuffer *b = editorBufferFind(job->snap.id);
+
+    if (job->len == -1) {
+        editorSetStatusMessage(job->autosave ? "Can't write backup! I/O error: %s" :
+            "Can't save! I/O error: %s", strerror(job->err));
+    } else if (job->autosave) {
+        if (b != NULL) b->autosaved = job->snap.dirty;
+    } else {
+        // The file holds the rows as they were when the save started
+        editorBufferSaved(job->snap.store, job->filename);
+        job->snap.store->size = job->len;
+
+        // Edits made while it was written are still unsaved
+        if (b != NULL) {
+            b->dirty -= job->snap.dirty;
+            b->autosaved = 0;
+        }
+
+        // The backup is older than the file now
+        size_t len = strlen(job->filename) + sizeof(AUTOSAVE_SUFFIX);
+        char *backup = malloc(len);
+        if (backup == NULL) die("malloc");
+        snprintf(backup, len, "%s%s", job->filename, AUTOSAVE_SUFFIX);
+        unlink(backup);
+        free(backup);
+
+        editorSetStatusMessage("%lld bytes written to disk", job->len);
+    }
+
+    if (b == &E.buffers[E.curbuffer]) editorBufferRestore(b);
+
+    editorStoreRelease(&job->snap);
+    free(job->snap.filename);
+    free(job->filename);
+    free(job);
+
+    // Backups wait while a save is written
+    editorAutosaveSchedule();
+}
+
+// Reports the save if the thread is done with it
+// Returns 1 if a save was finished
+int editorSaveCollect() {
+    if (E.save == NULL) return 0;
+
+    // Empty the wakeup pipe
+    char buf[64];
+    while (read(E.savenotify[0], buf, sizeof(buf)) > 0);
+
+    pthread_mutex_lock(&E.save->lock);
+    int done = E.save->done;
+    pthread_mutex_unlock(&E.save->lock);
+
+    if (!done) return 0;
+
+    editorSaveFinish();
+    return 1;
+}
+
+// Waits for the save being written, if there is one, and reports it
+void editorSaveWait() {
+    if (E.save != NULL) editorSaveFinish();
+}
+
+// Starts a backup of a buffer with changes that weren't backed up yet
+// Each buffer is backed up at most once every AUTOSAVE_SECS seconds,
+// never while a save is being written
+// Called when TIMER_AUTOSAVE goes off, returns 0 since nothing on screen changes
+int editorAutosave() {
+    if (E.save == NULL) {
+        long long now = editorMonotonicUs();
+        editorBufferPark(&E.buffers[E.curbuffer]);
+
+        int j;
+        for (j = 0; j < E.numbuffers; j++) {
+            struct editorBuffer *b = &E.buffers[j];
+            if (b->filename == NULL || b->dirty == 0 || b->dirty == b->autosaved) continue;
+            if (now - b->autosave_time < AUTOSAVE_SECS * 1000000LL) continue;
+
+            b->autosave_time = now;
+            if (j == E.curbuffer) E.autosave_time = now;
+
+            editorSaveStart(b, 1);
+            break;
+        }
+    }
+
+    editorAutosaveSchedule();
+    return 0;
+}
+
+// Arms TIMER_AUTOSAVE for the first buffer whose backup is due
+// While a save is being written the timer stays off, finishing the save arms it again
+void editorAutosaveSchedule() {
+    E.timers[TIMER_AUTOSAVE] = 0;
+    if (E.save != NULL) return;
+
+    editorBufferPark(&E.buffers[E.curbuffer]);
+
+    int j;
+    for (j = 0; j < E.numbuffers; j++) {
+        struct editorBuffer *b = &E.buffers[j];
+        if (b->filename == NULL || b->dirty == 0 || b->dirty == b->autosaved) continue;
+
+        long long due = b->autosave_time + AUTOSAVE_SECS * 1000000LL;
+        if (E.timers[TIMER_AUTOSAVE] == 0 || due < E.timers[TIMER_AUTOSAVE]) editorTimerArm(TIMER_AUTOSAVE, due);
+    }
+}
+
+// Writes the buffer to disk in the background
+// The status message reports how it went once it's written
+void editorSave() {
+    if (editorReadOnly()) return;
+
+    // Let the save before this one finish first, it may have been of this buffer
+    editorSaveWait();
+
+    // If it's a new file, prompt the user for a filename to save as
+    if (E.filename == NULL) {
+        // Prompt the user for filename
+        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        
+        // If user aborts the save, then display a message
+        // indicating that action and exit the function
+        if (E.filename == NULL) {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+
+        // Set appropriate syntax highlighting for the file type
+        editorSelectSyntaxHighlight();
+    }
+
+    // The saved file replaces the followed one, which won't grow anymore
+    editorFollowStop();
+
+    struct editorBuffer b;
+    editorBufferPark(&b);
+    editorSaveStart(&b, 0);
+}
+
+/*** follow ***/
+
+// Returns the number of buffers following a file through the given watch
+// Buffers following the same file get the same watch from inotify
+int editorFollowWatchers(int wd) {
+    editorBufferPark(&E.buffers[E.curbuffer]);
+
+    int n = 0;
+    int j;
+    for (j = 0; j < E.numbuffers; j++) {
+        if (E.buffers[j].follow != NULL && E.buffers[j].follow->wd == wd) n++;
+    }
+
+    return n;
+}
+
+// Gives every row of the buffer being edited a copy of its chars, so none of them
+// point into the mapped file anymore, and lets go of the mapping
+// A followed file can be truncated at any time, and reading the pages past its new
+// end faults with SIGBUS, even in a redraw before the truncation is noticed
+void editorFollowUnmap() {
+    if (E.store->map == NULL) return;
+
+    // Other buffers sharing the rows keep the mapping
+    editorStoreUnshare();
+
+    int j;
+    for (j = 0; j < E.numrows; j++) editorRowOwnChars(editorRowAt(j));
+
+    editorMapRelease(E.store->map);
+    E.store->map = NULL;
+}
+
+// Starts following the file of the buffer, like tail -f
+// Bytes appended to the file from now on are added to the end of the buffer
+// whenever inotify reports a write to it, and the file is checked every
+// FOLLOW_POLL_US where inotify isn't available. The buffer has to match the
+// file, so the bytes already in it are known
+void editorFollowStart() {
+    if (E.filename == NULL) {
+        editorSetStatusMessage("There's no file to follow");
+        return;
+    }
+    if (E.dirty) {
+        editorSetStatusMessage("Save the file before following it");
+        return;
+    }
+
+    int fd = open(E.filename, O_RDONLY);
+    if (fd == -1) {
+        editorSetStatusMessage("Can't follow %s: %s", E.filename, strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        editorSetStatusMessage("Can't follow %s, it isn't a regular file", E.filename);
+        return;
+    }
+
+    // Rows that stay in the mapped file would fault once it's truncated
+    if (E.view == NULL) editorFollowUnmap();
+
+    struct editorFollow *f = malloc(sizeof(struct editorFollow));
+    if (f == NULL) die("malloc");
+    f->fd = fd;
+
+    // The buffer holds the file as it was opened or last saved
+    f->offset = E.view != NULL ? (off_t) E.view->len : E.store->size;
+    f->partial = 0;
+    if (f->offset > 0) {
+        char c;
+        f->partial = pread(fd, &c, 1, f->offset - 1) == 1 && c != '\n';
+    }
+
+    // Anything written since then is read right away
+    f->pending = st.st_size != f->offset;
+
+    f->wd = -1;
+#ifdef __linux__
+    if (E.inotify == -1) E.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (E.inotify != -1) f->wd = inotify_add_watch(E.inotify, E.filename, IN_MODIFY);
+#endif
+    if (f->wd == -1) editorTimerArm(TIMER_FOLLOW, editorMonotonicUs() + FOLLOW_POLL_US);
+
+    // Like tail -f, start out at the end of the file, the screen scrolls along from there
+    E.cy = E.numrows > 0 ? E.numrows - 1 : 0;
+    E.cx = 0;
+
+    E.follow = f;
+    editorSetStatusMessage("Following %s, Ctrl-T to stop", E.filename);
+}
+
+// Stops following the file of the buffer, if it's following it
+void editorFollowStop() {
+    struct editorFollow *f = E.follow;
+    if (f == NULL) return;
+    E.follow = NULL;
+
+#ifdef __linux__
+    // The watch stays while another buffer follows the same file
+    if (f->wd != -1 && editorFollowWatchers(f->wd) == 0) inotify_rm_watch(E.inotify, f->wd);
+#endif
+
+    close(f->fd);
+    free(f);
+}
+
+// Reads the reports of writes to followed files from inotify
+// Every buffer following a written file gets its appended bytes the next time
+// it's the one being edited and idle, reports that arrive while a burst of
+// them is added only make the buffer check the file's size once more
+void editorFollowCollect() {
+#ifdef __linux__
+    union {
+        struct inotify_event event;
+        char buf[4096];
+    } u;
+    ssize_t n;
+
+    editorBufferPark(&E.buffers[E.curbuffer]);
+
+    while ((n = read(E.inotify, u.buf, sizeof(u.buf))) > 0) {
+        char *p = u.buf;
+        while (p < u.buf + n) {
+            struct inotify_event *event = (struct inotify_event *) p;
+
+            int j;
+            for (j = 0; j < E.numbuffers; j++) {
+                struct editorFollow *f = E.buffers[j].follow;
+                if (f != NULL && f->wd == event->wd) f->pending = 1;
+            }
+
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#endif
+}
+
+// Checks the size of the followed files inotify doesn't watch
+// Called when TIMER_FOLLOW goes off, returns 0 since the files are read while idle
+int editorFollowPoll() {
+    editorBufferPark(&E.buffers[E.curbuffer]);
+
+    int polled = 0;
+    int j;
+    for (j = 0; j < E.numbuffers; j++) {
+        struct editorFollow *f = E.buffers[j].follow;
+        if (f == NULL || f->wd != -1) continue;
+
+        struct stat st;
+        if (fstat(f->fd, &st) == -1 || st.st_size != f->offset) f->pending = 1;
+        polled = 1;
+    }
+
+    if (polled) editorTimerArm(TIMER_FOLLOW, editorMonotonicUs() + FOLLOW_POLL_US);
+    return 0;
+}
+
+// Adds the bytes appended to a followed file opened for editing to its rows
+// A slice of at most FOLLOW_READ_SIZE bytes is read at a time, so a file that
+// grows quickly doesn't keep the editor from reading keys. Its lines go in
+// through editorInsertRows(), after the rest of the last line if the buffer
+// ended in the middle of it
+// Returns 0 if the bytes couldn't be read
+int editorFollowRows(struct editorFollow *f, off_t size) {
+    size_t want = size - f->offset;
+    if (want > FOLLOW_READ_SIZE) want = FOLLOW_READ_SIZE;
+
+    char *buf = malloc(want);
+    if (buf == NULL) die("malloc");
+
+    ssize_t n = pread(f->fd, buf, want, f->offset);
+    if (n <= 0) {
+        // The file was cut short since its size was taken
+        if (n == 0) errno = EIO;
+        free(buf);
+        return 0;
+    }
+
+    // The rows may be shared with another buffer or a save being written
+    editorStoreUnshare();
+
+    size_t used = 0;
+    if (f->partial && E.numrows > 0) {
+        const char *nl = memchr(buf, '\n', n);
+        used = nl ? (size_t) (nl - buf) + 1 : (size_t) n;
+
+        size_t len = nl ? (size_t) (nl - buf) : (size_t) n;
+        while (nl && len > 0 && buf[len - 1] == '\r') len--;
+
+        // Add the rest of the line to the last row, without counting it as a change
+        if (len > 0) {
+            erow *row = editorRowAt(E.numrows - 1);
+            editorRowOwnChars(row);
+            row->chars = editorPoolGrow(row->chars, &row->charsclass, row->size + 1, row->size + len + 1);
+            memcpy(&row->chars[row->size], buf, len);
+            row->size += len;
+            row->chars[row->size] = '\0';
+            editorUpdateRow(row, row->size - len, 0, len);
+        }
+        f->partial = nl == NULL;
+    }
+
+    if (used < (size_t) n) {
+        // A newline at the end finishes the last line rather than starting an empty one
+        f->partial = buf[n - 1] != '\n';
+        editorInsertRows(E.numrows, buf + used, n - used - !f->partial, 1);
+    }
+
+    f->offset += n;
+    free(buf);
+
+    // The rows hold the file up to here now, following it again goes on from here
+    E.store->size = f->offset;
+    return 1;
+}
+
+// Adds the lines appended to a followed file opened with -R to its view
+// The grown file is mapped again and only the bytes past the old end are
+// scanned for the line index. Cached rows are moved over to the new mapping,
+// the last line is read again if the file ended in the middle of it
+// Returns 0 if the file couldn't be mapped
+int editorFollowView(struct editorFollow *f, off_t size) {
+    struct editorView *v = E.view;
+
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+    if (map == MAP_FAILED) return 0;
+
+    int partial = v->len > 0 && v->map[v->len - 1] != '\n';
+
+    int i;
+    for (i = 0; i < v->used; i++) {
+        erow *row = &v->rows[i].row;
+        row->chars = map + (row->chars - v->map);
+        if (row->flags & ROW_RENDER_ALIAS) row->render = row->chars;
+    }
+
+    if (v->map != NULL) munmap(v->map, v->len);
+    v->map = map;
+    v->len = size;
+
+    size_t from = f->offset;
+    if (partial) {
+        v->numrows--;
+        from = editorViewLineStart(v, v->numrows) - v->map;
+
+        // The cached row of the last line ends where the file used to
+        i = editorViewFind(v, v->numrows);
+        if (i != -1) {
+            erow *row = &v->rows[i].row;
+            const char *p = row->chars;
+            editorFreeRow(row);
+            memset(row, 0, sizeof(erow));
+            row->chars = (char *) p;
+            row->size = editorViewLineNext(v, &p);
+            row->flags = ROW_MAPPED | ROW_HL_STALE;
+        }
+    }
+    int lines = v->numrows;
+    editorViewScan(v, from);
+    E.numrows = v->numrows;
+
+    // The comment scan goes on into the new lines, the last line
+    // is scanned again if it got past where the file used to end
+    if (E.hl_dirty > lines) editorViewRewind(v, lines);
+    else if (E.hl_dirty == lines) v->scanlen = -1;
+
+    // The line the scan is at may have been indexed just now
+    if (E.hl_dirty == lines && v->scanat == 0 && lines % VIEW_INDEX_STEP == 0 && lines / VIEW_INDEX_STEP < v->nindex)
+        v->entry[lines / VIEW_INDEX_STEP] = v->scanstate == LEX_MLCOMMENT;
+
+    f->offset = size;
+    return 1;
+}
+
+// Empties the buffer of a followed file that was truncated, so it's read again from the start
+// Rows pointing into the mapped file can't be kept, their bytes are gone
+// and reading them would fault, so they're dropped without being looked at
+void editorFollowRestart(struct editorFollow *f) {
+    if (E.view != NULL) {
+        struct editorView *v = E.view;
+
+        int i;
+        for (i = 0; i < v->used; i++) editorFreeRow(&v->rows[i].row);
+        v->used = 0;
+        v->newest = -1;
+        v->oldest = -1;
+        memset(v->buckets, -1, sizeof(v->buckets));
+
+        if (v->map != NULL) munmap(v->map, v->len);
+        v->map = NULL;
+        v->len = 0;
+        v->nindex = 1;
+        v->numrows = 0;
+        v->entry[0] = 0;
+        editorViewRewind(v, 0);
+    } else {
+        editorStoreUnshare();
+
+        int j;
+        for (j = 0; j < E.numrows; j++) editorFreeRow(editorRowAt(j));
+        editorMapRelease(E.store->map);
+        E.store->map = NULL;
+        E.store->size = 0;
+
+        E.gap = 0;
+        E.gaplen = E.rowcap;
+        E.dirty = 0;
+        editorUndoClear();
+    }
+
+    E.numrows = 0;
+    E.hl_dirty = 0;
+    E.hl_dirty_end = 0;
+    E.cx = 0;
+    E.cy = 0;
+    E.rowoff = 0;
+    E.coloff = 0;
+
+    f->offset = 0;
+    f->partial = 0;
+}
+
+// Notices that the file followed by a buffer opened with -R was truncated before its rows are looked at
+// The rows of a view point into the mapped file and can't be copied like in
+// editorFollowUnmap(), so the size is checked before each key and each redraw
+// Returns 1 if the file was truncated and the buffer emptied
+int editorFollowTruncated() {
+    struct editorFollow *f = E.follow;
+    if (f == NULL || E.view == NULL) return 0;
+
+    struct stat st;
+    if (fstat(f->fd, &st) == -1 || st.st_size >= f->offset) return 0;
+
+    editorFollowRestart(f);
+    f->pending = 1;
+    editorSetStatusMessage("%s was truncated", E.filename);
+    return 1;
+}
+
+// Whether the buffer being edited follows a file that may have grown
+// Nothing is added while the search prompt is open, the workers may be reading the rows
+int editorFollowPending() {
+    return E.follow != NULL && E.follow->pending && !E.search.active;
+}
+
+// Adds what was appended to the followed file to the buffer being edited
+// A cursor on the last line stays on it, so the screen scrolls along with the file
+// Returns 1 if the buffer changed
+int editorFollowIdle() {
+    struct editorFollow *f = E.follow;
+
+    struct stat st;
+    if (fstat(f->fd, &st) == -1) {
+        editorSetStatusMessage("Can't read %s: %s, stopped following it", E.filename, strerror(errno));
+        editorFollowStop();
+        return 1;
+    }
+
+    // Like tail -f, a truncated file, say by log rotation, is followed from its new start
+    int restarted = st.st_size < f->offset;
+    if (restarted) {
+        editorFollowRestart(f);
+        editorSetStatusMessage("%s was truncated", E.filename);
+    }
+
+    if (st.st_size == f->offset) {
+        f->pending = 0;
+        return restarted;
+    }
+
+    int numrows = E.numrows;
+    int ok = E.view != NULL ? editorFollowView(f, st.st_size) : editorFollowRows(f, st.st_size);
+    if (!ok) {
+        editorSetStatusMessage("Can't read %s: %s, stopped following it", E.filename, strerror(errno));
+        editorFollowStop();
+        return 1;
+    }
+
+    // Whatever is left is read in the next slice
+    f->pending = f->offset < st.st_size;
+
+    if (E.cy >= numrows) {
+        E.cy = E.numrows;
+    } else if (E.cy == numrows - 1 && E.numrows > numrows) {
+        E.cy = E.numrows - 1;
+        int len = editorRowAt(E.cy)->size;
+        if (E.cx > len) E.cx = len;
+    }
+
+    return 1;
+}
 
-    // After inserting, move the cursor forward to allow
-    // the next char the user inserts to go after the inserted char
-    E.cx++;
+/*** regex ***/
+
+// Adds a node to the automaton being built and returns its index
+int editorRegexNode(struct regexParser *p, int type) {
+    if (p->nnodes == p->nodecap) {
+        p->nodecap = p->nodecap ? p->nodecap * 2 : 64;
+        p->nodes = realloc(p->nodes, sizeof(struct regexNode) * p->nodecap);
+        if (p->nodes == NULL) die("realloc");
+    }
+
+    struct regexNode *n = &p->nodes[p->nnodes];
+    n->type = type;
+    memset(n->set, 0, sizeof(n->set));
+    n->out = -1;
+    n->out1 = -1;
+
+    return p->nnodes++;
 }
 
-// Inserts a new line
-void editorInsertNewline() {
-    // If the cursor is at the start of a line,
-    // then insert a blank row before the line the cursor is on
-    // Otherwise, split the line the cursor is on into two rows
-    if (E.cx == 0) {
-        editorInsertRow(E.cy, "", 0);
-    } else {
-        // Get the current row
-        erow *row = &E.row[E.cy];
+// Adds a byte to the set of a REGEX_CHAR node
+void editorRegexSetAdd(unsigned char *set, int c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
 
-        // Insert the row's chars right of the cursor to 
-        // create a new row after the current row
-        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+// Checks whether a byte is in the set of a REGEX_CHAR node
+int editorRegexSetHas(const unsigned char *set, int c) {
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
 
-        // Reassign pointer since realloc() might move 
-        // around and invalidate the pointer
-        row = &E.row[E.cy];
+// Adds the bytes a class escape like \d stands for to a set
+// Returns 0 if the char after the backslash isn't a class escape
+int editorRegexEscapeClass(unsigned char *set, int c) {
+    int negate = isupper(c) != 0;
+    int b;
+
+    switch (tolower(c)) {
+        case 'd':
+            for (b = 0; b < 256; b++)
+                if ((isdigit(b) != 0) != negate) editorRegexSetAdd(set, b);
+            return 1;
+        case 'w':
+            for (b = 0; b < 256; b++)
+                if ((isalnum(b) || b == '_') != negate) editorRegexSetAdd(set, b);
+            return 1;
+        case 's':
+            for (b = 0; b < 256; b++)
+                if ((isspace(b) != 0) != negate) editorRegexSetAdd(set, b);
+            return 1;
+    }
 
-        // Truncate the size of the current row by setting
-        // size to the position of the cursor
-        row->size = E.cx;
+    return 0;
+}
 
-        // Append null byte at the end of the current row 
-        // since it was truncated
-        row->chars[row->size] = '\0';
+// Returns the byte a single-char escape like \t stands for
+int editorRegexEscapeChar(int c) {
+    switch (c) {
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+    }
+    return c;
+}
 
-        // Update the render string to update the current row content
-        editorUpdateRow(row);
+// Makes a fragment that consumes one byte of a set
+// The set is filled in by the caller through the returned fragment's start node
+struct regexFrag editorRegexChar(struct regexParser *p) {
+    struct regexFrag f;
+    f.start = editorRegexNode(p, REGEX_CHAR);
+    f.end = editorRegexNode(p, REGEX_EMPTY);
+    p->nodes[f.start].out = f.end;
+    return f;
+}
+
+// Parses a bracket expression, the opening [ was already consumed
+struct regexFrag editorRegexParseClass(struct regexParser *p) {
+    struct regexFrag f = editorRegexChar(p);
+    unsigned char set[32];
+    int negate = 0;
+
+    memset(set, 0, sizeof(set));
+
+    if (*p->pos == '^') {
+        negate = 1;
+        p->pos++;
     }
 
-    // Move the cursor to the beginning of the row
-    E.cy++;
-    E.cx = 0;
+    // A ] right after the opening bracket is an ordinary char
+    int first = 1;
+    while (*p->pos != '\0' && (*p->pos != ']' || first)) {
+        int c = (unsigned char) *p->pos++;
+        first = 0;
+
+        if (c == '\\') {
+            if (*p->pos == '\0') break;
+            c = (unsigned char) *p->pos++;
+            if (editorRegexEscapeClass(set, c)) continue;
+            c = editorRegexEscapeChar(c);
+        }
+
+        // A range like a-z, a - at the end of the class is an ordinary char
+        int hi = c;
+        if (p->pos[0] == '-' && p->pos[1] != ']' && p->pos[1] != '\0') {
+            hi = (unsigned char) p->pos[1];
+            p->pos += 2;
+            if (hi == '\\' && *p->pos != '\0') hi = editorRegexEscapeChar((unsigned char) *p->pos++);
+            if (hi < c) {
+                p->error = "bad range in regex";
+                return f;
+            }
+        }
+
+        for (int b = c; b <= hi; b++) editorRegexSetAdd(set, b);
+    }
+
+    if (*p->pos != ']') {
+        p->error = "missing ] in regex";
+        return f;
+    }
+    p->pos++;
+
+    for (int b = 0; b < 256; b++) {
+        if (editorRegexSetHas(set, b) != negate) editorRegexSetAdd(p->nodes[f.start].set, b);
+    }
+
+    return f;
 }
 
-// Deletes the character left of the cursor
-void editorDelChar() {
-    // If cursor is at the end of the file, there's nothing
-    // to delete, so exit the function
-    if (E.cy == E.numrows) return;
+struct regexFrag editorRegexParseAlt(struct regexParser *p);
 
-    // If cursor is at the beginning of the first line,
-    // there's nothing to do, so exit the function
-    if (E.cx == 0 && E.cy == 0) return;
+// Parses a single char, a class, a dot or a group
+struct regexFrag editorRegexParseAtom(struct regexParser *p) {
+    struct regexFrag f;
+    int c = (unsigned char) *p->pos++;
 
-    // Get the row where the cursor is on
-    erow *row = &E.row[E.cy];
+    switch (c) {
+        case '(':
+            f = editorRegexParseAlt(p);
+            if (p->error) return f;
+            if (*p->pos != ')') {
+                p->error = "missing ) in regex";
+                return f;
+            }
+            p->pos++;
+            return f;
+
+        case '[':
+            return editorRegexParseClass(p);
+
+        case '.':
+            // Rows never contain a newline, so a dot matches every byte
+            f = editorRegexChar(p);
+            memset(p->nodes[f.start].set, 0xff, sizeof(p->nodes[f.start].set));
+            return f;
+
+        case '\\':
+            f = editorRegexChar(p);
+            if (*p->pos == '\0') {
+                p->error = "trailing \\ in regex";
+                return f;
+            }
+            c = (unsigned char) *p->pos++;
+            if (!editorRegexEscapeClass(p->nodes[f.start].set, c))
+                editorRegexSetAdd(p->nodes[f.start].set, editorRegexEscapeChar(c));
+            return f;
+
+        case '*':
+        case '+':
+        case '?':
+            f.start = f.end = editorRegexNode(p, REGEX_EMPTY);
+            p->error = "nothing to repeat in regex";
+            return f;
+    }
 
-    // If there's a char left of the cursor,
-    // proceed to delete it and move the cursor one to the left
-    // Otherwise if the cursor is at the beginning of ar row, 
-    // set the cursor to the end of the preceding line, append the current 
-    // line to the end of the preceding line, and delete the current line
-    if (E.cx > 0) {
-        editorRowDelChar(row, E.cx - 1);
-        E.cx--;
-    } else {
-        E.cx = E.row[E.cy - 1].size;
-        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-        editorDelRow(E.cy);
-        E.cy--;
+    // Any other char stands for itself
+    f = editorRegexChar(p);
+    editorRegexSetAdd(p->nodes[f.start].set, c);
+    return f;
+}
+
+// Parses an atom followed by any number of *, + and ? operators
+struct regexFrag editorRegexParseRepeat(struct regexParser *p) {
+    struct regexFrag f = editorRegexParseAtom(p);
+
+    while (!p->error && (*p->pos == '*' || *p->pos == '+' || *p->pos == '?')) {
+        char op = *p->pos++;
+        int split = editorRegexNode(p, REGEX_SPLIT);
+        int end = editorRegexNode(p, REGEX_EMPTY);
+
+        // The split either goes into the atom or past it
+        p->nodes[split].out = f.start;
+        p->nodes[split].out1 = end;
+
+        // * and + loop back to the split after the atom, ? goes on past it
+        p->nodes[f.end].out = op == '?' ? end : split;
+
+        // + has to go through the atom once before reaching the split
+        if (op != '+') f.start = split;
+        f.end = end;
     }
+
+    return f;
 }
 
-/*** file i/o ***/
+// Parses a sequence of repeats up to a |, a ) or the end of the pattern
+struct regexFrag editorRegexParseConcat(struct regexParser *p) {
+    struct regexFrag f;
+    f.start = f.end = editorRegexNode(p, REGEX_EMPTY);
 
-// Converts erow struct array into a single string
-// that will be written out to a file
-char *editorRowsToString(int *buflen) {
-    int totlen = 0;
-    int j;
+    while (!p->error && *p->pos != '\0' && *p->pos != '|' && *p->pos != ')') {
+        // A $ at the very end anchors the match to the end of the row
+        if (p->pos[0] == '$' && p->pos[1] == '\0') {
+            p->eol = 1;
+            p->pos++;
+            break;
+        }
 
-    // Add all of the lengths of row of text
-    // Add 1 to each row to account newline char 
-    // that will be added at the end of each line
-    for (j = 0; j < E.numrows; j++)
-        totlen += E.row[j].size + 1;
+        struct regexFrag next = editorRegexParseRepeat(p);
+        p->nodes[f.end].out = next.start;
+        f.end = next.end;
+    }
 
-    // Save the total length to tell caller how long the string is
-    *buflen = totlen;
+    return f;
+}
 
-    // Allocate space for a buffer based on the total string length
-    char *buf = malloc(totlen);
-    
-    // Set a pointer to the buffer, so the buffer maintains
-    // its pointer at the start and to be used later
-    // to free the allocated memory
-    char *p = buf;
+// Parses alternatives separated by |
+struct regexFrag editorRegexParseAlt(struct regexParser *p) {
+    struct regexFrag f = editorRegexParseConcat(p);
 
-    // Loop through the rows and copy the contents to the 
-    // end of the buffer and append a newline char after each row
-    for (j = 0; j < E.numrows; j++) {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+    while (!p->error && *p->pos == '|') {
+        p->pos++;
+        struct regexFrag next = editorRegexParseConcat(p);
+
+        int split = editorRegexNode(p, REGEX_SPLIT);
+        int end = editorRegexNode(p, REGEX_EMPTY);
+        p->nodes[split].out = f.start;
+        p->nodes[split].out1 = next.start;
+        p->nodes[f.end].out = end;
+        p->nodes[next.end].out = end;
+
+        f.start = split;
+        f.end = end;
     }
 
-    // Return the buffer, expect caller to free memory
-    return buf;
+    return f;
 }
 
-// Opens and reads a files from disk
-void editorOpen(char *filename) {
-    // Free used memory to update the filename
-    free(E.filename);
+// Adds a node and every node reachable from it without consuming a byte to a set of nodes
+// Only the REGEX_CHAR and REGEX_MATCH nodes are kept, they are all a DFA state depends on
+// Nodes marked in seen were already followed and are skipped, which also
+// ends loops like (a*)* that never consume a byte
+void editorRegexClosure(const struct regexParser *p, int node, unsigned int *set,
+                        unsigned int *seen, int *stack) {
+    int top = 0;
+    stack[top++] = node;
+
+    while (top > 0) {
+        int n = stack[--top];
+        if (n == -1 || (seen[n >> 5] & (1u << (n & 31)))) continue;
+        seen[n >> 5] |= 1u << (n & 31);
+
+        const struct regexNode *rn = &p->nodes[n];
+        if (rn->type == REGEX_EMPTY) {
+            stack[top++] = rn->out;
+        } else if (rn->type == REGEX_SPLIT) {
+            stack[top++] = rn->out;
+            stack[top++] = rn->out1;
+        } else {
+            set[n >> 5] |= 1u << (n & 31);
+        }
+    }
+}
 
-    // Duplicate the filename and store it as a global state
-    E.filename = strdup(filename);
+// Hashes a set of nodes with FNV-1a
+unsigned int editorRegexHashSet(const unsigned int *set, int words) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < words; i++) {
+        h ^= set[i];
+        h *= 16777619u;
+    }
+    return h;
+}
 
-    // Set appropriate syntax highlighting for the file type
-    editorSelectSyntaxHighlight();
+// Frees a compiled regex once the last user lets go of it
+// Note: the caller holds E.search.lock when the regex is shared with search workers
+void editorRegexRelease(struct editorRegex *re) {
+    if (re == NULL || --re->refs > 0) return;
+
+    free(re->dfa.trans);
+    free(re->dfa.accept);
+    free(re->search.trans);
+    free(re->search.accept);
+    free(re->reverse.trans);
+    free(re->reverse.accept);
+    free(re);
+}
 
-    // Opens the file that the user passed as the arg for reading
-    FILE *fp = fopen(filename, "r");
+// Builds one DFA of a regex by subset construction, each state is a set of NFA nodes
+// init is the closure of the start node and outs holds the closure of the out node
+// of each REGEX_CHAR node, one set of words words per node
+// REGEX_DFA_SEARCH adds init to every state before following a byte, so a match
+// can start anywhere, and REGEX_DFA_REVERSE follows the REGEX_CHAR nodes backwards
+// from the REGEX_MATCH node, accepting once it gets back to one init holds
+// Returns an error if the DFA needs more than REGEX_MAX_STATES states
+const char *editorRegexBuild(const struct regexParser *p, int kind, const unsigned int *init,
+                             const unsigned int *outs, int match, int nclasses, const int *rep,
+                             struct regexDfa *dfa) {
+    const char *error = NULL;
+    int words = (p->nnodes + 31) / 32;
+    int n, c, w;
+
+    unsigned int *sets = calloc((size_t) REGEX_MAX_STATES * words, sizeof(unsigned int));
+    int *table = malloc(sizeof(int) * REGEX_MAX_STATES * 2);
+    unsigned int *from = malloc(sizeof(unsigned int) * words);
+    unsigned int *next = malloc(sizeof(unsigned int) * words);
+    dfa->trans = malloc(sizeof(int) * REGEX_MAX_STATES * nclasses);
+    dfa->accept = malloc(REGEX_MAX_STATES);
+    if (!sets || !table || !from || !next || !dfa->trans || !dfa->accept) die("malloc");
+
+    // Open addressing table of the states found so far, keyed by their node set
+    int tablemask = REGEX_MAX_STATES * 2 - 1;
+    for (int i = 0; i <= tablemask; i++) table[i] = -1;
+
+    // State 0 is the empty set, the search DFA starts there and the others die there
+    dfa->nstates = 1;
+    table[editorRegexHashSet(sets, words) & tablemask] = 0;
+
+    // The state the others start in
+    memset(next, 0, sizeof(unsigned int) * words);
+    if (kind == REGEX_DFA_ANCHORED) memcpy(next, init, sizeof(unsigned int) * words);
+    if (kind == REGEX_DFA_REVERSE) next[match >> 5] |= 1u << (match & 31);
+
+    for (int s = -1; s < dfa->nstates && !error; s++) {
+        if (s >= 0) {
+            unsigned int *set = &sets[(size_t) s * words];
+            if (kind == REGEX_DFA_REVERSE) {
+                dfa->accept[s] = 0;
+                for (w = 0; w < words; w++) if (set[w] & init[w]) dfa->accept[s] = 1;
+            } else {
+                dfa->accept[s] = (set[match >> 5] >> (match & 31)) & 1;
+            }
 
-    // If fopen failed to open the file, error out
-    if (!fp) die("fopen");
-    
-    // Pointer that points to the buffer where the read message will be stored
-    char *line = NULL;
+            memcpy(from, set, sizeof(unsigned int) * words);
+            if (kind == REGEX_DFA_SEARCH) for (w = 0; w < words; w++) from[w] |= init[w];
+        }
 
-    // Size of the buffer pointed to by the message pointer
-    size_t linecap = 0;
+        for (c = 0; c < nclasses; c++) {
+            // Going forward, follow every REGEX_CHAR node of the state that takes the class,
+            // going backwards, find the REGEX_CHAR nodes that take it and lead into the state
+            if (s >= 0) {
+                memset(next, 0, sizeof(unsigned int) * words);
+                for (n = 0; n < p->nnodes; n++) {
+                    if (p->nodes[n].type != REGEX_CHAR || !editorRegexSetHas(p->nodes[n].set, rep[c])) continue;
+                    const unsigned int *out = &outs[(size_t) n * words];
+
+                    if (kind == REGEX_DFA_REVERSE) {
+                        for (w = 0; w < words && !(out[w] & from[w]); w++);
+                        if (w < words) next[n >> 5] |= 1u << (n & 31);
+                    } else if (from[n >> 5] & (1u << (n & 31))) {
+                        for (w = 0; w < words; w++) next[w] |= out[w];
+                    }
+                }
+            }
 
-    // Length of the message
-    ssize_t linelen;
+            // Look the resulting set up, adding a new state if it wasn't seen before
+            unsigned int h = editorRegexHashSet(next, words) & tablemask;
+            int t;
+            while ((t = table[h]) != -1 && memcmp(&sets[(size_t) t * words], next, sizeof(unsigned int) * words) != 0)
+                h = (h + 1) & tablemask;
 
-    // Read lines from the file and store to the allocated buffer
-    // Updates pointer and allocates necessary memory
-    // Check if the returned value is not the end of the file 
-    // -1 indicates there are no more lines to read
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        // Strip off newline or carriage return at the end of the line 
-        // before copying it to the erow since each erow represents one line of text
-        // there's no reason to store a newline character at the end of each one
-        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-            linelen--;
+            if (t == -1) {
+                if (dfa->nstates == REGEX_MAX_STATES) {
+                    error = "regex too complex";
+                    break;
+                }
+                t = dfa->nstates++;
+                memcpy(&sets[(size_t) t * words], next, sizeof(unsigned int) * words);
+                table[h] = t;
+            }
 
-        // Append line to erow struct array
-        editorInsertRow(E.numrows, line, linelen);
+            // The start state only has to be looked up once
+            if (s == -1) {
+                dfa->start = t;
+                break;
+            }
+            dfa->trans[s * nclasses + c] = t;
+        }
     }
 
-    // Free the memory used by the buffer 
-    free(line);
+    free(sets);
+    free(table);
+    free(from);
+    free(next);
+    return error;
+}
 
-    // Close the file since we're done reading
-    fclose(fp);
+// Compiles a pattern into DFAs
+// The whole automata are built up front, so matching does one table lookup
+// per byte and the result can be shared by the search workers without locking
+// Supports chars, ., [...] classes, \d \w \s and their negations, groups,
+// |, *, + and ?, ^ at the start and $ at the end of the pattern
+// Returns null and sets *error if the pattern is invalid or too complex
+struct editorRegex *editorRegexCompile(const char *pattern, const char **error) {
+    *error = NULL;
+
+    struct regexParser p;
+    p.pos = pattern;
+    p.error = NULL;
+    p.nodes = NULL;
+    p.nnodes = 0;
+    p.nodecap = 0;
+    p.eol = 0;
+
+    // A ^ at the very start anchors the match to the start of the row
+    int bol = 0;
+    if (*p.pos == '^') {
+        bol = 1;
+        p.pos++;
+    }
 
-    // File is unchanged when opened
-    E.dirty = 0;
+    // Parse the pattern into a Thompson NFA ending in a REGEX_MATCH node
+    struct regexFrag f = editorRegexParseAlt(&p);
+    if (!p.error && *p.pos != '\0') p.error = "unmatched ) in regex";
+    if (p.error) {
+        free(p.nodes);
+        *error = p.error;
+        return NULL;
+    }
+    int match = editorRegexNode(&p, REGEX_MATCH);
+    p.nodes[f.end].out = match;
+
+    struct editorRegex *re = malloc(sizeof(struct editorRegex));
+    if (re == NULL) die("malloc");
+    re->refs = 1;
+    re->bol = bol;
+    re->eol = p.eol;
+
+    // Split the bytes into classes no REGEX_CHAR node tells apart,
+    // the DFA only needs one column per class instead of one per byte
+    int n, b, c;
+    int remap[512];
+    memset(re->classof, 0, sizeof(re->classof));
+    re->nclasses = 1;
+    for (n = 0; n < p.nnodes; n++) {
+        if (p.nodes[n].type != REGEX_CHAR) continue;
+
+        for (c = 0; c < 512; c++) remap[c] = -1;
+        int count = 0;
+        for (b = 0; b < 256; b++) {
+            int key = re->classof[b] * 2 + editorRegexSetHas(p.nodes[n].set, b);
+            if (remap[key] == -1) remap[key] = count++;
+            re->classof[b] = remap[key];
+        }
+        re->nclasses = count;
+    }
+
+    // A byte standing for each class
+    int rep[256];
+    for (b = 255; b >= 0; b--) rep[re->classof[b]] = b;
+
+    // The closure of the start node and of what comes after each REGEX_CHAR node,
+    // which is all the subset construction needs from the NFA
+    int words = (p.nnodes + 31) / 32;
+    unsigned int *init = calloc(words, sizeof(unsigned int));
+    unsigned int *outs = calloc((size_t) p.nnodes * words, sizeof(unsigned int));
+    unsigned int *seen = malloc(sizeof(unsigned int) * words);
+    int *stack = malloc(sizeof(int) * (p.nnodes * 2 + 1));
+    if (!init || !outs || !seen || !stack) die("malloc");
+
+    memset(seen, 0, sizeof(unsigned int) * words);
+    editorRegexClosure(&p, f.start, init, seen, stack);
+    for (n = 0; n < p.nnodes; n++) {
+        if (p.nodes[n].type != REGEX_CHAR) continue;
+        memset(seen, 0, sizeof(unsigned int) * words);
+        editorRegexClosure(&p, p.nodes[n].out, &outs[(size_t) n * words], seen, stack);
+    }
+
+    memset(&re->dfa, 0, sizeof(re->dfa));
+    memset(&re->search, 0, sizeof(re->search));
+    memset(&re->reverse, 0, sizeof(re->reverse));
+    *error = editorRegexBuild(&p, REGEX_DFA_ANCHORED, init, outs, match, re->nclasses, rep, &re->dfa);
+    if (!*error) *error = editorRegexBuild(&p, REGEX_DFA_SEARCH, init, outs, match, re->nclasses, rep, &re->search);
+    if (!*error) *error = editorRegexBuild(&p, REGEX_DFA_REVERSE, init, outs, match, re->nclasses, rep, &re->reverse);
+
+    free(init);
+    free(outs);
+    free(seen);
+    free(stack);
+    free(p.nodes);
+
+    if (*error) {
+        editorRegexRelease(re);
+        return NULL;
+    }
+
+    // Bytes that can start a match, to skip the ones that can't without running the DFA
+    struct regexDfa *dfa = &re->dfa;
+    for (b = 0; b < 256; b++) re->first[b] = dfa->trans[dfa->start * re->nclasses + re->classof[b]] != 0;
+
+    // Follow the DFA from the start as long as only one byte leads on,
+    // those bytes begin every match and are searched for first
+    re->prefixlen = 0;
+    int s = dfa->start;
+    while (!dfa->accept[s] && re->prefixlen < REGEX_MAX_PREFIX) {
+        int only = -1;
+        for (b = 0; b < 256; b++) {
+            if (dfa->trans[s * re->nclasses + re->classof[b]] == 0) continue;
+            if (only != -1) break;
+            only = b;
+        }
+        if (only == -1 || b < 256) break;
+
+        re->prefix[re->prefixlen++] = only;
+        s = dfa->trans[s * re->nclasses + re->classof[only]];
+    }
+
+    return re;
+}
+
+// Runs the DFA from a position in a row
+// Returns where the longest match starting there ends, or -1 if there's none
+int editorRegexMatchAt(const struct editorRegex *re, const char *chars, int size, int at) {
+    const struct regexDfa *dfa = &re->dfa;
+    int state = dfa->start;
+    int end = -1;
+
+    if (dfa->accept[state] && (!re->eol || at == size)) end = at;
+
+    for (int i = at; i < size; i++) {
+        state = dfa->trans[state * re->nclasses + re->classof[(unsigned char) chars[i]]];
+        if (state == 0) break;
+        if (dfa->accept[state] && (!re->eol || i + 1 == size)) end = i + 1;
+    }
+
+    return end;
+}
+
+// Finds the first match in a row that starts at or after from
+// One pass of the search DFA finds where the first match ends, the reverse DFA
+// runs back from there to the leftmost start of a match ending there, and the match
+// is then made as long as it gets, giving up on a longer one once REGEX_LOOKAHEAD
+// bytes and as many as the match holds went by without one, so no byte is
+// looked at more than a few times however many matches the row has
+// Note: a longer match that starts further left but ends later loses to the
+// first one to end, like bb over abb for (ab)*b+ in babb
+// Empty matches are skipped, they'd have nothing to highlight
+// Every SEARCH_CANCEL_BYTES the scan checks whether the search of gen was cancelled
+// Returns where the match starts and sets *len, -1 if there's none, or -2 if cancelled
+int editorRegexSearch(const struct editorRegex *re, const char *chars, int size, int from,
+                      int *len, unsigned int gen) {
+    // A ^ pattern can only match at the start of the row
+    if (re->bol) {
+        if (from > 0) return -1;
+
+        int end = editorRegexMatchAt(re, chars, size, 0);
+        if (end <= 0) return -1;
+        *len = end;
+        return 0;
+    }
+
+    // Find the first place a match ends, with a $ only the end of the row counts
+    const struct regexDfa *dfa = &re->search;
+    int state = dfa->start;
+    int end = -1;
+    int check = from + SEARCH_CANCEL_BYTES;
+
+    for (int i = from; i < size; i++) {
+        // While no match is under way, jump to the next place the literal prefix
+        // occurs, or skip bytes no match can start with
+        if (state == dfa->start) {
+            if (re->prefixlen > 0) {
+                const char *p = editorSearchFind(chars + i, size - i, re->prefix, re->prefixlen);
+                if (p == NULL) return -1;
+                i = p - chars;
+            } else if (!re->first[(unsigned char) chars[i]]) {
+                continue;
+            }
+        }
+
+        if (i >= check) {
+            if (editorSearchCancelled(gen)) return -2;
+            check = i + SEARCH_CANCEL_BYTES;
+        }
+
+        state = dfa->trans[state * re->nclasses + re->classof[(unsigned char) chars[i]]];
+        if (dfa->accept[state] && (!re->eol || i + 1 == size)) {
+            end = i + 1;
+            break;
+        }
+    }
+    if (end == -1) return -1;
+
+    // Go back to the leftmost start of a match ending there
+    dfa = &re->reverse;
+    state = dfa->start;
+    int start = -1;
+    for (int i = end - 1; i >= from; i--) {
+        state = dfa->trans[state * re->nclasses + re->classof[(unsigned char) chars[i]]];
+        if (state == 0) break;
+        if (dfa->accept[state]) start = i;
+    }
+    if (start == -1) return -1;
+
+    // Every match ends at the end of the row with a $, otherwise look for a longer one
+    if (!re->eol) {
+        dfa = &re->dfa;
+        state = dfa->start;
+        for (int i = start; i < size; i++) {
+            state = dfa->trans[state * re->nclasses + re->classof[(unsigned char) chars[i]]];
+            if (state == 0) break;
+            if (dfa->accept[state]) end = i + 1;
+            else if (i >= end && i - end >= REGEX_LOOKAHEAD && i - end >= end - start) break;
+        }
+    }
+
+    *len = end - start;
+    return start;
+}
+
+/*** find ***/
+
+// Finds the first occurrence of the needle in the haystack
+// Returns a pointer to it, or null if there's none
+// Positions are checked 16 at a time by comparing the first and the last
+// char of the needle against the haystack, only the positions where both
+// match are compared in full, which skips most of a line in a few steps
+const char *editorSearchFind(const char *hay, size_t haylen, const char *needle, size_t len) {
+    if (len == 0 || len > haylen) return NULL;
+
+    // A single char is what memchr() is made for
+    if (len == 1) return memchr(hay, needle[0], haylen);
+
+    // Last position a match can start at
+    size_t last = haylen - len;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i final = _mm_set1_epi8(needle[len - 1]);
+
+    // Each block covers the 16 start positions i to i + 15
+    while (i + 15 <= last) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (hay + i + len - 1));
+
+        // One bit per start position whose first and last chars both match
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final)));
+
+        // Compare the chars in between for each candidate, leftmost first
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, len - 2) == 0)
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+
+        i += 16;
+    }
+#endif
+
+    // Check the remaining positions, jumping between occurrences of the first char
+    while (i <= last) {
+        const char *p = memchr(hay + i, needle[0], last - i + 1);
+        if (p == NULL) return NULL;
+        if (memcmp(p + 1, needle + 1, len - 1) == 0) return p;
+        i = p - hay + 1;
+    }
+
+    return NULL;
+}
+
+// Makes room for more matches at the end of a match list
+// The list grows geometrically so adding matches costs amortized constant time
+void editorSearchReserve(struct searchMatchList *list, int n) {
+    if (list->len + n <= list->cap) return;
+
+    int cap = list->cap ? list->cap : 256;
+    while (cap < list->len + n) cap *= 2;
+
+    struct searchMatch *matches = realloc(list->matches, sizeof(struct searchMatch) * cap);
+    if (matches == NULL) die("realloc");
+    list->matches = matches;
+    list->cap = cap;
+}
+
+// Appends a match to the end of a match list
+void editorSearchAddMatch(struct searchMatchList *list, int row, int cx, int len) {
+    editorSearchReserve(list, 1);
+
+    list->matches[list->len].row = row;
+    list->matches[list->len].cx = cx;
+    list->matches[list->len].len = len;
+    list->len++;
+}
+
+// Checks whether the scan a worker is doing was replaced or dropped
+int editorSearchCancelled(unsigned int gen) {
+    pthread_mutex_lock(&E.search.lock);
+    int cancelled = gen != E.search.gen;
+    pthread_mutex_unlock(&E.search.lock);
+    return cancelled;
+}
+
+// Adds the matches of a query in the rows from start up to end to a match list
+// Overlapping literal matches are all listed, so the list of a longer query
+// is always a subset of the list of any prefix of it
+// With a regex, matches don't overlap and the query is ignored
+// Only literal matches starting from the from-th up to the to-th char of a row are
+// listed, so a long row can be split among the workers. Where a regex match
+// starts depends on the ones before it, so the whole row is scanned for the
+// piece the row starts with and nothing for the others
+// Returns 0 if the scan was cancelled before it got through the rows
+int editorSearchScanRows(int start, int end, int from, int to, const char *query, size_t len,
+                         const struct editorRegex *re, struct searchMatchList *list,
+                         unsigned int gen) {
+    // The lines of a file opened with -R are read from the mapping one after another,
+    // the row cache belongs to the main thread
+    const char *line = E.view != NULL && start < end ? editorViewLineStart(E.view, start) : NULL;
+
+    for (int j = start; j < end; j++) {
+        // Give up early on a scan that's no longer wanted
+        if (j > start && (j - start) % SEARCH_CANCEL_ROWS == 0 && editorSearchCancelled(gen))
+            return 0;
+
+        // The chars are searched since rows that were never drawn don't have a render
+        const char *chars;
+        int size;
+        if (line != NULL) {
+            chars = line;
+            size = editorViewLineNext(E.view, &line);
+        } else {
+            erow *row = editorRowAt(j);
+            chars = row->chars;
+            size = row->size;
+        }
+
+        if (re != NULL) {
+            if (from > 0) continue;
+
+            int at = 0;
+            int mlen;
+            while ((at = editorRegexSearch(re, chars, size, at, &mlen, gen)) >= 0) {
+                editorSearchAddMatch(list, j, at, mlen);
+                at += mlen;
+            }
+            if (at == -2) return 0;
+            continue;
+        }
+
+        // A match starting before to may run past it
+        if ((size_t) to + len - 1 < (size_t) size) size = to + len - 1;
+
+        size_t pos = from;
+        const char *match;
+        while (pos < (size_t) size &&
+               (match = editorSearchFind(chars + pos, size - pos, query, len)) != NULL) {
+            editorSearchAddMatch(list, j, match - chars, len);
+            pos = match - chars + 1;
+        }
+    }
+
+    return 1;
+}
+
+// Body of a search worker thread
+// Workers take chunks of rows off the running scan one at a time and scan
+// them straight from the row store, which can't change while the search
+// prompt is open, and editorSearchReset() waits for them before it's closed
+void *editorSearchWorker(void *arg) {
+    struct editorSearch *s = &E.search;
+    (void) arg;
+
+    pthread_mutex_lock(&s->lock);
+    while (1) {
+        // Sleep until a scan has chunks left to hand out
+        if (s->nextchunk >= s->nchunks) {
+            pthread_cond_wait(&s->work, &s->lock);
+            continue;
+        }
+
+        // Take the next chunk along with a copy of the query it's scanned for
+        // and a reference to its regex, both may be replaced while scanning
+        int k = s->nextchunk++;
+        struct searchChunk chunk = s->chunks[k];
+        unsigned int gen = s->gen;
+        size_t len = s->querylen;
+        char *query = malloc(len);
+        if (query == NULL) die("malloc");
+        memcpy(query, s->query, len);
+        struct editorRegex *re = s->regex;
+        if (re != NULL) re->refs++;
+        s->busy++;
+        pthread_mutex_unlock(&s->lock);
+
+        // Scan the chunk without holding the lock
+        struct searchMatchList found = {NULL, 0, 0};
+        int complete = editorSearchScanRows(chunk.start, chunk.end, chunk.from, chunk.to,
+                                            query, len, re, &found, gen);
+        free(query);
+
+        pthread_mutex_lock(&s->lock);
+        s->busy--;
+        editorRegexRelease(re);
+
+        // Hand the matches over unless the scan was cancelled in the meantime
+        if (complete && gen == s->gen) {
+            s->chunks[k].found = found;
+            s->chunks[k].done = 1;
+
+            // Wake up the main loop, a full pipe already has a wakeup pending
+            write(s->notify[1], "", 1);
+        } else {
+            free(found.matches);
+        }
+
+        if (s->busy == 0) pthread_cond_broadcast(&s->idle);
+    }
+
+    return NULL;
+}
+
+// Starts the search worker threads, one per processor up to SEARCH_MAX_THREADS
+void editorSearchStartWorkers() {
+    struct editorSearch *s = &E.search;
+
+    // The main loop polls the read end, neither end may block
+    if (pipe(s->notify) == -1) die("pipe");
+    fcntl(s->notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(s->notify[1], F_SETFL, O_NONBLOCK);
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > SEARCH_MAX_THREADS) n = SEARCH_MAX_THREADS;
+
+    for (s->nthreads = 0; s->nthreads < n; s->nthreads++) {
+        if (pthread_create(&s->threads[s->nthreads], NULL, editorSearchWorker, NULL) != 0)
+            die("pthread_create");
+    }
+}
+
+// Checks whether a background scan has chunks that weren't merged into the match list yet
+int editorSearchScanning() {
+    return E.search.merged < E.search.nchunks;
+}
+
+// Drops the background scan, if there is one
+// Workers still scanning one of its chunks notice the new gen and throw their matches away
+void editorSearchCancel() {
+    struct editorSearch *s = &E.search;
+
+    pthread_mutex_lock(&s->lock);
+    s->gen++;
+
+    for (int k = s->merged; k < s->nchunks; k++) free(s->chunks[k].found.matches);
+    free(s->chunks);
+    s->chunks = NULL;
+    s->nchunks = 0;
+    s->nextchunk = 0;
+    s->merged = 0;
+
+    pthread_mutex_unlock(&s->lock);
 }
 
-// Write a string to disk
-// Note: string is returned by editorRowsToString()
-void editorSave() {
-    // If it's a new file, prompt the user for a filename to save as
-    if (E.filename == NULL) {
-        // Prompt the user for filename
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        
-        // If user aborts the save, then display a message
-        // indicating that action and exit the function
-        if (E.filename == NULL) {
-            editorSetStatusMessage("Save aborted");
-            return;
+// Appends a chunk of rows from start up to end, or of the chars
+// of row start from from up to to, to the split of the buffer
+void editorSearchAddChunk(int start, int end, int from, int to) {
+    struct editorSearch *s = &E.search;
+
+    if ((s->nsplit & (s->nsplit - 1)) == 0) {
+        int cap = s->nsplit ? s->nsplit * 2 : 16;
+        s->split = realloc(s->split, sizeof(struct searchChunk) * cap);
+        if (s->split == NULL) die("realloc");
+    }
+
+    struct searchChunk *c = &s->split[s->nsplit++];
+    memset(c, 0, sizeof(struct searchChunk));
+    c->start = start;
+    c->end = end;
+    c->from = from;
+    c->to = to;
+}
+
+// Splits the buffer into chunks of at most SEARCH_CHUNK_ROWS rows and about
+// SEARCH_CHUNK_BYTES bytes, so a buffer of a few huge rows is shared among the
+// workers as well, and a row longer than that into pieces of its own
+// The lines of a file opened with -R are counted a line index step at a time,
+// only a step longer than a chunk is read line by line
+void editorSearchSplit() {
+    struct editorSearch *s = &E.search;
+    int start = 0;
+    size_t bytes = 0;
+    const char *line = NULL;
+
+    s->nsplit = 0;
+    for (int j = 0; j < E.numrows; ) {
+        int n = 1;
+        size_t size;
+        if (E.view != NULL && j % VIEW_INDEX_STEP == 0 && j + VIEW_INDEX_STEP <= E.numrows &&
+            j / VIEW_INDEX_STEP + 1 < E.view->nindex &&
+            E.view->index[j / VIEW_INDEX_STEP + 1] - E.view->index[j / VIEW_INDEX_STEP] <= SEARCH_CHUNK_BYTES) {
+            n = VIEW_INDEX_STEP;
+            size = E.view->index[j / VIEW_INDEX_STEP + 1] - E.view->index[j / VIEW_INDEX_STEP];
+            line = NULL;
+        } else if (E.view != NULL) {
+            if (line == NULL) line = editorViewLineStart(E.view, j);
+            size = editorViewLineNext(E.view, &line);
+        } else {
+            size = editorRowAt(j)->size;
+        }
+
+        // Close the chunk before the rows that would make it too big
+        if (j > start && (bytes + size > SEARCH_CHUNK_BYTES || j + n - start > SEARCH_CHUNK_ROWS)) {
+            editorSearchAddChunk(start, j, 0, INT_MAX);
+            start = j;
+            bytes = 0;
         }
 
-        // Set appropriate syntax highlighting for the file type
-        editorSelectSyntaxHighlight();
+        // A long row is split into pieces of SEARCH_CHUNK_BYTES chars
+        if (size > SEARCH_CHUNK_BYTES) {
+            for (size_t from = 0; from < size; from += SEARCH_CHUNK_BYTES) {
+                size_t to = size - from > SEARCH_CHUNK_BYTES ? from + SEARCH_CHUNK_BYTES : size;
+                editorSearchAddChunk(j, j + 1, from, to);
+            }
+            start = j + 1;
+            bytes = 0;
+        } else {
+            bytes += size;
+        }
+        j += n;
     }
 
-    int len;
+    if (start < E.numrows) editorSearchAddChunk(start, E.numrows, 0, INT_MAX);
+}
 
-    // Get the string that will be saved to disk
-    char *buf = editorRowsToString(&len);
-    
-    // Open the file for reading and writing from the given filename if it exists
-    // Create a new file if it doesn't exist 
-    // Note: 0644 is file permissions for the owner to read and write the file
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+// Hands the chunks of the buffer to the workers to scan for the current query
+// Matches come in through editorSearchCollect() as chunks are finished
+void editorSearchStartScan() {
+    struct editorSearch *s = &E.search;
+
+    if (s->nthreads == 0) editorSearchStartWorkers();
+
+    int nchunks = s->nsplit;
+    struct searchChunk *chunks = malloc(sizeof(struct searchChunk) * nchunks);
+    if (chunks == NULL) die("malloc");
+    memcpy(chunks, s->split, sizeof(struct searchChunk) * nchunks);
+
+    pthread_mutex_lock(&s->lock);
+    s->chunks = chunks;
+    s->nchunks = nchunks;
+    s->nextchunk = 0;
+    s->merged = 0;
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+}
 
-    // If there's an error opening the file, close the file
-    if (fd != -1) {
-        // Set the file's size to the specified length 
-        // If the file is larger, then the data is cut off at the end of the file
-        // If the file is smaller, then it will add 0 bytes at the end to get the length
-        // If truncation fails, we expect write() to return the number of specified bytes
-        if (ftruncate(fd, len) != -1) {
-            // Write the string to the file destination
-            if (write(fd, buf, len) == len) {
-                // Close the file
-                close(fd);
+// Appends the matches of finished chunks to the match list
+// Chunks are merged in row order, so the list stays sorted and
+// the first match in the file is found first
+// Returns 1 if the scan made progress since the last call
+int editorSearchCollect() {
+    struct editorSearch *s = &E.search;
 
-                // Free the memory used by the buffer
-                free(buf);
+    if (!editorSearchScanning()) return 0;
 
-                // Once saved, file isn't "dirty" anymore
-                E.dirty = 0;
+    // Empty the wakeup pipe
+    char buf[64];
+    while (read(s->notify[0], buf, sizeof(buf)) > 0);
 
-                // Notify user that the save succeeded
-                editorSetStatusMessage("%d bytes written to disk", len);
+    int merged = s->merged;
 
-                return;
-            }
+    pthread_mutex_lock(&s->lock);
+    while (s->merged < s->nchunks && s->chunks[s->merged].done) {
+        struct searchMatchList *found = &s->chunks[s->merged].found;
+
+        // Pieces of a long row often have no matches and no list
+        if (found->len > 0) {
+            editorSearchReserve(&s->list, found->len);
+            memcpy(&s->list.matches[s->list.len], found->matches, sizeof(struct searchMatch) * found->len);
+            s->list.len += found->len;
         }
 
-        // Close the file
-        close(fd);
+        free(found->matches);
+        found->matches = NULL;
+        s->merged++;
     }
+    pthread_mutex_unlock(&s->lock);
 
-    // Free the memory used by the buffer
-    free(buf);
+    // Move the cursor to the first match as soon as it's known
+    if (s->current == -1 && s->list.len > 0) {
+        s->current = 0;
+        editorFindShowMatch();
+    }
 
-    // On error, notify the user that the save failed
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    return s->merged != merged;
 }
 
+// Narrows the match list of a query down to the matches of a longer query
+// that starts with it, only the positions already in the list can match
+void editorSearchNarrow(const char *query, size_t len) {
+    struct editorSearch *s = &E.search;
+    int kept = 0;
 
-/*** find ***/
+    for (int j = 0; j < s->list.len; j++) {
+        struct searchMatch m = s->list.matches[j];
+        erow *row = editorRowAt(m.row);
 
-// Callback function that searches through all the rows in the file and if a 
-// row contains the query string, move the cursor to the match
-void editorFindCallback(char *query, int key) {
-    // Store the index of the row that the last match was on
-    // It will be -1 if there was no last match
-    static int last_match = -1;
+        // Keep the match if the rest of the longer query follows it
+        if ((size_t) (row->size - m.cx) >= len &&
+            memcmp(row->chars + m.cx + s->querylen, query + s->querylen, len - s->querylen) == 0) {
+            s->list.matches[kept++] = m;
+        }
+    }
+
+    s->list.len = kept;
+}
+
+// Brings the match list up to date with the query in the search prompt
+// The rows can't change while the prompt is open, so a query that
+// extends the last one only has to recheck the matches found for it
+// Buffers of more than one chunk are scanned in the background
+void editorSearchUpdate(const char *query) {
+    struct editorSearch *s = &E.search;
+    size_t len = strlen(query);
+
+    // Nothing to do if the query didn't change
+    if (s->query != NULL && len == s->querylen && memcmp(query, s->query, len) == 0) return;
+
+    // Narrowing needs the complete list of the shorter query
+    // and doesn't work for regexes, whose matches change in any way as they grow
+    // A long list is left to the workers, which can be cancelled by the next key
+    int narrow = !s->regex_mode && s->query != NULL && s->querylen > 0 && len > s->querylen &&
+        memcmp(query, s->query, s->querylen) == 0 && !editorSearchScanning() &&
+        (s->list.len <= SEARCH_NARROW_MATCHES || s->nsplit <= 1);
+
+    if (narrow) {
+        editorSearchNarrow(query, len);
+    } else {
+        editorSearchCancel();
+        s->list.len = 0;
+    }
 
-    // Store the direction of the search
-    // 1 for searching forward and -1 for searching backward
-    static int direction = 1;
+    // Compile the query once for every row to be matched against
+    struct editorRegex *re = NULL;
+    s->error = NULL;
+    if (s->regex_mode && len > 0) re = editorRegexCompile(query, &s->error);
 
-    // Use to know which line's hl needs to be restored
-    static int saved_hl_line;
+    // Remember the query the list belongs to, the workers read it too
+    char *copy = strdup(query);
+    if (copy == NULL) die("strdup");
 
-    // Save the original contents of hl
-    static char *saved_hl = NULL;
+    pthread_mutex_lock(&s->lock);
+    free(s->query);
+    s->query = copy;
+    s->querylen = len;
+    editorRegexRelease(s->regex);
+    s->regex = re;
+    pthread_mutex_unlock(&s->lock);
 
-    // If there's a line to restore, then copy the saved hl
-    // to the row's hl and deallocate the saved hl array
-    if (saved_hl) {
-        // Restore the row's hl 
-        memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
+    if (narrow || len == 0 || s->error) return;
 
-        // Free the memory and set the pointer to null
-        free(saved_hl);
-        saved_hl = NULL;
+    // The rows are split the same way for every query
+    if (s->split == NULL) editorSearchSplit();
+
+    if (s->nsplit <= 1) {
+        editorSearchScanRows(0, E.numrows, 0, INT_MAX, query, len, re, &s->list, s->gen);
+    } else {
+        editorSearchStartScan();
     }
+}
+
+// Forgets the match list once the search prompt is closed
+void editorSearchReset() {
+    struct editorSearch *s = &E.search;
+
+    editorSearchCancel();
+
+    // The buffer can be edited once the prompt is closed,
+    // so wait for the workers to stop reading its rows
+    pthread_mutex_lock(&s->lock);
+    while (s->busy > 0) pthread_cond_wait(&s->idle, &s->lock);
+
+    free(s->query);
+    s->query = NULL;
+    s->querylen = 0;
+    editorRegexRelease(s->regex);
+    s->regex = NULL;
+    pthread_mutex_unlock(&s->lock);
+
+    // The next time the prompt is opened the rows may have changed
+    free(s->split);
+    s->split = NULL;
+    s->nsplit = 0;
+
+    s->list.len = 0;
+    s->current = -1;
+    s->active = 0;
+    s->regex_mode = 0;
+    s->error = NULL;
+}
+
+// Moves the cursor to the current match
+// The matches are highlighted by editorDrawRows() as they're drawn
+void editorFindShowMatch() {
+    struct searchMatch *m = &E.search.list.matches[E.search.current];
+
+    // Move the cursor to the match
+    E.cy = m->row;
+    E.cx = m->cx;
+
+    // Scroll to the bottom of the file, so editorScroll() 
+    // will scroll up on the next refresh where the matching 
+    // line will be at the top of the screen
+    E.rowoff = E.numrows;
+}
+
+// Callback function that keeps the match list up to date with the query
+// and moves the cursor to the current match
+void editorFindCallback(char *query, int key) {
+    struct editorSearch *s = &E.search;
 
     // If the user's keypress is either enter or escape,
     // then they are attempting to leave search mode, so quit the function
-    // last_match is reset to -1 unless an arrow key was pressed 
     if (key == '\r' || key == '\x1b') {
-        last_match = -1;
-        direction = 1;
+        editorSearchReset();
         return;
-    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    } else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
-    } else {
-        last_match = -1;
-        direction = 1;
     }
 
-    // If there's no last match, we are searching forward
-    if (last_match == -1) direction = 1;
+    // The status bar shows the match count while the prompt is open
+    s->active = 1;
 
-    // Store the index of the current row we're searching
-    int current = last_match;
-    
-    int i;
-    
-    // Loop through all the rows in the file
-    for (i = 0; i < E.numrows; i++) {
-        // Move the index in the direction being searched
-        current += direction;
-
-        // If the current index is past the top of the file, set it to the end of the file
-        // If the current index is at the end of the file, reset it back to the top of the file
-        if (current == -1) current = E.numrows - 1;
-        else if (current == E.numrows) current = 0;
-
-        // Get the row
-        erow *row = &E.row[current];
-
-        // Check if the query is a substring of the current row
-        // Returns null if there's no match or a pointer to the matching
-        // substring if there's a match
-        char *match = strstr(row->render, query);
-
-        // If there's a match, move the cursor to the position
-        // where the matching substring is 
-        if (match) {
-            // Set the last match index to the current index that we searched
-            last_match = current;
-
-            // Set cursor y position to the current index we searched
-            E.cy = current;
-
-            // Set the cursor position based on the render position
-            // Subtract the render pointer from the match pointer
-            // since it's already a pointer to the render string
-            E.cx = editorRowRxToCx(row, match - row->render);
-
-            // Scroll to the bottom of the file, so editorScroll() 
-            // will scroll up on the next refresh where the matching 
-            // line will be at the top of the screen
-            E.rowoff = E.numrows;
-
-            // Set the hl line we need to save to the current 
-            saved_hl_line = current;
-
-            // Allocate memory for the saved hl array
-            // NOTE: This memory is guaranteed to be freed
-            // because when the user closes the search prompt
-            // editorPrompt() calls this function so hl will
-            // be restored before it editorPrompt() returns
-            saved_hl = malloc(row->rsize);
-
-            // Copy over the row's hl to the saved hl array
-            memcpy(saved_hl, row->hl, row->rsize);
-
-            // Set the matched substring to HL_MATCH
-            // match - row->render is the index into render of the match, 
-            // so we use that as our index into hl
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-            break;
-        }
+    // Arrow keys step through the match list, wrapping around at either end
+    // once the whole buffer was scanned
+    // Any other key may have changed the query, which starts over at the first match
+    if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        if (s->current + 1 < s->list.len) s->current++;
+        else if (!editorSearchScanning() && s->list.len) s->current = 0;
+    } else if (key == ARROW_LEFT || key == ARROW_UP) {
+        if (s->current > 0) s->current--;
+        else if (!editorSearchScanning() && s->list.len) s->current = s->list.len - 1;
+    } else {
+        editorSearchUpdate(query);
+        s->current = s->list.len ? 0 : -1;
     }
+
+    if (s->current != -1) editorFindShowMatch();
 }
 
 // Prompts the user for a search query to search in 
 // the file for the user's matching query
-void editorFind() {
+// The query is a regex if regex is set, a literal string otherwise
+void editorFind(int regex) {
     // Store the user's current cursor position
     int saved_cx = E.cx;
     int saved_cy = E.cy;
@@ -1288,7 +7216,9 @@ void editorFind() {
     int saved_rowoff = E.rowoff;
 
     // Prompt the user for a query string to search
-    char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
+    E.search.regex_mode = regex;
+    char *query = editorPrompt(regex ? "Regex: %s (Use ESC/Arrows/Enter)" : "Search: %s (Use ESC/Arrows/Enter)",
+                               editorFindCallback);
 
     // If the search isn't canceled, free the memory used 
     // by pointer pointing to the user's query input
@@ -1306,43 +7236,103 @@ void editorFind() {
 /*** append buffer ***/
 
 // Define dynamic string type
-// Consists of a pointer to our buffer in memory and a length
+// Consists of a pointer to our buffer in memory, a length
+// and the number of bytes allocated for the buffer
+// The buffer is meant to be reused, so once it has grown
+// big enough appending to it doesn't allocate
 struct abuf {
   char *b;
   int len;
+  int cap;
 };
 
-#define ABUF_INIT {NULL, 0} // Represents empty buffer, acts as a constructor to abuf
+#define ABUF_INIT {NULL, 0, 0} // Represents empty buffer, acts as a constructor to abuf
 
-// Append to string to abuf
-void abAppend(struct abuf *ab, const char *s, int len) {
-    // Allocate memory (size of current string + size of appended string) 
-    // to hold new string, realloc() will either extend size 
-    // of memory block already allocated or free current memory
-    // and allocate new memory big enough to hold new string
-    char *new = realloc(ab->b, ab->len + len);
+// Make sure there's room for len more bytes in the abuf
+// The capacity doubles each time it runs out, so a frame
+// only reallocates a handful of times until it fits
+// Returns -1 if the buffer can't grow
+int abReserve(struct abuf *ab, int len) {
+    if (ab->len + len <= ab->cap) return 0;
 
-    // If allocation fails, exit function
-    if (new == NULL) return;
+    int newcap = ab->cap ? ab->cap : 1024;
+    while (newcap < ab->len + len) newcap *= 2;
 
-    // Copy string after end of current data in buffer
-    memcpy(&new[ab->len], s, len);
+    // realloc() will either extend size of memory block already 
+    // allocated or free current memory and allocate new memory
+    // big enough to hold new string
+    char *new = realloc(ab->b, newcap);
+
+    // If allocation fails, exit function
+    if (new == NULL) return -1;
 
-    // Update pointer and length of abuf to new values
+    // Update pointer and capacity of abuf to new values
     ab->b = new;
+    ab->cap = newcap;
+    return 0;
+}
+
+// Append to string to abuf
+void abAppend(struct abuf *ab, const char *s, int len) {
+    if (abReserve(ab, len) == -1) return;
+
+    // Copy string after end of current data in buffer
+    memcpy(&ab->b[ab->len], s, len);
     ab->len += len;
 }
 
+// Append a single char to abuf
+void abAppendChar(struct abuf *ab, char c) {
+    if (ab->len == ab->cap && abReserve(ab, 1) == -1) return;
+    ab->b[ab->len++] = c;
+}
+
+// Append the decimal digits of a non-negative integer to abuf
+// Formats the number by hand to avoid going through snprintf()
+void abAppendInt(struct abuf *ab, int n) {
+    char digits[12];
+    int len = 0;
+
+    // Collect the digits from least to most significant
+    do {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0 && len < (int)sizeof(digits));
+
+    if (abReserve(ab, len) == -1) return;
+    while (len > 0) ab->b[ab->len++] = digits[--len];
+}
+
+// Append the escape sequence that moves the cursor to a 0-indexed screen position
+void abAppendCursorMove(struct abuf *ab, int y, int x) {
+    // <esc>[<row>;<col>H, where the terminal counts rows and columns from 1
+    abAppend(ab, "\x1b[", 2);
+    abAppendInt(ab, y + 1);
+    abAppendChar(ab, ';');
+    abAppendInt(ab, x + 1);
+    abAppendChar(ab, 'H');
+}
+
+// Empty the abuf, keeping its memory for the next use
+void abReset(struct abuf *ab) {
+    ab->len = 0;
+}
+
 // Destructor to deallocate memory used by abuf
 void abFree(struct abuf *ab) {
     // Deallocate to avoid memory leaks
     free(ab->b);
+    ab->b = NULL;
+    ab->len = 0;
+    ab->cap = 0;
 }
 
 /*** output ***/
 
-// Enable vertical scrolling
-void editorScroll() {
+// Moves the visible window so the cursor is inside it
+// Run after every key, since keys like page up and page down
+// move the cursor relative to the window
+void editorScrollWindow() {
     // Initialize render position
     E.rx = 0;
 
@@ -1350,7 +7340,7 @@ void editorScroll() {
     if (E.cy < E.numrows) {
         // Calculate render position using the current
         // cursor x position and the row at that y position
-        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+        E.rx = editorRowCxToRx(editorRowAt(E.cy), E.cx);
     }
 
     // Check if the cursor is above the visible window
@@ -1370,7 +7360,7 @@ void editorScroll() {
     // NOTE: rx is being used since scrolling should take into account
     // the chars that are actually rendered and rendered position of the cursor
     if (E.rx < E.coloff) {
-        E.coloff = E.cx;
+        E.coloff = E.rx;
     }
 
     // Check if the cursor is horizontally past the visible window
@@ -1378,12 +7368,242 @@ void editorScroll() {
     // NOTE: rx is being used since scrolling should take into account
     // the chars that are actually rendered and rendered position of the cursor
     if (E.rx >= E.coloff + E.screencols) {
-        E.coloff = E.cx - E.screencols + 1;
+        E.coloff = E.rx - E.screencols + 1;
+    }
+}
+
+// Enable vertical scrolling
+void editorScroll() {
+    editorScrollWindow();
+
+    // Render and highlight the rows that are about to be drawn
+    // If an edit far above the screen left more comment state to scan than fits in
+    // the budget, the rows are drawn from their cached state and drawn again
+    // once editorIdle() gets to them
+    PROFILE_BEGIN(PROF_SYNTAX);
+    editorSyntaxPropagate(E.rowoff + E.screenrows, HL_PROPAGATE_BUDGET_US);
+    int y;
+    for (y = E.rowoff; y < E.rowoff + E.screenrows && y < E.numrows; y++) {
+        editorRowMaterialize(y);
+    }
+    PROFILE_END(PROF_SYNTAX);
+}
+
+// Returns the cell at the given screen position of the frame being drawn
+struct screenCell *editorFrameCell(int y, int x) {
+    return &E.frame[y * E.screencols + x];
+}
+
+// Sets the text and attribute of a screen cell, len is at most CELL_BYTES
+void editorCellSet(struct screenCell *cell, const char *s, int len, unsigned char attr) {
+    memcpy(cell->ch, s, len);
+    memset(&cell->ch[len], 0, CELL_BYTES - len);
+    cell->attr = attr;
+}
+
+// Returns the number of bytes of text in a screen cell
+int editorCellLength(const struct screenCell *cell) {
+    int len = 0;
+    while (len < CELL_BYTES && cell->ch[len] != '\0') len++;
+    return len;
+}
+
+// Checks if two screen cells look the same
+int editorCellSame(const struct screenCell *a, const struct screenCell *b) {
+    return !memcmp(a, b, sizeof(struct screenCell));
+}
+
+// Draws a string into the frame being drawn, clipped to the width of the screen
+void editorFramePut(int y, int x, const char *s, int len, unsigned char attr) {
+    for (int j = 0; j < len && x + j < E.screencols; j++) {
+        editorCellSet(editorFrameCell(y, x + j), &s[j], 1, attr);
+    }
+}
+
+// Draws a render char of a row into a screen cell
+// *color is the text color of the last printable char before it, which is updated
+// Control chars are drawn as their letter with inverted colors, and so are
+// invalid UTF-8 bytes, as '?'
+void editorDrawChar(struct screenCell *cell, char ch, unsigned char hl, unsigned char *color) {
+    unsigned char c = ch;
+
+    // If it's a control char, translate it into a printable char
+    // Otherwise, set the text color of the char depending
+    // on the type of char it is
+    if (c < 0x20 || c >= 0x7f) {
+        // Add the ctrl char to a @ char 
+        // If it's not in the alphabetic range, replace it with a ? char
+        char sub = (c <= 26) ? '@' + c : '?';
+        editorCellSet(cell, &sub, 1, *color | ATTR_INVERSE);
+    } else {
+        // Get the corresponding color for the type of char that will be highlighted 
+        if (hl == HL_NORMAL) *color = ATTR_DEFAULT;
+        else *color = editorSyntaxToColor(hl);
+        editorCellSet(cell, &ch, 1, *color);
+    }
+}
+
+// Draws len columns of a row laid out in glyphs into a row of the screen, starting at render position from
+// render is indexed by the glyphs' render offsets, and hl holds the highlighting from render offset hlfrom on
+void editorDrawGlyphs(int y, const struct rowGlyph *g, int n, int from, int len,
+                      const char *render, const unsigned char *hl, int hlfrom) {
+    unsigned char color = ATTR_DEFAULT;
+    int x = 0;
+
+    for (int k = editorGlyphAtRx(g, n, from); k < n && x < len; k++) {
+        const struct rowGlyph *a = &g[k];
+        const struct rowGlyph *b = &g[k + 1];
+        int rx = from + x;
+
+        // A run of ASCII chars or a tab has one render char per column, drawn like an ASCII row's
+        if (b->ridx - a->ridx == b->rx - a->rx) {
+            for (; rx < b->rx && x < len; rx++, x++) {
+                int i = a->ridx + rx - a->rx;
+                editorDrawChar(editorFrameCell(y, x), render[i], hl[i - hlfrom], &color);
+            }
+            continue;
+        }
+
+        // Any other char takes the color of its first byte
+        int columns = b->rx - a->rx;
+        if (columns == 0) continue;
+        unsigned char h = hl[a->ridx - hlfrom];
+        color = h == HL_NORMAL ? ATTR_DEFAULT : editorSyntaxToColor(h);
+
+        // Only part of a wide char is on the screen at the edges, that part is left blank
+        if (rx > a->rx || x + columns > len) {
+            for (; rx < b->rx && x < len; rx++, x++) editorCellSet(editorFrameCell(y, x), " ", 1, color);
+            continue;
+        }
+
+        // A char of the C1 control range or a mark with nothing to go over can't be
+        // drawn, it's inverted like a control char. Otherwise the char and as many of
+        // the marks over it as fit in the cell are drawn, the cell for the right half
+        // of a wide char is left empty
+        int cp;
+        const char *s = &render[a->ridx];
+        int bytes = b->ridx - a->ridx;
+        int used = editorUtf8Decode(s, bytes, &cp);
+        if (cp < 0x20 || (cp >= 0x7f && cp < 0xa0) || editorInRanges(cp, ZERO_WIDTH_RANGES, sizeof(ZERO_WIDTH_RANGES) / sizeof(ZERO_WIDTH_RANGES[0]))) {
+            editorCellSet(editorFrameCell(y, x), "?", 1, color | ATTR_INVERSE);
+        } else {
+            while (used < bytes) {
+                int m = editorUtf8Decode(&s[used], bytes - used, &cp);
+                if (used + m > CELL_BYTES) break;
+                used += m;
+            }
+            editorCellSet(editorFrameCell(y, x), s, used, color);
+        }
+        if (columns == 2) editorCellSet(editorFrameCell(y, x + 1), "", 0, color);
+        x += columns;
+    }
+}
+
+// Renders and highlights len columns of a long row, starting at render position from
+// Sets *c and *hl to the render string and highlighting of those columns
+// Lexing starts at most LONG_LINE_LOOKBACK chars before the first column, so a string
+// or comment that started further back on the line isn't highlighted as one
+// A window with UTF-8 text is laid out in glyphs, then *c and *hl are the whole
+// window's, *glyphs is set to the glyphs and their number is returned
+// Otherwise *glyphs is null and 0 is returned
+int editorLongRowWindow(erow *row, int from, int len, char **c, unsigned char **hl, struct rowGlyph **glyphs) {
+    // Chars of the row to render, the ones on the screen and a margin on both sides
+    // The window starts and ends at the start of a char
+    int first = editorRowRxToCx(row, from);
+    int start = editorCharStart(row->chars, row->size, first > LONG_LINE_LOOKBACK ? first - LONG_LINE_LOOKBACK : 0);
+    int end = editorRowRxToCx(row, from + len) + LONG_LINE_MARGIN;
+    end = end > row->size ? row->size : editorUtf8Start(row->chars, row->size, end);
+
+    // Render positions of the window, tabs go to the same stops as in the whole row
+    int startrx = editorRowCxToRx(row, start);
+    int ascii = editorIsAscii(&row->chars[start], end - start);
+    int wsize = ascii ? editorRowCxToRx(row, end) - startrx
+                      : end - start + editorCountByte(&row->chars[start], end - start, '\t') * (TAB_STOP_LENGTH - 1);
+
+    if (wsize + 1 > E.winbufcap) {
+        int cap = E.winbufcap ? E.winbufcap : 4096;
+        while (cap < wsize + 1) cap *= 2;
+
+        char *new = realloc(E.winbuf, cap);
+        if (new == NULL) die("realloc");
+        E.winbuf = new;
+        E.winbufcap = cap;
+    }
+
+    // Render and lay out UTF-8 text the same way editorRenderRow() does
+    if (!ascii) {
+        int n = editorLayoutGlyphs(&row->chars[start], end - start, startrx,
+                                   editorCharAttach(row->chars, row->size, start), E.winbuf);
+        wsize = E.glyphbuf[n].ridx;
+
+        unsigned char *whl = editorHighlightScratch(wsize);
+        editorHighlightLine(E.winbuf, wsize, whl, start == 0 ? row->hl_entry : 0);
+
+        *c = E.winbuf;
+        *hl = whl;
+        *glyphs = E.glyphbuf;
+        return n;
+    }
+
+    // Render the chars the same way editorRenderRow() does
+    int idx = 0;
+    for (int j = start; j < end; j++) {
+        if (row->chars[j] == '\t') {
+            E.winbuf[idx++] = ' ';
+            while ((startrx + idx) % TAB_STOP_LENGTH != 0) E.winbuf[idx++] = ' ';
+        } else {
+            E.winbuf[idx++] = row->chars[j];
+        }
+    }
+
+    // The state at the start of the row is known, elsewhere it's taken to be plain code
+    unsigned char *whl = editorHighlightScratch(wsize);
+    editorHighlightLine(E.winbuf, wsize, whl, start == 0 ? row->hl_entry : 0);
+
+    *c = &E.winbuf[from - startrx];
+    *hl = &whl[from - startrx];
+    *glyphs = NULL;
+    return 0;
+}
+
+// Highlights the search matches on a row of the screen
+// len is the number of cells of the row that were drawn
+void editorDrawMatches(int y, int filerow, erow *row, int len) {
+    struct searchMatchList *list = &E.search.list;
+
+    // Binary search for the row's first match that ends right of the left edge of the screen
+    // The list is in file order, and the ends of a row's matches are in order too, since
+    // literal matches all have the same length and regex matches don't overlap,
+    // so a long row with a match every few chars only goes through the ones on the screen
+    int left = editorRowRxToCx(row, E.coloff);
+    int lo = 0, hi = list->len;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        struct searchMatch *m = &list->matches[mid];
+        if (m->row < filerow || (m->row == filerow && m->cx + m->len <= left)) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (int j = lo; j < list->len && list->matches[j].row == filerow; j++) {
+        struct searchMatch *m = &list->matches[j];
+
+        // Matches are positions in chars, the screen shows render
+        int from = editorRowCxToRx(row, m->cx) - E.coloff;
+        if (from >= len) break;
+        int to = editorRowCxToRx(row, m->cx + m->len) - E.coloff;
+        if (from < 0) from = 0;
+        if (to > len) to = len;
+
+        // Keep the inverted colors of control chars
+        for (int x = from; x < to; x++) {
+            struct screenCell *cell = editorFrameCell(y, x);
+            cell->attr = editorSyntaxToColor(HL_MATCH) | (cell->attr & ATTR_INVERSE);
+        }
     }
 }
 
 // Draw row of tildes (similar to vim)
-void editorDrawRows(struct abuf *ab) {
+void editorDrawRows() {
     int y;
 
     // Draw tildes based on current number of rows in terminal
@@ -1411,25 +7631,23 @@ void editorDrawRows(struct abuf *ab) {
                 // Tells how far from left edge of screen to start printing string for centering
                 int padding = (E.screencols - welcomelen) / 2;
 
-                // Fill empty left space with space chars
-                // First character should be a tilde
-                if (padding) {
-                    abAppend(ab, "~", 1);
-                    padding--;
-                }
-                while (padding--) abAppend(ab, " ", 1);
+                // The empty left space is already blank, 
+                // but the first character should be a tilde
+                if (padding) editorFramePut(y, 0, "~", 1, ATTR_DEFAULT);
 
-                // Append welcome message to abuf 
-                abAppend(ab, welcome, welcomelen);
+                // Draw welcome message after the padding
+                editorFramePut(y, padding, welcome, welcomelen, ATTR_DEFAULT);
             } else {
                 // Output tilde in the row
-                abAppend(ab, "~", 1);
+                editorFramePut(y, 0, "~", 1, ATTR_DEFAULT);
             }
         } else {
-            // Get the length (the render length specifically) of the string
+            erow *row = editorRowAt(filerow);
+
+            // Get the length (the render length in columns specifically) of the string
             // Subtract the number of characters that are to the left of 
             // offset from the length of the row
-            int len = E.row[filerow].rsize - E.coloff;
+            int len = editorRowColumns(row) - E.coloff;
 
             // len can be negative which means the user scrolled horizontally
             // past the end of the line, in that case, set len to 0 so that
@@ -1443,93 +7661,55 @@ void editorDrawRows(struct abuf *ab) {
             // Get the pointer to the render string for displaying on screen
             // To display each row at the column offset, E.coloff is used 
             // an index for the chars of each erow displayed
-            char *c = &E.row[filerow].render[E.coloff];
-
-            // Get the highlight array for the row 
-            unsigned char *hl = &E.row[filerow].hl[E.coloff];
-
-            // Keep track of the current text color as we loop through the chars
-            int current_color = -1;
-
-            // Loop through the characters in the render string 
-            int j;
-            for (j = 0; j < len; j++) {
-                // If it's a control char, translate it into a printable char
-                // Else if it's a normal char, set the text color to white
-                // Otherwise, set the text color of the char depending
-                // on the type of char it is
-                if (iscntrl(c[j])) {
-                    // Add the ctrl char to a @ char 
-                    // If it's not in the alphabetic range, replace it with
-                    // a ? char
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    
-                    // Switch to inverted colors before printing the translated
-                    // char, then turn off inverted colors again
-                    abAppend(ab, "\x1b[7m", 4);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, "\x1b[m", 3);
-
-                    // The <esc>[m  turns off all text formatting including colors
-                    // Print the esc sequence for the current color afterwards
-                    if (current_color != -1) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        abAppend(ab, buf, clen);
-                    }
-                } else if (hl[j] == HL_NORMAL) {
-                    if (current_color != -1) {
-                        // m command inverts colors
-                        // Set the text color back to default white (9 = white)
-                        abAppend(ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-
-                    // Append the char
-                    abAppend(ab, &c[j], 1);
-                } else {
-                    // Get the corresponding integer for the type of char
-                    // that will be highlighted 
-                    int color = editorSyntaxToColor(hl[j]);
-
-                    if (color != current_color) {
-                        // Set the current color to the intended 
-                        // color that the char will be highlighted
-                        current_color = color;
-
-                        // Write the escape sequence into a buffer
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+            // Get the highlight array for the visible part of the row 
+            // Only the chars that are drawn get their runs expanded
+            char *c = NULL;
+            unsigned char *hl = NULL;
+            // Rows with UTF-8 text have glyphs, and so does the window of a long row with it
+            struct rowGlyph *g = NULL;
+            int n = 0;
+            int hlfrom = 0;
+            if (len > 0 && (row->flags & ROW_LONG)) {
+                // Long rows are rendered and highlighted just for the screen
+                n = editorLongRowWindow(row, E.coloff, len, &c, &hl, &g);
+            } else if (len > 0 && row->glyphs != NULL) {
+                // Only expand the highlighting from the start of the glyph at the
+                // left edge of the screen to the end of the one at the right edge
+                g = row->glyphs->g;
+                n = row->glyphs->n;
+                hlfrom = g[editorGlyphAtRx(g, n, E.coloff)].ridx;
+                int hlto = g[editorGlyphAtRx(g, n, E.coloff + len - 1) + 1].ridx;
+                c = row->render;
+                hl = editorHighlightExpand(row, hlfrom, hlto - hlfrom);
+            } else if (len > 0) {
+                c = &row->render[E.coloff];
+                hl = editorHighlightExpand(row, E.coloff, len);
+            }
 
-                        // Append the color code escape sequence buffer
-                        abAppend(ab, buf, clen);
-                    }
+            if (g != NULL) {
+                editorDrawGlyphs(y, g, n, E.coloff, len, c, hl, hlfrom);
+            } else {
+                // Keep track of the current text color as we loop through the chars
+                unsigned char current_color = ATTR_DEFAULT;
 
-                    // Append the char
-                    abAppend(ab, &c[j], 1);
+                // Loop through the characters in the render string,
+                // each of them takes up one column
+                for (int j = 0; j < len; j++) {
+                    editorDrawChar(editorFrameCell(y, j), c[j], hl[j], &current_color);
                 }
             }
 
-            // Reset the text color of the characters
-            abAppend(ab, "\x1b[39m", 5);
+            // Paint the search matches over the syntax colors
+            if (E.search.active) editorDrawMatches(y, filerow, row, len);
         }
-
-        // Clear each line as they're redrawn instead 
-        // of clearing entire screen before each refresh
-        // Put <esc>[K sequence at the end of each line we draw
-        abAppend(ab, "\x1b[K", 3);
-
-        // Print newline as last line after last row
-        // since status bar is the final line drawn on screen
-        abAppend(ab, "\r\n", 2);
     }
 }
 
 // Display the status bar with inverted colors on the screen
-void editorDrawStatusBar(struct abuf *ab) {
-    // <esc>[7m switches to inverted colors
-    abAppend(ab, "\x1b[7m", 4);
-    
+void editorDrawStatusBar() {
+    // The status bar is the second to last line of the screen
+    int y = E.screenrows;
+
     // Declare buffer for file and line status message 
     char status[80], rstatus[80];
 
@@ -1540,49 +7720,60 @@ void editorDrawStatusBar(struct abuf *ab) {
     // If the dirty flag is not 0 after the file is modified, then we show "(modified)"
     // The 'snprintf' function ensures that the status message doesn't exceed 
     // the size of the status buffer, truncating the filename to 20 characters if needed
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", 
+    // With several buffers open, the status starts with "[<buffer>/<buffers>]"
+    // A followed file gets "(following)" after that
+    int len = 0;
+    if (E.numbuffers > 1) len = snprintf(status, sizeof(status), "[%d/%d] ", E.curbuffer + 1, E.numbuffers);
+    len += snprintf(&status[len], sizeof(status) - len, "%.20s - %d lines %s%s", 
         E.filename ? E.filename : "[No Name]", E.numrows, 
-        E.dirty ? "(modified)" : "");
+        E.view ? "(read-only)" : E.dirty ? "(modified)" : "",
+        !E.follow ? "" : E.view || E.dirty ? " (following)" : "(following)");
 
     // Create a formatted line status message and store it in the buffer
     // The status message includes the current line number and number of rows
     // Formatted at "<filetype> | <current line>/<numrows>"
     // Current line stored in cy and we add 1 since cy is 0-indexed
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
+    // While searching, the position of the current match among all of them is shown instead
+    // A + after the count means the background scan hasn't finished yet
+    // A query that isn't a valid regex gets the reason shown instead
+    int rlen;
+    if (E.search.active && E.search.error) {
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s", E.search.error);
+    } else if (E.search.active && E.search.querylen > 0) {
+        rlen = snprintf(rstatus, sizeof(rstatus), "%d of %d%s matches", E.search.current + 1,
+            E.search.list.len, editorSearchScanning() ? "+" : "");
+    } else {
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
+    }
 
     // If the length of the status doesn't fit inside 
     // the width of the window, cut the string short for fit
     if (len > E.screencols) len = E.screencols;
 
-    // Append the file status message
-    abAppend(ab, status, len);
-    
     // Draw blank white status bar of inverted space characters
-    while (len < E.screencols) {
-        // If the line status string is against the right edge of the screen
-        // stop printing spaces and append the second status message
-        // Otherwise, print a space
-        if (E.screencols - len == rlen) {
-            abAppend(ab, rstatus, rlen);
-            break;
-        } else {
-            abAppend(ab, " ", 1);
-            len++;
-        }
+    int x;
+    for (x = 0; x < E.screencols; x++) {
+        editorFramePut(y, x, " ", 1, ATTR_DEFAULT | ATTR_INVERSE);
     }
 
-    // <esc>[m switches back to normal formatting
-    abAppend(ab, "\x1b[m", 3);
+    // Draw the file status message
+    editorFramePut(y, 0, status, len, ATTR_DEFAULT | ATTR_INVERSE);
 
-    // Print new line after the first status bar 
-    // to allow space for the second status message
-    abAppend(ab, "\r\n", 2);
+    // If the line status string fits, put it against the right edge of the screen
+    if (E.screencols - len >= rlen) {
+        editorFramePut(y, E.screencols - rlen, rstatus, rlen, ATTR_DEFAULT | ATTR_INVERSE);
+    }
 }
 
 // Displays the status message
-void editorDrawMessageBar(struct abuf *ab) {
-    // Clear the message bar with <esc>[K sequence
-    abAppend(ab, "\x1b[K", 3);
+void editorDrawMessageBar() {
+#ifdef EDITOR_PROFILE
+    // The stage latencies take the place of the status message while they're shown
+    if (E.profile.overlay) {
+        editorProfileDrawOverlay();
+        return;
+    }
+#endif
 
     // Get the length of the status message
     int msglen = strlen(E.statusmsg);
@@ -1592,58 +7783,197 @@ void editorDrawMessageBar(struct abuf *ab) {
     if (msglen > E.screencols) msglen = E.screencols;
 
     // Display the status message only if the message
-    // is less than 5 seconds old
-    if (msglen && time(NULL) - E.statusmsg_time < 5)
-        abAppend(ab, E.statusmsg, msglen);
+    // is less than STATUS_MSG_SECS seconds old
+    if (msglen && editorMonotonicUs() - E.statusmsg_time < STATUS_MSG_SECS * 1000000LL)
+        editorFramePut(E.screenrows + 1, 0, E.statusmsg, msglen, ATTR_DEFAULT);
+}
+
+// Appends the escape sequence that switches the terminal from one cell attribute to another
+void editorAppendAttr(struct abuf *ab, unsigned char from, unsigned char to) {
+    // Only the parts of the attribute that changed are sent
+    abAppend(ab, "\x1b[", 2);
+    if ((from ^ to) & ATTR_INVERSE) {
+        if (to & ATTR_INVERSE) abAppendChar(ab, '7');
+        else abAppend(ab, "27", 2);
+        if ((from ^ to) & ATTR_COLOR_MASK) abAppendChar(ab, ';');
+    }
+    if ((from ^ to) & ATTR_COLOR_MASK) abAppendInt(ab, to & ATTR_COLOR_MASK);
+    abAppendChar(ab, 'm');
+}
+
+// Appends the cells of the frame that differ from what the terminal
+// already shows, which is kept in the shadow frame
+// Changed cells close to each other are sent as one run, each run starts
+// with a cursor move, and attributes are only sent when they change
+void editorFlushFrame(struct abuf *ab) {
+    // Attribute the terminal is currently drawing with
+    // Every frame leaves the terminal with the default attribute
+    unsigned char attr = ATTR_DEFAULT;
+
+    int y;
+    for (y = 0; y < E.screenrows + 2; y++) {
+        struct screenCell *cur = editorFrameCell(y, 0);
+        struct screenCell *old = &E.shadow[y * E.screencols];
+
+        // Skip rows that didn't change since the last frame
+        if (E.shadow_valid && !memcmp(cur, old, sizeof(struct screenCell) * E.screencols))
+            continue;
+
+        // Find where the trailing blank cells of the row start,
+        // those are cleared with a single <esc>[K
+        int blank = E.screencols;
+        while (blank > 0 && cur[blank - 1].ch[0] == ' ' && cur[blank - 1].ch[1] == '\0' &&
+               cur[blank - 1].attr == ATTR_DEFAULT)
+            blank--;
+
+        int x = 0;
+        while (x < E.screencols) {
+            // Find the next changed cell
+            if (E.shadow_valid && editorCellSame(&cur[x], &old[x])) {
+                x++;
+                continue;
+            }
+
+            // Extend the run until a stretch of unchanged cells too
+            // long to be worth sending instead of another cursor move
+            int end = x + 1;
+            int same = 0;
+            while (end < E.screencols && same < FRAME_RUN_GAP) {
+                if (E.shadow_valid && editorCellSame(&cur[end], &old[end])) same++;
+                else same = 0;
+                end++;
+            }
+            end -= same;
+
+            abAppendCursorMove(ab, y, x);
+
+            // Send the cells of the run, the blank cells at the end
+            // of the row are cleared instead of drawn
+            int stop = (end > blank) ? blank : end;
+            for (; x < stop; x++) {
+                if (cur[x].attr != attr) {
+                    editorAppendAttr(ab, attr, cur[x].attr);
+                    attr = cur[x].attr;
+                }
+                // The cell after a wide char is empty, the terminal already moved past it
+                abAppend(ab, cur[x].ch, editorCellLength(&cur[x]));
+            }
+
+            if (end > blank) {
+                // <esc>[K clears with the current attribute, so switch back to the default
+                if (attr != ATTR_DEFAULT) {
+                    editorAppendAttr(ab, attr, ATTR_DEFAULT);
+                    attr = ATTR_DEFAULT;
+                }
+                abAppend(ab, "\x1b[K", 3);
+                break;
+            }
+
+            x = end;
+        }
+    }
+
+    // Leave the terminal with the default attribute
+    if (attr != ATTR_DEFAULT) editorAppendAttr(ab, attr, ATTR_DEFAULT);
+
+    // The terminal now shows this frame, so it becomes the shadow frame
+    // and the old shadow frame is reused to draw the next one
+    struct screenCell *tmp = E.shadow;
+    E.shadow = E.frame;
+    E.frame = tmp;
+    E.shadow_valid = 1;
+}
+
+// Allocates the frame buffers for the current screen size
+// The shadow frame starts out invalid so the first frame is sent in full
+void editorAllocFrame() {
+    size_t cells = (size_t)(E.screenrows + 2) * E.screencols;
+
+    free(E.frame);
+    free(E.shadow);
+    E.frame = malloc(sizeof(struct screenCell) * cells);
+    E.shadow = malloc(sizeof(struct screenCell) * cells);
+    if (E.frame == NULL || E.shadow == NULL) die("malloc");
+
+    E.shadow_valid = 0;
+}
+
+// Lays out the screen again for the new size of the terminal
+// Called when TIMER_RESIZE goes off once a burst of SIGWINCH is over
+// Only the frame buffers depend on the size, so the rows keep their
+// render and highlighting and the next frame is just sent in full
+// Returns 1 if the size changed and the screen has to be drawn again
+int editorResize() {
+    // A terminal that sends SIGWINCH reports its size, so there's
+    // no need for the slow cursor position fallback of getWindowSize()
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0 || ws.ws_row == 0) return 0;
+
+    // Keep room for at least one row of text above the status bar and the message bar
+    int rows = ws.ws_row > 2 ? ws.ws_row - 2 : 1;
+    int cols = ws.ws_col;
+    if (rows == E.screenrows && cols == E.screencols) return 0;
+
+    E.screenrows = rows;
+    E.screencols = cols;
+    editorAllocFrame();
+
+    return 1;
 }
 
-// Clear screen and reposition cursor for rendering 
-// editor UI after each keypress
+// Draws the editor UI into a frame and sends the
+// parts of it that changed to the terminal after each keypress
 void editorRefreshScreen() {
-    editorScroll();
+    PROFILE_BEGIN(PROF_FRAME);
 
-    // Initialize new abuf
-    struct abuf ab = ABUF_INIT;
+    // A truncated file that's viewed can't have its rows read anymore,
+    // neither can the rows of a mapped file another program changed
+    editorFollowTruncated();
+    editorMapChanged();
+    editorScroll();
 
-    // Hide cursor before refreshing the screen
-    abAppend(&ab, "\x1b[?25l", 6);
+    if (E.frame == NULL) editorAllocFrame();
 
-    // Write 3 bytes out to terminal
-    // Byte 1 is \x1b (escape char) and other 2 bytes 
-    // are [H (arg for repositioning cursor at row 1 column 1)
-    abAppend(&ab, "\x1b[H", 3);
+    // Start from a blank frame
+    size_t cells = (size_t)(E.screenrows + 2) * E.screencols;
+    for (size_t j = 0; j < cells; j++) editorCellSet(&E.frame[j], " ", 1, ATTR_DEFAULT);
 
-    // Draw tilde row buffer
-    editorDrawRows(&ab);
+    // Draw tilde rows
+    PROFILE_BEGIN(PROF_DRAW);
+    editorDrawRows();
+    PROFILE_END(PROF_DRAW);
 
     // Draw the status bar on the second to last line of the screen
-    editorDrawStatusBar(&ab);
+    editorDrawStatusBar();
 
     // Draw the status message on the last line of the screen
-    editorDrawMessageBar(&ab);
+    editorDrawMessageBar();
 
-    // Declare buffer to store formatted string
-    char buf[32];
+    // The abuf is kept between frames, so once it's
+    // big enough for a frame drawing doesn't allocate
+    static struct abuf ab = ABUF_INIT;
+    abReset(&ab);
+
+    // Hide cursor before refreshing the screen
+    abAppend(&ab, "\x1b[?25l", 6);
+
+    // Append the changed parts of the frame
+    editorFlushFrame(&ab);
 
-    // Specify exact position we want cursor 
-    // to move to and store it in the buffer
-    // Add 1 to x and y position to convert 0 index values to 
-    // 1 index values that the terminal uses
+    // Move the cursor to its position on screen
     // NOTE: rx is being used since scrolling should take into account
     // the chars that are actually rendered and rendered position of the cursor
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
-
-    // Append formatted string to abuf
-    abAppend(&ab, buf, strlen(buf));
+    abAppendCursorMove(&ab, E.cy - E.rowoff, E.rx - E.coloff);
 
     // Show cursor after refresh
     abAppend(&ab, "\x1b[?25h", 6);
 
     // Write buffer's contents to standard output
+    PROFILE_BEGIN(PROF_WRITE);
     write(STDOUT_FILENO, ab.b, ab.len);
+    PROFILE_END(PROF_WRITE);
 
-    // Free memory used by the abuf
-    abFree(&ab);
+    PROFILE_END(PROF_FRAME);
 }
 
 // Variadic function that stores the status message 
@@ -1662,9 +7992,109 @@ void editorSetStatusMessage(const char *fmt, ...) {
     va_end(ap);
 
     // Set to the current time when the status message was stored
-    E.statusmsg_time = time(NULL);
+    // and have the message bar drawn again once it's expired
+    E.statusmsg_time = editorMonotonicUs();
+    editorTimerArm(TIMER_STATUS, E.statusmsg_time + STATUS_MSG_SECS * 1000000LL);
+}
+
+/*** profiling ***/
+
+#ifdef EDITOR_PROFILE
+
+// Short names of the stages, in enum profileStage order
+const char *PROFILE_STAGE_NAMES[PROF_STAGES] = { "read", "key", "syntax", "draw", "write", "frame" };
+
+// Returns the histogram bucket of a time in nanoseconds
+// Times under 4ns get a bucket each, after that every power of two is split in four
+int editorProfileBucket(long long ns) {
+    if (ns < 4) return ns < 0 ? 0 : (int) ns;
+
+    int msb = 63 - __builtin_clzll((unsigned long long) ns);
+    int b = msb * 4 + (int) ((ns >> (msb - 2)) & 3) - 4;
+    return b < PROFILE_BUCKETS ? b : PROFILE_BUCKETS - 1;
+}
+
+// Returns the largest time in nanoseconds that falls into a bucket
+long long editorProfileBucketTop(int b) {
+    if (b < 4) return b;
+
+    int msb = b / 4 + 1;
+    return ((long long) (4 + b % 4 + 1) << (msb - 2)) - 1;
+}
+
+// Adds the time a stage took to its histogram
+void editorProfileRecord(int stage, long long ns) {
+    struct profileHist *h = &E.profile.stage[stage];
+
+    h->last = ns;
+    h->count++;
+    h->total += ns;
+    if (ns > h->max) h->max = ns;
+    h->buckets[editorProfileBucket(ns)]++;
+}
+
+// Returns the time in nanoseconds that the given percentage of a stage's times are at or below
+// Buckets are a quarter of a power of two wide, so this is within 25% of the exact value
+long long editorProfilePercentile(struct profileHist *h, int percent) {
+    if (h->count == 0) return 0;
+
+    long long want = (h->count * percent + 99) / 100;
+    long long seen = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= want) {
+            long long top = editorProfileBucketTop(b);
+            return top < h->max ? top : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+// Draws the latest and the p99 time of each stage, in microseconds, into the message bar
+void editorProfileDrawOverlay() {
+    char buf[160];
+    int len = snprintf(buf, sizeof(buf), "us last/p99:");
+
+    for (int s = 0; s < PROF_STAGES && len < (int) sizeof(buf); s++) {
+        struct profileHist *h = &E.profile.stage[s];
+        len += snprintf(&buf[len], sizeof(buf) - len, " %s %lld/%lld", PROFILE_STAGE_NAMES[s],
+                        h->last / 1000, editorProfilePercentile(h, 99) / 1000);
+    }
+
+    if (len > E.screencols) len = E.screencols;
+    editorFramePut(E.screenrows + 1, 0, buf, len, ATTR_DEFAULT | ATTR_INVERSE);
+}
+
+// Writes the histograms of every stage to PROFILE_DUMP_FILE
+// Each stage gets a summary line followed by its nonempty buckets
+void editorProfileDump() {
+    FILE *fp = fopen(PROFILE_DUMP_FILE, "w");
+    if (fp == NULL) {
+        editorSetStatusMessage("Can't write profile! I/O error: %s", strerror(errno));
+        return;
+    }
+
+    for (int s = 0; s < PROF_STAGES; s++) {
+        struct profileHist *h = &E.profile.stage[s];
+        fprintf(fp, "%s count %lld mean_ns %lld max_ns %lld last_ns %lld p50_ns %lld p90_ns %lld p99_ns %lld\n",
+                PROFILE_STAGE_NAMES[s], h->count, h->count ? h->total / h->count : 0, h->max, h->last,
+                editorProfilePercentile(h, 50), editorProfilePercentile(h, 90), editorProfilePercentile(h, 99));
+
+        // Buckets as the range of nanoseconds they hold and how many times fell into them
+        for (int b = 0; b < PROFILE_BUCKETS; b++) {
+            if (h->buckets[b] == 0) continue;
+            long long low = b == 0 ? 0 : editorProfileBucketTop(b - 1) + 1;
+            fprintf(fp, "  %lld-%lld %lld\n", low, editorProfileBucketTop(b), h->buckets[b]);
+        }
+    }
+
+    fclose(fp);
+    editorSetStatusMessage("Profile written to %s", PROFILE_DUMP_FILE);
 }
 
+#endif
+
 /*** input ***/
 
 // Displays a prompt in the status bar and let
@@ -1729,7 +8159,20 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
                 if (callback) callback(buf, c);
                 return buf;
             }
-        } else if (!iscntrl(c) && c < 128) {
+        } else if (c == PASTE_KEY) {
+            // Append the pasted text up to its first line break,
+            // skipping chars that can't be typed into the prompt
+            for (size_t j = 0; j < E.pastelen && E.paste[j] != '\r' && E.paste[j] != '\n'; j++) {
+                if (iscntrl(E.paste[j]) || (unsigned char)E.paste[j] >= 128) continue;
+
+                if (buflen == bufsize - 1) {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = E.paste[j];
+            }
+            buf[buflen] = '\0';
+        } else if (c < 128 && !iscntrl(c)) {
             if (buflen == bufsize - 1) {
                 bufsize *= 2;
                 buf = realloc(buf, bufsize);
@@ -1754,19 +8197,20 @@ void editorMoveCursor(int key) {
     // Since cursor y position is allowed to be one past the last
     // line of the file, check if the cursor is on an actual line
     // If it is, then row will point to the erow that the cursor is on
-    erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    erow *row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy);
 
     switch (key) {
         case ARROW_LEFT:
-            // Decrement x position if it isn't 0
+            // Move to the start of the char to the left if x position isn't 0,
+            // a UTF-8 char and the combining marks over it are passed over as one
             // Check if the cursor isn't on the first line, if it isn't,
             // then allow the cursor to move to the end of the previous line
             // if it is at the beginning of the current line
             if (E.cx != 0) {
-                E.cx--;
+                E.cx = editorCharStart(row->chars, row->size, E.cx - 1);
             } else if (E.cy > 0) {
                 E.cy--;
-                E.cx = E.row[E.cy].size;
+                E.cx = editorRowAt(E.cy)->size;
             }
             break;
         case ARROW_RIGHT:
@@ -1777,7 +8221,7 @@ void editorMoveCursor(int key) {
             // (not end of the file), if it is, then allow
             // the cursor go to the start of the next line
             if (row && E.cx < row->size) {
-                E.cx++;
+                E.cx = editorCharNext(row->chars, row->size, E.cx);
             } else if (row && E.cx == row->size) {
                 E.cy++;
                 E.cx = 0;
@@ -1801,17 +8245,65 @@ void editorMoveCursor(int key) {
     // line of the file, check if the cursor is on an actual line
     // If it is, then row will point to the erow that the cursor is on
     // Setting row again since y position could point to a different line than before
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy);
 
     // If row is null, then we consider it to be length 0
     // Otherwise, set length to the current size of the row
     int rowlen = row ? row->size : 0;
 
-    // Set cursor x position to the end of the line
-    // if it is to the right of the end of the line
-    if (E.cx > rowlen) {
-        E.cx = rowlen;
+    // Set cursor x position to the end of the line
+    // if it is to the right of the end of the line
+    // Otherwise make sure it's at the start of a char, moving to a line
+    // with UTF-8 text could have put it in the middle of one
+    if (E.cx > rowlen) {
+        E.cx = rowlen;
+    } else if (row) {
+        E.cx = editorCharStart(row->chars, row->size, E.cx);
+    }
+}
+
+// Moves the cursor to a line, or to a byte offset of the file given as @<offset>
+// A file opened with -R finds the line through its line index,
+// so jumping anywhere in a large file doesn't walk the lines before it
+void editorGoto() {
+    char *input = editorPrompt("Go to line or @offset: %s (ESC to cancel)", NULL);
+    if (input == NULL) return;
+
+    int offset = input[0] == '@';
+    char *end;
+    long long n = strtoll(&input[offset], &end, 10);
+    if (end == &input[offset] || *end != '\0' || n < (offset ? 0 : 1)) {
+        editorSetStatusMessage("Not a line number or offset: %s", input);
+        free(input);
+        return;
+    }
+    free(input);
+
+    if (E.numrows == 0) return;
+
+    int y = 0;
+    long long x = 0;
+    if (!offset) {
+        y = n > E.numrows ? E.numrows - 1 : n - 1;
+    } else if (E.view != NULL) {
+        y = editorViewLineAt(E.view, n);
+        x = n - (editorRowAt(y)->chars - E.view->map);
+    } else {
+        // The rows of a file being edited are walked, each followed by a line break
+        while (y < E.numrows - 1 && n > editorRowAt(y)->size) {
+            n -= editorRowAt(y)->size + 1;
+            y++;
+        }
+        x = n;
     }
+
+    // An offset in a line break or past the end goes to the end of the line
+    int size = editorRowAt(y)->size;
+    E.cy = y;
+    E.cx = x > size ? size : x;
+
+    // Scroll to the bottom so editorScroll() puts the line at the top of the screen
+    E.rowoff = E.numrows;
 }
 
 // Map keypresses to editor operations
@@ -1820,24 +8312,60 @@ void editorProcessKeypress() {
     // the user to Ctrl-Q 3 more times
     static int quit_times = CONFIRM_QUIT_TIMES;
 
+    // Closing a buffer with unsaved changes takes a second Ctrl-W
+    static int close_confirmed = 0;
+
     // Get returned keypress
     int c = editorReadKey();
+    PROFILE_BEGIN(PROF_KEY);
+
+    // The wait for the key may have been long enough for a viewed file to be truncated,
+    // or for a mapped file to be changed
+    editorFollowTruncated();
+    editorMapChanged();
 
     switch (c) {
         // Enter key inserts a new line
         case '\r':
+            editorUndoSeal();
             editorInsertNewline();
             break;
 
+        // Insert pasted text all at once
+        case PASTE_KEY:
+            editorUndoSeal();
+            editorInsertText(E.paste, E.pastelen);
+            break;
+
+        // Undo and redo the last group of edits
+        case CTRL_KEY('z'):
+            editorUndo();
+            break;
+
+        case CTRL_KEY('y'):
+            editorRedo();
+            break;
+
         // Exit program, clear screen, and reset cursor position
         // If quitting with unsaved changes, then the user will need to 
         // Ctrl-Q 3 more times to fully exit the editor
         case CTRL_KEY('q'):
-            if (E.dirty && quit_times > 0) {
-                editorSetStatusMessage("WARNING!!! File has unsaved changes. "
-                    "Press Ctrl-Q %d more times to quit.", quit_times);
-                quit_times--;
-                return;
+            {
+                // A save still being written has to reach the disk first
+                editorSaveWait();
+
+                int dirty = editorBuffersDirty();
+                if (dirty && quit_times > 0) {
+                    if (dirty == 1) {
+                        editorSetStatusMessage("WARNING!!! File has unsaved changes. "
+                            "Press Ctrl-Q %d more times to quit.", quit_times);
+                    } else {
+                        editorSetStatusMessage("WARNING!!! %d files have unsaved changes. "
+                            "Press Ctrl-Q %d more times to quit.", dirty, quit_times);
+                    }
+                    quit_times--;
+                    return;
+                }
             }
 
             write(STDOUT_FILENO, "\x1b[2J", 4);
@@ -1850,21 +8378,78 @@ void editorProcessKeypress() {
             editorSave();
             break;
 
+        // Open a file in a new buffer
+        case CTRL_KEY('e'):
+            {
+                char *filename = editorPrompt("Open: %s (ESC to cancel)", NULL);
+                if (filename == NULL) break;
+
+                // A file that can't be read gets a message rather than ending the editor
+                if (access(filename, R_OK) == -1) {
+                    editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+                } else {
+                    editorBufferOpen(filename, E.view != NULL);
+                }
+                free(filename);
+            }
+            break;
+
+        // Switch to the next buffer
+        case CTRL_KEY('n'):
+            editorBufferSwitch((E.curbuffer + 1) % E.numbuffers);
+            break;
+
+        // Close the buffer, asking again if it has unsaved changes
+        case CTRL_KEY('w'):
+            if (E.dirty && !close_confirmed && E.numbuffers > 1) {
+                editorSetStatusMessage("WARNING!!! File has unsaved changes. "
+                    "Press Ctrl-W again to close it.");
+                close_confirmed = 1;
+                return;
+            }
+            editorBufferClose();
+            break;
+
         // TEMPORARY: Move cursor to left edge of screen
         case HOME_KEY:
+            editorUndoSeal();
             E.cx = 0;
             break;
         
         // Move the cursor to the end of the current line
         // If there's no current line then the cursor x position is 0
         case END_KEY:
+            editorUndoSeal();
             if (E.cy < E.numrows)
-                E.cx = E.row[E.cy].size;
+                E.cx = editorRowAt(E.cy)->size;
+            break;
+
+        // Start or stop following the file as it grows
+        case CTRL_KEY('t'):
+            if (E.follow == NULL) {
+                editorFollowStart();
+            } else {
+                editorFollowStop();
+                editorSetStatusMessage("Stopped following %s", E.filename);
+            }
+            break;
+
+        // Jump to a line or a byte offset
+        case CTRL_KEY('g'):
+            editorUndoSeal();
+            editorGoto();
             break;
 
         // Enables user to search within the file
         case CTRL_KEY('f'):
-            editorFind();
+            editorUndoSeal();
+            editorFind(0);
+            break;
+
+        // Enables user to search within the file with a regex
+        case CTRL_KEY('r'):
+            editorUndoSeal();
+            editorFind(1);
             break;
         
         // Delete a character left of the cursor
@@ -1882,6 +8467,8 @@ void editorProcessKeypress() {
         case PAGE_UP:
         case PAGE_DOWN:
             {
+                editorUndoSeal();
+
                 if (c == PAGE_UP) {
                     // Position the cursor top of the screen
                     E.cy = E.rowoff;
@@ -1904,9 +8491,22 @@ void editorProcessKeypress() {
         case ARROW_DOWN:
         case ARROW_LEFT:
         case ARROW_RIGHT:
+            editorUndoSeal();
             editorMoveCursor(c);
             break;
         
+#ifdef EDITOR_PROFILE
+        // Show or hide the stage latencies in the message bar
+        case CTRL_KEY('p'):
+            E.profile.overlay = !E.profile.overlay;
+            break;
+
+        // Write the stage latencies to a file
+        case CTRL_KEY('o'):
+            editorProfileDump();
+            break;
+#endif
+
         // Ignore the CTRL-L and Esc keypresses
         case CTRL_KEY('l'):
         case '\x1b':
@@ -1919,28 +8519,110 @@ void editorProcessKeypress() {
             break;
     }
 
-    // Reset the quit counter
+    // Reset the quit counter and the close confirmation
     quit_times = CONFIRM_QUIT_TIMES;
+    close_confirmed = 0;
+
+    // Get a backup of the edits going
+    if (E.dirty != E.autosaved && E.timers[TIMER_AUTOSAVE] == 0) editorAutosaveSchedule();
+
+    // The search prompts wait for the user, so their time isn't counted
+    if (c != CTRL_KEY('f') && c != CTRL_KEY('r')) PROFILE_END(PROF_KEY);
 }
 
 /*** init ***/
 
 // Initialize all fields in global struct
 void initEditor() {
-    E.cx = 0;
-    E.cy = 0;
-    E.rx = 0;
-    E.rowoff = 0;
-    E.coloff = 0;
-    E.numrows = 0;
-    E.row = NULL;
-    E.dirty = 0;
-    E.filename = NULL; // Will stay null if no file is opened
+    // The editor starts out with a single empty buffer
+    E.lastid = 0;
+    editorBufferInit();
+    E.buffers = malloc(sizeof(struct editorBuffer));
+    if (E.buffers == NULL) die("malloc");
+    E.numbuffers = 1;
+    E.curbuffer = 0;
+
+    // Nothing is being saved or backed up yet
+    E.save = NULL;
+    E.savenotify[0] = -1;
+    E.savenotify[1] = -1;
+
+    // umask() can only be read by changing it, which is done here before any
+    // thread runs, the save thread would change it for the whole process
+    E.umask = umask(0);
+    umask(E.umask);
+
+    // No timer is armed
+    memset(E.timers, 0, sizeof(E.timers));
+
+    // Signals aren't caught until editorSignalsInit()
+    E.sigpipe[0] = -1;
+    E.sigpipe[1] = -1;
+
+    // The inotify instance is created when the first file is followed
+    E.inotify = -1;
+
+    // Only the built-in filetypes until editorSyntaxLoadAll()
+    E.syntaxes = NULL;
+    E.nsyntaxes = 0;
+
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    E.syntax = NULL;
-    
+    E.frame = NULL;
+    E.shadow = NULL;
+    E.shadow_valid = 0;
+    E.inlen = 0;
+    E.inpos = 0;
+    E.paste = NULL;
+    E.pastelen = 0;
+    E.pastecap = 0;
+
+    // No search until the search prompt is opened
+    E.search.query = NULL;
+    E.search.querylen = 0;
+    E.search.list.matches = NULL;
+    E.search.list.len = 0;
+    E.search.list.cap = 0;
+    E.search.current = -1;
+    E.search.active = 0;
+    E.search.regex_mode = 0;
+    E.search.regex = NULL;
+    E.search.error = NULL;
+    E.search.chunks = NULL;
+    E.search.nchunks = 0;
+    E.search.nextchunk = 0;
+    E.search.merged = 0;
+    E.search.split = NULL;
+    E.search.nsplit = 0;
+    E.search.gen = 0;
+    E.search.busy = 0;
+    E.search.nthreads = 0;
+    pthread_mutex_init(&E.search.lock, NULL);
+    pthread_cond_init(&E.search.work, NULL);
+    pthread_cond_init(&E.search.idle, NULL);
+
+    // Pick the kernels for this CPU
+    editorKernelsInit();
+
+    // Row memory pool starts out empty
+    memset(&E.pool, 0, sizeof(E.pool));
+    E.hlbuf = NULL;
+    E.hlbufcap = 0;
+    E.winbuf = NULL;
+    E.winbufcap = 0;
+
+#ifdef EDITOR_PROFILE
+    // No stage has been timed yet
+    memset(&E.profile, 0, sizeof(E.profile));
+#endif
+
+#ifdef EDITOR_BENCH
+    // The benchmark has no terminal to ask, it draws into a screen of a fixed size
+    E.screenrows = BENCH_SCREEN_ROWS;
+    E.screencols = BENCH_SCREEN_COLS;
+#else
     if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
+#endif
     
     // Decrement by 2 so editorDrawRows() doesn’t try to draw a line of 
     // text at the bottom of the screen and to allow space for the 
@@ -1948,21 +8630,814 @@ void initEditor() {
     E.screenrows -= 2;
 }
 
+/*** benchmark ***/
+
+#ifdef EDITOR_BENCH
+
+// Latencies of the operations of one benchmark step
+struct benchStat {
+    long long *ns;
+    int n;
+    int cap;
+};
+
+// Where the results are printed, the editor's own output goes to /dev/null
+FILE *bench_report;
+
+// Set by --json, prints one JSON object per step instead of a table
+int bench_json;
+
+// Records the latency of one operation that started at t0
+void editorBenchRecord(struct benchStat *st, long long t0) {
+    long long t = editorMonotonicNs() - t0;
+
+    if (st->n == st->cap) {
+        st->cap = st->cap ? st->cap * 2 : 256;
+        st->ns = realloc(st->ns, sizeof(long long) * st->cap);
+        if (st->ns == NULL) die("realloc");
+    }
+    st->ns[st->n++] = t;
+}
+
+// Orders latencies for qsort()
+int editorBenchCompare(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+// Prints the throughput and latency percentiles of a step and forgets its latencies
+void editorBenchReport(const char *corpus, const char *step, struct benchStat *st) {
+    if (st->n == 0) return;
+
+    long long total = 0;
+    for (int j = 0; j < st->n; j++) total += st->ns[j];
+    qsort(st->ns, st->n, sizeof(long long), editorBenchCompare);
+
+    double p50 = st->ns[(st->n - 1) / 2] / 1000.0;
+    double p99 = st->ns[(st->n - 1) * 99 / 100] / 1000.0;
+    double opsps = total > 0 ? st->n * 1e9 / total : 0;
+
+    if (bench_json) {
+        fprintf(bench_report, "{\"corpus\": \"%s\", \"step\": \"%s\", \"ops\": %d, \"ops_per_sec\": %.0f, \"p50_us\": %.1f, \"p99_us\": %.1f}\n",
+            corpus, step, st->n, opsps, p50, p99);
+    } else {
+        fprintf(bench_report, "%-10s %-16s %8d %14.0f %12.1f %12.1f\n", corpus, step, st->n, opsps, p50, p99);
+    }
+    fflush(bench_report);
+    st->n = 0;
+}
+
+// Feeds a key sequence to the editor the way the terminal would,
+// applies the keys and draws the screen into the null sink
+void editorBenchKeys(const char *keys) {
+    int len = strlen(keys);
+    memcpy(E.inbuf, keys, len);
+    E.inlen = len;
+    E.inpos = 0;
+
+    while (E.inpos < E.inlen) {
+        editorProcessKeypress();
+        editorScrollWindow();
+    }
+
+    editorRefreshScreen();
+}
+
+// Times count operations that each send the same keys
+void editorBenchRepeat(const char *corpus, const char *step, const char *keys, int count) {
+    struct benchStat st = { NULL, 0, 0 };
+
+    for (int j = 0; j < count; j++) {
+        long long t0 = editorMonotonicNs();
+        editorBenchKeys(keys);
+        editorBenchRecord(&st, t0);
+    }
+
+    editorBenchReport(corpus, step, &st);
+    free(st.ns);
+}
+
+// Puts the cursor at a position of the buffer with the screen scrolled to the top,
+// the next redraw scrolls it to the cursor
+void editorBenchMoveTo(int cy, int cx) {
+    E.cy = cy;
+    E.cx = cx;
+    E.rowoff = 0;
+    E.coloff = 0;
+}
+
+// Returns the index of the longest row of the buffer
+int editorBenchLongestRow() {
+    int longest = 0;
+    for (int j = 1; j < E.numrows; j++) {
+        if (editorRowAt(j)->size > editorRowAt(longest)->size) longest = j;
+    }
+    return longest;
+}
+
+// Returns the next number of a xorshift generator, the fuzz step has to
+// press the same keys on every run so a failure can be repeated
+unsigned int editorBenchRandom(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Returns a hash of the text of the buffer, to tell if undo put it back
+unsigned long long editorBenchHash() {
+    unsigned long long h = 14695981039346656037ULL;
+    for (int j = 0; j < E.numrows; j++) {
+        erow *row = editorRowAt(j);
+        for (int k = 0; k < row->size; k++) h = (h ^ (unsigned char) row->chars[k]) * 1099511628211ULL;
+        h = (h ^ '\n') * 1099511628211ULL;
+    }
+    return h;
+}
+
+// Presses bursts of random keys and pastes at random places of the corpus and
+// checks the cursor stays on the text after each, then undoes all of it and
+// checks the corpus is back to what it was
+// Only the keys that edit or move are pressed, the ones that open a prompt,
+// save or quit would wait for input the benchmark doesn't send
+void editorBenchFuzz(const char *corpus, int rounds, unsigned int seed) {
+    static const char *keys[] = {
+        "a", "Z", " ", "\t", "{", "}", "/*", "*/", "//", "\"", "#", "\xc3\xa9", "\xe6\x97\xa5",
+        "\r", "\x7f", "\x08", "\x1b[3~", "\x1b[A", "\x1b[B", "\x1b[C", "\x1b[D",
+        "\x1b[H", "\x1b[F", "\x1b[5~", "\x1b[6~", "\x1a", "\x19"
+    };
+    static const char *pasted[] = { "x", "\n", "\t", " ", "/*", "*/", "\xc3\xa9" };
+    const int nkeys = sizeof(keys) / sizeof(keys[0]);
+    const int npasted = sizeof(pasted) / sizeof(pasted[0]);
+    struct benchStat st = { NULL, 0, 0 };
+    unsigned int state = seed;
+    char burst[INPUT_BUF_SIZE / 2];
+
+    unsigned long long before = editorBenchHash();
+    int numrows = E.numrows;
+
+    for (int j = 0; j < rounds; j++) {
+        // Start somewhere in the corpus each time, the longest row every so often
+        int y = j % 4 ? (int) (editorBenchRandom(&state) % (E.numrows + 1)) : editorBenchLongestRow();
+        int x = 0;
+        if (y < E.numrows) {
+            erow *row = editorRowAt(y);
+            x = editorUtf8Start(row->chars, row->size, editorBenchRandom(&state) % (row->size + 1));
+        }
+        editorBenchMoveTo(y, x);
+
+        // A burst of single keys with a bracketed paste among them now and then,
+        // always short enough to leave room in the input buffer
+        int len = 0;
+        while (len < (int) sizeof(burst) - 64) {
+            if (editorBenchRandom(&state) % 16 == 0) {
+                len += sprintf(&burst[len], "\x1b[200~");
+                for (int n = editorBenchRandom(&state) % 16; n > 0; n--) {
+                    len += sprintf(&burst[len], "%s", pasted[editorBenchRandom(&state) % npasted]);
+                }
+                len += sprintf(&burst[len], "\x1b[201~");
+            } else {
+                len += sprintf(&burst[len], "%s", keys[editorBenchRandom(&state) % nkeys]);
+            }
+            if (editorBenchRandom(&state) % 32 == 0) break;
+        }
+
+        long long t0 = editorMonotonicNs();
+        editorBenchKeys(burst);
+        editorBenchRecord(&st, t0);
+
+        erow *row = E.cy < E.numrows ? editorRowAt(E.cy) : NULL;
+        if (E.cy < 0 || E.cy > E.numrows || E.cx < 0 || (row == NULL && E.cx != 0) ||
+            (row != NULL && (E.cx > row->size || (E.cx < row->size && (row->chars[E.cx] & 0xc0) == 0x80)))) {
+            fprintf(stderr, "%s: fuzz round %d (seed %u) left the cursor at %d,%d off the text\n", corpus, j, seed, E.cy, E.cx);
+            exit(1);
+        }
+    }
+
+    while (E.undo.current != NULL) editorUndo();
+    if (E.numrows != numrows || editorBenchHash() != before) {
+        fprintf(stderr, "%s: undoing the fuzz rounds (seed %u) doesn't bring the corpus back\n", corpus, seed);
+        exit(1);
+    }
+    editorBenchMoveTo(0, 0);
+
+    editorBenchReport(corpus, "fuzz", &st);
+    free(st.ns);
+}
+
+// Times opening the corpus and then highlighting all of it, on a fresh buffer each round
+// Highlighting covers scanning the comment state of every row and rendering and highlighting
+// each of them, like scrolling from the top to the bottom would, without the drawing
+// Both happen once per file, so a single time is too noisy to compare runs by, the median of a few isn't
+void editorBenchOpen(const char *corpus, char *path, int rounds) {
+    struct benchStat open = { NULL, 0, 0 };
+    struct benchStat hl = { NULL, 0, 0 };
+
+    for (int r = 0; r < rounds; r++) {
+        // Free the rows of the round before, the way closing its buffer would
+        if (r > 0) {
+            editorBufferPark(&E.buffers[E.curbuffer]);
+            editorStoreRelease(&E.buffers[E.curbuffer]);
+            editorUndoClear();
+            free(E.filename);
+            editorBufferInit();
+        }
+
+        long long t0 = editorMonotonicNs();
+        editorOpen(path);
+        editorRefreshScreen();
+        editorBenchRecord(&open, t0);
+
+        // Start over like after the filetype is set, so long rows, which are
+        // only highlighted a window at a time, still have their comment state scanned
+        t0 = editorMonotonicNs();
+        for (int j = 0; j < E.numrows; j++) editorRowAt(j)->flags |= ROW_HL_STALE;
+        E.hl_dirty = 0;
+        E.hl_dirty_end = E.numrows;
+        editorSyntaxPropagate(E.numrows, 1000000000LL);
+        for (int j = 0; j < E.numrows; j++) editorRowMaterialize(j);
+        editorBenchRecord(&hl, t0);
+    }
+
+    editorBenchReport(corpus, "open", &open);
+    editorBenchReport(corpus, "highlight", &hl);
+    free(open.ns);
+    free(hl.ns);
+}
+
+// Times adding lines appended to the corpus to the buffer following it
+// Following stops and starts again every round, which must go on from the
+// end of the lines already added instead of adding them a second time
+void editorBenchFollow(const char *corpus, char *path, int rounds) {
+    struct benchStat st = { NULL, 0, 0 };
+    int numrows = E.numrows;
+
+    for (int r = 0; r < rounds; r++) {
+        FILE *fp = fopen(path, "a");
+        if (fp == NULL) die(path);
+        for (int j = 0; j < BENCH_FOLLOW_LINES; j++) fprintf(fp, "appended %d of round %d\n", j, r);
+        fclose(fp);
+
+        long long t0 = editorMonotonicNs();
+        editorFollowStart();
+        while (editorFollowPending()) editorFollowIdle();
+        editorRefreshScreen();
+        editorBenchRecord(&st, t0);
+        editorFollowStop();
+
+        numrows += BENCH_FOLLOW_LINES;
+        if (E.numrows != numrows) {
+            fprintf(stderr, "following %s again gave %d lines instead of %d\n", path, E.numrows, numrows);
+            exit(1);
+        }
+    }
+
+    // The steps after this one start from the top, like on the other corpora
+    editorBenchMoveTo(0, 0);
+
+    editorBenchReport(corpus, "follow", &st);
+    free(st.ns);
+}
+
+// Times typing a search query one char at a time
+// Each operation lasts until the match list for the query is complete,
+// including the scan by the search workers on large buffers
+void editorBenchFind(const char *corpus, const char *query, int rounds) {
+    struct benchStat st = { NULL, 0, 0 };
+    char typed[64];
+    int len = strlen(query);
+
+    for (int r = 0; r < rounds; r++) {
+        for (int j = 1; j <= len && j < (int) sizeof(typed); j++) {
+            memcpy(typed, query, j);
+            typed[j] = '\0';
+
+            long long t0 = editorMonotonicNs();
+            editorFindCallback(typed, query[j - 1]);
+            while (editorSearchScanning()) {
+                struct pollfd pfd = { E.search.notify[0], POLLIN, 0 };
+                poll(&pfd, 1, 100);
+                editorSearchCollect();
+            }
+            editorRefreshScreen();
+            editorBenchRecord(&st, t0);
+        }
+
+        // Leave the prompt the way the escape key does
+        editorFindCallback(typed, '\x1b');
+    }
+
+    editorBenchReport(corpus, "find", &st);
+    free(st.ns);
+}
+
+// Times typing a comment delimiter at the end of the first line and taking it out again,
+// which changes the comment state of the rows after it
+// Each operation includes scanning the whole file, like the idle time after the keys would
+// With check set, the corpus is supposed to be one where the change reaches past the
+// screen, and the benchmark fails if the comment state of the row below the screen doesn't flip
+void editorBenchCommentToggle(const char *corpus, const char *delim, int count, int check) {
+    struct benchStat st = { NULL, 0, 0 };
+    char keys[16], undo[16];
+    int len = strlen(delim);
+    snprintf(keys, sizeof(keys), "\x1b[F%s", delim);
+    snprintf(undo, sizeof(undo), "\x1b[F%.*s", len, "\x7f\x7f\x7f\x7f\x7f\x7f\x7f\x7f");
+
+    // The row just below the screen, or the last one of a shorter file
+    int probe = E.numrows - 1 < E.screenrows ? E.numrows - 1 : E.screenrows;
+    editorSyntaxPropagate(E.numrows, 1000000000LL);
+    int before = E.numrows > 0 ? editorRowAt(probe)->hl_open_comment : 0;
+
+    for (int j = 0; j < count; j++) {
+        editorBenchMoveTo(0, 0);
+
+        long long t0 = editorMonotonicNs();
+        editorBenchKeys(j % 2 ? undo : keys);
+        editorSyntaxPropagate(E.numrows, 1000000000LL);
+        editorBenchRecord(&st, t0);
+
+        if (check && editorRowAt(probe)->hl_open_comment != (j % 2 ? before : !before)) {
+            fprintf(stderr, "%s: typing %s on the first line doesn't reach past the screen\n", corpus, delim);
+            exit(1);
+        }
+    }
+
+    editorBenchReport(corpus, "comment-toggle", &st);
+    free(st.ns);
+}
+
+// Writes a C file with the given number of small functions
+void editorBenchWriteCode(FILE *fp, int functions) {
+    for (int j = 0; j < functions; j++) {
+        fprintf(fp, "/* function %d */\n", j);
+        fprintf(fp, "int func%d(int a, char *s) {\n", j);
+        fprintf(fp, "\tint x = a + %d;\n", j);
+        fprintf(fp, "\tif (x > 0) return x * 2.5;\n");
+        fprintf(fp, "\tprintf(\"value %%d\\n\", x); // print it\n");
+        fprintf(fp, "}\n\n");
+    }
+}
+
+// Writes a few very long lines, like minified JSON or JavaScript
+void editorBenchWriteLongLines(FILE *fp, int lines, int linelen) {
+    for (int j = 0; j < lines; j++) {
+        int written = fprintf(fp, "var data%d = [", j);
+        for (int k = 0; written < linelen; k++) {
+            written += fprintf(fp, "{\"key%d\": [1, 2.5, \"str\"]}, ", k);
+        }
+        fprintf(fp, "0];\n");
+    }
+}
+
+// Writes a file that is almost all one multi-line comment, opened on the first line
+void editorBenchWriteDeepComment(FILE *fp, int lines) {
+    fprintf(fp, "int x; /* the comment starts here\n");
+    for (int j = 0; j < lines; j++) {
+        fprintf(fp, "   line %d of the comment with int, \"a string\" and 42\n", j);
+    }
+    fprintf(fp, "*/ int y;\n");
+}
+
+// Writes C with UTF-8 strings and comments: accents, CJK, combining marks and emoji,
+// so every row takes the glyph layout path
+void editorBenchWriteUtf8(FILE *fp, int functions) {
+    for (int j = 0; j < functions; j++) {
+        fprintf(fp, "// f\xc3\xbcnction %d, \xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\n", j);
+        fprintf(fp, "const char *name%d = \"caf\xc3\xa9 e\xcc\x81t\xc3\xa9\";\n", j);
+        fprintf(fp, "\tint w%d = 2; // \xef\xbc\xb7\xef\xbc\xa9\xef\xbc\xa4\xef\xbc\xa5 \xf0\x9f\x98\x80\n\n", j);
+    }
+}
+
+// Writes a million lines of a few chars each, like a log or a data file
+void editorBenchWriteShortLines(FILE *fp, int lines) {
+    for (int j = 0; j < lines; j++) {
+        fprintf(fp, "x%d = %d;\n", j, j % 100);
+    }
+}
+
+// Writes a checked-in file over and over until the corpus is at least the given size
+// The files are small, so they can be read and reviewed, and big enough once repeated
+void editorBenchWriteTiled(FILE *fp, const char *seed, long bytes) {
+    const char *dir = getenv(BENCH_CORPUS_ENV);
+    if (dir == NULL) dir = BENCH_CORPUS_DIR;
+    size_t len = strlen(dir) + strlen(seed) + 2;
+    char *path = malloc(len);
+    if (path == NULL) die("malloc");
+    snprintf(path, len, "%s/%s", dir, seed);
+
+    FILE *in = fopen(path, "r");
+    if (in == NULL) die(path);
+
+    char buf[4096];
+    size_t n;
+    long written = 0;
+    while (written < bytes) {
+        rewind(in);
+        while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+            fwrite(buf, 1, n, fp);
+            written += n;
+        }
+        // An empty file would never get there
+        if (written == 0) die(path);
+    }
+
+    fclose(in);
+    free(path);
+}
+
+// A corpus the benchmark runs every step on
+struct benchCorpus {
+    const char *name; // Name of the corpus in the results
+    const char *seed; // Checked-in file in BENCH_CORPUS_DIR that's repeated into the corpus, NULL for generated ones
+    const char *query; // Typed into the search prompt by the find step
+    const char *delim; // Typed at the end of the first line and taken out again by the comment-toggle step
+    int follow; // Whether lines are appended to the corpus while it's followed, like to a log
+    int toggles; // Whether the comment-toggle step changes the comment state past the screen, only then it's gated
+};
+
+// Opening a comment on the first line comments out everything after it,
+// closing the comment of the comment corpus early uncomments everything
+// In the code, utf8 and tabs corpora a comment or line comment near the top
+// ends the change before it leaves the screen
+struct benchCorpus BENCH_CORPORA[] = {
+    { "code", NULL, "func123", "/*", 0, 0 },
+    { "longlines", NULL, "key77", "/*", 0, 1 },
+    { "comment", NULL, "comment", "*/", 0, 1 },
+    { "utf8", NULL, "name123", "/*", 0, 0 },
+    { "lines", NULL, "x999999", "/*", 1, 1 },
+    { "oneline", NULL, "key1234567", "/*", 0, 1 },
+    { "nesting", "nesting.c", "nesting_starts_here", "/*", 0, 1 },
+    { "tabs", "tabs.c", "alternating", "/*", 0, 0 },
+};
+
+// Writes the corpus at the given index of BENCH_CORPORA
+void editorBenchWriteCorpus(FILE *fp, int kind) {
+    const struct benchCorpus *c = &BENCH_CORPORA[kind];
+    if (c->seed) {
+        editorBenchWriteTiled(fp, c->seed, BENCH_TILE_BYTES);
+        return;
+    }
+
+    switch (kind) {
+        case 0: editorBenchWriteCode(fp, 40000); break;
+        case 1: editorBenchWriteLongLines(fp, 8, 1 << 20); break;
+        case 2: editorBenchWriteDeepComment(fp, 200000); break;
+        case 3: editorBenchWriteUtf8(fp, 60000); break;
+        case 4: editorBenchWriteShortLines(fp, 1000000); break;
+        case 5: editorBenchWriteLongLines(fp, 1, 50 << 20); break;
+    }
+}
+
+// Runs every benchmark step on one corpus
+// Runs in its own process, so every corpus starts with a fresh editor
+void editorBenchCorpus(int kind) {
+    const struct benchCorpus *c = &BENCH_CORPORA[kind];
+
+    // Generate the corpus into a .c file, so it's opened with C highlighting
+    char path[] = "/tmp/simple-text-editor-bench-XXXXXX.c";
+    int fd = mkstemps(path, 2);
+    if (fd == -1) die("mkstemps");
+    FILE *fp = fdopen(fd, "w");
+    if (fp == NULL) die("fdopen");
+
+    editorBenchWriteCorpus(fp, kind);
+    fclose(fp);
+
+    initEditor();
+
+    editorBenchOpen(c->name, path, BENCH_OPEN_ROUNDS);
+    if (c->follow) editorBenchFollow(c->name, path, 20);
+    editorBenchRepeat(c->name, "page-down", "\x1b[6~", 300);
+    editorBenchRepeat(c->name, "page-up", "\x1b[5~", 300);
+    editorBenchRepeat(c->name, "arrow-down", "\x1b[B", 2000);
+    editorBenchRepeat(c->name, "arrow-right", "\x1b[C", 2000);
+    editorBenchRepeat(c->name, "end-home", "\x1b[F\x1b[H", 500);
+
+    // The cursor keys may have left the cursor past the last row,
+    // the edits start at the top like a session on the file would
+    editorBenchMoveTo(0, 0);
+    editorBenchRepeat(c->name, "type", "x", 2000);
+    editorBenchRepeat(c->name, "backspace", "\x7f", 1000);
+    editorBenchRepeat(c->name, "newline", "\r", 200);
+    editorBenchRepeat(c->name, "undo", "\x1a", 500);
+    editorBenchRepeat(c->name, "redo", "\x19", 500);
+
+    // The middle of the longest row is where an edit has the most to keep up to date
+    int longest = editorBenchLongestRow();
+    erow *row = editorRowAt(longest);
+    editorBenchMoveTo(longest, editorUtf8Start(row->chars, row->size, row->size / 2));
+    editorBenchRepeat(c->name, "type-long", "x", 500);
+    editorBenchRepeat(c->name, "backspace-long", "\x7f", 500);
+
+    // Put the corpus back the way it was opened for the steps after this, which
+    // look for its text and toggle a comment on its first line
+    while (E.undo.current != NULL) editorUndo();
+    editorBenchFuzz(c->name, 100, 2463534242u + kind);
+    editorBenchFind(c->name, c->query, 3);
+    editorBenchCommentToggle(c->name, c->delim, 20, c->toggles);
+
+    unlink(path);
+}
+
+// Opens a sample with the filetype of the syntax file loaded at the given index of E.syntaxes
+// and times how long it takes to highlight, so every file in the syntax directory is checked
+// to load and highlight without crashing each time the benchmark runs
+// Runs in its own process, like editorBenchCorpus()
+void editorBenchSyntax(unsigned int at) {
+    initEditor();
+
+    char report[160];
+    editorSyntaxLoadAll(report, sizeof(report));
+    if (report[0] != '\0') {
+        fprintf(stderr, "%s\n", report);
+        exit(1);
+    }
+
+    // Name the sample so it matches the filetype's first pattern
+    struct editorSyntax *syntax = &E.syntaxes[at];
+    const char *match = syntax->filematch[0];
+    size_t len = sizeof("/tmp/simple-text-editor-bench-XXXXXX") + strlen(match);
+    char *path = malloc(len);
+    if (path == NULL) die("malloc");
+    snprintf(path, len, "/tmp/simple-text-editor-bench-XXXXXX%s", match);
+
+    int fd = mkstemps(path, strlen(match));
+    if (fd == -1) die("mkstemps");
+    FILE *fp = fdopen(fd, "w");
+    if (fp == NULL) die("fdopen");
+    editorBenchWriteTiled(fp, "syntax.txt", BENCH_TILE_BYTES);
+    fclose(fp);
+
+    editorBenchOpen(syntax->filetype, path, BENCH_OPEN_ROUNDS);
+    if (E.syntax != syntax) {
+        fprintf(stderr, "%s isn't highlighted as %s\n", path, syntax->filetype);
+        exit(1);
+    }
+    editorBenchRepeat(syntax->filetype, "page-down", "\x1b[6~", 300);
+    if (syntax->multiline_comment_start)
+        editorBenchCommentToggle(syntax->filetype, syntax->multiline_comment_start, 20, 0);
+
+    unlink(path);
+    free(path);
+}
+
+// One line of a results file written with --json
+struct benchResult {
+    char corpus[32];
+    char step[32];
+    double p50;
+};
+
+// Steps whose latency --compare checks against the baseline: opening a file,
+// highlighting it all and again after a comment changes, searching, and drawing pages
+const char *BENCH_GATED[] = { "open", "highlight", "comment-toggle", "find", "page-down", "page-up" };
+
+// Whether --compare checks the step of the given corpus against the baseline
+// The comment-toggle step is only checked where it reaches past the screen,
+// elsewhere it times a few rows and says nothing about the scan of the rest
+int editorBenchGated(const char *corpus, const char *step) {
+    unsigned int g = 0;
+    while (g < BENCH_GATED_LEN && strcmp(BENCH_GATED[g], step) != 0) g++;
+    if (g == BENCH_GATED_LEN) return 0;
+
+    if (strcmp(step, "comment-toggle") != 0) return 1;
+    for (unsigned int j = 0; j < BENCH_CORPORA_LEN; j++) {
+        if (strcmp(BENCH_CORPORA[j].name, corpus) == 0) return BENCH_CORPORA[j].toggles;
+    }
+    return 0;
+}
+
+// Reads the results of --json runs, one JSON object per line
+// Only reads what editorBenchReport() writes, this isn't a JSON parser
+// A file can hold several runs, a step then gets its fastest p50, since a busy
+// machine only ever makes a run slower
+// Returns the number of results, or -1 if the file can't be read
+int editorBenchLoad(const char *path, struct benchResult **out) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct benchResult *res = NULL;
+    int n = 0, cap = 0;
+    char *line = NULL;
+    size_t linecap = 0;
+    while (getline(&line, &linecap, fp) != -1) {
+        struct benchResult r;
+        if (sscanf(line, "{\"corpus\": \"%31[^\"]\", \"step\": \"%31[^\"]\", \"ops\": %*d, \"ops_per_sec\": %*f, \"p50_us\": %lf",
+                r.corpus, r.step, &r.p50) != 3) continue;
+
+        int j;
+        for (j = 0; j < n; j++) {
+            if (strcmp(res[j].corpus, r.corpus) == 0 && strcmp(res[j].step, r.step) == 0) break;
+        }
+        if (j < n) {
+            if (r.p50 < res[j].p50) res[j].p50 = r.p50;
+            continue;
+        }
+
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            res = realloc(res, sizeof(struct benchResult) * cap);
+            if (res == NULL) die("realloc");
+        }
+        res[n++] = r;
+    }
+
+    free(line);
+    fclose(fp);
+    *out = res;
+    return n;
+}
+
+// Compares the gated steps of a results file with a baseline file
+// A step regresses when its p50 latency is more than threshold percent and
+// more than BENCH_NOISE_US slower, a step missing from the results regresses too
+// Returns the exit status: 0 if nothing regressed, 1 if something did, 2 if a file can't be read
+int editorBenchCheck(const char *basepath, const char *respath, int threshold) {
+    struct benchResult *base, *res;
+    int nbase = editorBenchLoad(basepath, &base);
+    if (nbase == -1) return 2;
+    int nres = editorBenchLoad(respath, &res);
+    if (nres == -1) return 2;
+
+    printf("%-10s %-16s %12s %12s %9s\n", "corpus", "step", "base p50 us", "p50 us", "change");
+
+    int regressed = 0;
+    for (int j = 0; j < nbase; j++) {
+        if (!editorBenchGated(base[j].corpus, base[j].step)) continue;
+
+        struct benchResult *r = NULL;
+        for (int k = 0; k < nres && r == NULL; k++) {
+            if (strcmp(res[k].corpus, base[j].corpus) == 0 && strcmp(res[k].step, base[j].step) == 0)
+                r = &res[k];
+        }
+
+        if (r == NULL) {
+            printf("%-10s %-16s %12.1f %12s %9s  missing\n", base[j].corpus, base[j].step, base[j].p50, "-", "-");
+            regressed++;
+            continue;
+        }
+
+        double change = base[j].p50 > 0 ? (r->p50 - base[j].p50) * 100 / base[j].p50 : 0;
+        int slow = change > threshold && r->p50 - base[j].p50 > BENCH_NOISE_US;
+        printf("%-10s %-16s %12.1f %12.1f %+8.0f%%%s\n", base[j].corpus, base[j].step, base[j].p50, r->p50,
+            change, slow ? "  REGRESSED" : "");
+        regressed += slow;
+    }
+
+    if (regressed) printf("%d step(s) regressed more than %d%% against %s\n", regressed, threshold, basepath);
+    else printf("no step regressed more than %d%% against %s\n", threshold, basepath);
+
+    free(base);
+    free(res);
+    return regressed ? 1 : 0;
+}
+
+// Runs the benchmark on each corpus, or on the corpora named on the command line,
+// and prints a line per step
+// The editor draws into /dev/null, so the numbers don't depend on a terminal
+// Usage: simple-text-editor-bench [--json] [corpus...]
+//        simple-text-editor-bench --compare baseline.json results.json [threshold percent]
+int main(int argc, char *argv[]) {
+    if (argc >= 4 && strcmp(argv[1], "--compare") == 0)
+        return editorBenchCheck(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : BENCH_THRESHOLD_PERCENT);
+
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "--json") == 0) {
+        bench_json = 1;
+        first = 2;
+    }
+
+    // Keep stdout for the results and send the editor's output to the null sink 
+    bench_report = fdopen(dup(STDOUT_FILENO), "w");
+    if (bench_report == NULL) die("fdopen");
+    int null = open("/dev/null", O_RDWR);
+    if (null == -1) die("open");
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+
+    // Check the syntax files that come with the editor, not the ones in the home directory
+    setenv(SYNTAX_DIR_ENV, BENCH_SYNTAX_DIR, 0);
+
+    if (!bench_json) {
+        fprintf(bench_report, "%-10s %-16s %8s %14s %12s %12s\n", "corpus", "step", "ops", "ops/sec", "p50 us", "p99 us");
+        fflush(bench_report);
+    }
+
+    for (unsigned int kind = 0; kind < BENCH_CORPORA_LEN; kind++) {
+        // Skip corpora that weren't asked for
+        int wanted = (first == argc);
+        for (int j = first; j < argc; j++) {
+            if (strcmp(argv[j], BENCH_CORPORA[kind].name) == 0) wanted = 1;
+        }
+        if (!wanted) continue;
+
+        pid_t pid = fork();
+        if (pid == -1) die("fork");
+        if (pid == 0) {
+            editorBenchCorpus(kind);
+            fflush(bench_report);
+            _exit(0);
+        }
+
+        int status;
+        if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "benchmark of %s failed\n", BENCH_CORPORA[kind].name);
+            return 1;
+        }
+    }
+
+    // Then every syntax file, named by its filetype, loaded here only to count them
+    char report[160];
+    editorSyntaxLoadAll(report, sizeof(report));
+    for (unsigned int at = 0; at < E.nsyntaxes; at++) {
+        const char *name = E.syntaxes[at].filetype;
+        int wanted = (first == argc);
+        for (int j = first; j < argc; j++) {
+            if (strcmp(argv[j], name) == 0) wanted = 1;
+        }
+        if (!wanted) continue;
+
+        pid_t pid = fork();
+        if (pid == -1) die("fork");
+        if (pid == 0) {
+            editorBenchSyntax(at);
+            fflush(bench_report);
+            _exit(0);
+        }
+
+        int status;
+        if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "benchmark of syntax file for %s failed\n", name);
+            return 1;
+        }
+    }
+    if (report[0] != '\0') {
+        fprintf(stderr, "%s\n", report);
+        return 1;
+    }
+
+    return 0;
+}
+
+#endif
+
+#ifndef EDITOR_BENCH
 int main(int argc, char *argv[]) {
     enableRawMode();
     initEditor();
+    editorSignalsInit();
+
+    // Filetypes from syntax files have to be known before the files are opened
+    char syntaxreport[80];
+    editorSyntaxLoadAll(syntaxreport, sizeof(syntaxreport));
+
+    // With -R the files are only viewed, see editorViewOpen(),
+    // with -F they're followed as they grow, see editorFollowStart()
+    int view = 0;
+    int follow = 0;
+    int first = 1;
+    for (; first < argc; first++) {
+        if (strcmp(argv[first], "-R") == 0) view = 1;
+        else if (strcmp(argv[first], "-F") == 0) follow = 1;
+        else break;
+    }
 
-    if (argc >= 2) {
-        editorOpen(argv[1]);
+    // Every file named on the command line gets a buffer, the first one is shown
+    if (argc > first) {
+        if (view) editorViewOpen(argv[first]);
+        else editorOpen(argv[first]);
+        if (follow) editorFollowStart();
+    }
+    int j;
+    for (j = first + 1; j < argc; j++) {
+        editorBufferOpen(argv[j], view);
+        if (follow) editorFollowStart();
     }
+    editorBufferSwitch(0);
 
-    // Set initial status message to help message with key bindings
-    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+    // Set initial status message to help message with key bindings,
+    // unless a syntax file couldn't be loaded
+    if (syntaxreport[0] != '\0') editorSetStatusMessage("%s", syntaxreport);
+    else editorSetStatusMessage("HELP: Ctrl-S save | Ctrl-Q quit | Ctrl-F find | Ctrl-R regex | Ctrl-Z undo");
 
     while (1) {
         editorRefreshScreen();
-        editorProcessKeypress();
+
+        // Apply every key that has already arrived before drawing again,
+        // so a burst of input is drawn once instead of once per key
+        long long deadline = editorMonotonicUs() + INPUT_BATCH_US;
+        do {
+            editorProcessKeypress();
+
+            // Keep the window on the cursor between keys that aren't drawn
+            editorScrollWindow();
+        } while (editorInputPending() && editorMonotonicUs() < deadline);
     }
 
     return 0;
 }
+#endif